@@ -50,6 +50,7 @@
 #include "gstomx_videosink.h"
 #include "gstomx_filereadersrc.h"
 #include "gstomx_volume.h"
+#include "gstomx_trace.h"
 
 #include "config.h"
 
@@ -66,6 +67,7 @@ plugin_init (GstPlugin *plugin)
     GST_DEBUG_CATEGORY_INIT (gstomx_util_debug, "omx_util", 0, "gst-openmax utility");
 
     g_omx_init ();
+    g_omx_trace_init ();
 
     if (!gst_element_register (plugin, "omx_dummy", GST_RANK_NONE, GST_OMX_DUMMY_TYPE))
     {
@@ -189,6 +189,8 @@ sink_setcaps (GstPad *pad,
 
     GST_INFO_OBJECT (omx_base, "setcaps (sink): %" GST_PTR_FORMAT, caps);
 
+    gst_omx_base_filter_eager_prepare (omx_base);
+
     return gst_pad_set_caps (pad, caps);
 }
 
@@ -162,6 +162,8 @@ sink_setcaps (GstPad *pad,
         gst_caps_unref (tmp_caps);
     }
 
+    gst_omx_base_filter_eager_prepare (omx_base);
+
     return gst_pad_set_caps (pad, caps);
 }
 
@@ -352,6 +352,9 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base->gomx->settings_changed_cb = settings_changed_cb;
 
+    omx_base->output_packer = gst_omx_packer_new (32, 320, 20 * GST_MSECOND,
+                                                  gst_omx_packer_amrnb_frame_length);
+
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
 
     self->bitrate = DEFAULT_BITRATE;
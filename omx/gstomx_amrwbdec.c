@@ -161,6 +161,9 @@ type_instance_init (GTypeInstance *instance,
     omx_base->omx_component = g_strdup (OMX_COMPONENT_NAME);
 
     omx_base->gomx->settings_changed_cb = settings_changed_cb;
+
+    omx_base->input_packer = gst_omx_packer_new (61, 640, 20 * GST_MSECOND,
+                                                 gst_omx_packer_amrwb_frame_length);
 }
 
 GType
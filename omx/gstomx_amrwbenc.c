@@ -345,6 +345,9 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base->gomx->settings_changed_cb = settings_changed_cb;
 
+    omx_base->output_packer = gst_omx_packer_new (61, 640, 20 * GST_MSECOND,
+                                                  gst_omx_packer_amrwb_frame_length);
+
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
 
     self->bitrate = DEFAULT_BITRATE;
@@ -22,20 +22,91 @@
 #include "gstomx_base_filter.h"
 #include "gstomx.h"
 #include "gstomx_interface.h"
+#include "gstomx_trace.h"
 
 #include <stdlib.h> /* For calloc, free */
 #include <string.h> /* For memcpy */
 
+/* Not in our headers; same value as in OpenMAX IL 1.1.2. */
+#ifndef OMX_BUFFERFLAG_CODECCONFIG
+#define OMX_BUFFERFLAG_CODECCONFIG 0x00000080
+#endif
+
+/* Input buffers submitted at once for a single GstBuffer. */
+#define MAX_INPUT_BATCH 16
+
+/* Milliseconds a partly coalesced input buffer waits for more input when
+ * coalesce-time doesn't say. */
+#define COALESCE_FLUSH_INTERVAL 100
+
 enum
 {
     ARG_0,
     ARG_COMPONENT_NAME,
     ARG_LIBRARY_NAME,
     ARG_USE_TIMESTAMPS,
+    ARG_STALL_TIMEOUT,
+    ARG_DROP_ON_STALL,
+    ARG_STATS,
+    ARG_STATE_TIMEOUT,
+    ARG_DISPATCH_CALLBACKS,
+    ARG_EAGER_PREPARE,
+    ARG_PRIORITY,
+    ARG_ADMISSION_TIMEOUT,
+    ARG_ZERO_COPY_INPUT,
+    ARG_ZERO_COPY_OUTPUT,
+    ARG_COALESCE_BYTES,
+    ARG_COALESCE_TIME,
+    ARG_FRAMES_PER_BUFFER,
 };
 
 static GstElementClass *parent_class = NULL;
 
+static void
+flush_coalesced (GstOmxBaseFilter *self);
+
+/* Memory for zero-copy output comes from downstream when possible. */
+static GstBuffer *
+alloc_output_buffer (GOmxPort *port,
+                     guint size)
+{
+    GstOmxBaseFilter *self;
+    GstBuffer *buf = NULL;
+
+    self = port->core->client_data;
+
+    if (gst_pad_alloc_buffer (self->srcpad, GST_BUFFER_OFFSET_NONE, size,
+                              GST_PAD_CAPS (self->srcpad), &buf) != GST_FLOW_OK)
+    {
+        GST_INFO_OBJECT (self, "downstream allocation failed; using our own");
+        return NULL;
+    }
+
+    return buf;
+}
+
+/* Room for frames_per_buffer frames, so the component can take a whole
+ * packet at once. */
+static void
+resize_port (GstOmxBaseFilter *self,
+             OMX_PARAM_PORTDEFINITIONTYPE *param,
+             guint frame_size)
+{
+    guint size;
+
+    GST_OBJECT_LOCK (self);
+    size = frame_size * self->output_packer->frames_per_buffer;
+    GST_OBJECT_UNLOCK (self);
+
+    if (param->nBufferSize >= size)
+        return;
+
+    /* this is against the standard; nBufferSize is read-only. */
+    param->nBufferSize = size;
+    OMX_SetParameter (self->gomx->omx_handle, OMX_IndexParamPortDefinition, param);
+    OMX_GetParameter (self->gomx->omx_handle, OMX_IndexParamPortDefinition, param);
+}
+
 static void
 setup_ports (GstOmxBaseFilter *self)
 {
@@ -53,14 +124,22 @@ setup_ports (GstOmxBaseFilter *self)
 
     param->nPortIndex = 0;
     OMX_GetParameter (core->omx_handle, OMX_IndexParamPortDefinition, param);
+    if (self->output_packer)
+        resize_port (self, param, self->output_packer->raw_frame_size);
     self->in_port = g_omx_core_setup_port (core, param);
+    self->in_port->zero_copy = self->zero_copy_input;
     gst_pad_set_element_private (self->sinkpad, self->in_port);
 
     /* Output port configuration. */
 
     param->nPortIndex = 1;
     OMX_GetParameter (core->omx_handle, OMX_IndexParamPortDefinition, param);
+    if (self->output_packer)
+        resize_port (self, param, self->output_packer->frame_size);
     self->out_port = g_omx_core_setup_port (core, param);
+    self->out_port->zero_copy = self->zero_copy_output;
+    self->out_port->alloc_cb = alloc_output_buffer;
+    self->out_port->reconfigurable = TRUE;
     gst_pad_set_element_private (self->srcpad, self->out_port);
 
     free (param);
@@ -85,6 +164,12 @@ change_state (GstElement *element,
     {
         case GST_STATE_CHANGE_NULL_TO_READY:
             g_omx_core_init (self->gomx, self->omx_library, self->omx_component);
+            if (self->gomx->omx_error == OMX_ErrorInsufficientResources)
+            {
+                GST_ELEMENT_ERROR (self, RESOURCE, BUSY, (NULL),
+                                   ("no session of %s left", self->omx_component));
+                return GST_STATE_CHANGE_FAILURE;
+            }
             if (self->gomx->omx_error)
                 return GST_STATE_CHANGE_FAILURE;
             break;
@@ -115,8 +200,18 @@ change_state (GstElement *element,
             if (self->initialized)
             {
                 g_omx_core_finish (self->gomx);
+                if (self->gomx->omx_error)
+                    GST_WARNING_OBJECT (self, "finish failed: 0x%08x", self->gomx->omx_error);
+                GST_OBJECT_LOCK (self);
                 self->initialized = FALSE;
+                GST_OBJECT_UNLOCK (self);
             }
+            if (self->timestamps)
+                gst_omx_timestamps_reset (self->timestamps);
+            if (self->output_packer)
+                gst_omx_packer_reset (self->output_packer);
+            /* Freed along with the rest of the port. */
+            self->coalesce_buffer = NULL;
             break;
 
         case GST_STATE_CHANGE_READY_TO_NULL:
@@ -134,6 +229,42 @@ change_state (GstElement *element,
     return ret;
 }
 
+/* Called from the state thread of the core, or from the component on
+ * errors outside of a state change. */
+static void
+state_changed (GOmxCore *core,
+               OMX_STATETYPE state,
+               OMX_ERRORTYPE error)
+{
+    GstOmxBaseFilter *self;
+
+    self = core->client_data;
+
+    if (error == OMX_ErrorNone)
+    {
+        GST_INFO_OBJECT (self, "component in state %d", state);
+        return;
+    }
+
+    /* Whoever waits for the state reports the failure. */
+    if (state != core->omx_state)
+    {
+        GST_WARNING_OBJECT (self, "state change to %d failed: 0x%08x", state, error);
+        return;
+    }
+
+    /* The session goes to a higher priority stream once we're shut down. */
+    if (error == OMX_ErrorResourcesPreempted)
+    {
+        GST_ELEMENT_ERROR (self, RESOURCE, BUSY, (NULL),
+                           ("component preempted by a higher priority stream"));
+        return;
+    }
+
+    GST_ELEMENT_WARNING (self, LIBRARY, FAILED, (NULL),
+                         ("component error: 0x%08x", error));
+}
+
 static void
 dispose (GObject *obj)
 {
@@ -149,6 +280,15 @@ dispose (GObject *obj)
 
     g_omx_core_free (self->gomx);
 
+    if (self->timestamps)
+        gst_omx_timestamps_free (self->timestamps);
+    if (self->output_packer)
+        gst_omx_packer_free (self->output_packer);
+    if (self->input_packer)
+        gst_omx_packer_free (self->input_packer);
+    if (self->framed_caps)
+        gst_caps_unref (self->framed_caps);
+
     g_free (self->omx_component);
     g_free (self->omx_library);
 
@@ -178,6 +318,50 @@ set_property (GObject *obj,
         case ARG_USE_TIMESTAMPS:
             self->use_timestamps = g_value_get_boolean (value);
             break;
+        case ARG_STALL_TIMEOUT:
+            self->stall_timeout = g_value_get_uint (value);
+            break;
+        case ARG_DROP_ON_STALL:
+            self->drop_on_stall = g_value_get_boolean (value);
+            break;
+        case ARG_ZERO_COPY_INPUT:
+            self->zero_copy_input = g_value_get_boolean (value);
+            break;
+        case ARG_ZERO_COPY_OUTPUT:
+            self->zero_copy_output = g_value_get_boolean (value);
+            break;
+        case ARG_STATE_TIMEOUT:
+            self->gomx->state_timeout = g_value_get_uint (value);
+            break;
+        case ARG_DISPATCH_CALLBACKS:
+            self->gomx->use_dispatcher = g_value_get_boolean (value);
+            break;
+        case ARG_PRIORITY:
+            self->gomx->priority = g_value_get_uint (value);
+            break;
+        case ARG_ADMISSION_TIMEOUT:
+            self->gomx->admission_timeout = g_value_get_uint (value);
+            break;
+        case ARG_EAGER_PREPARE:
+            self->eager_prepare = g_value_get_boolean (value);
+            break;
+        case ARG_COALESCE_BYTES:
+            self->coalesce_bytes = g_value_get_uint (value);
+            break;
+        case ARG_COALESCE_TIME:
+            self->coalesce_time = g_value_get_uint (value);
+            break;
+        case ARG_FRAMES_PER_BUFFER:
+            /* Fixed once the ports are sized for it. */
+            GST_OBJECT_LOCK (self);
+            if (!self->output_packer)
+                GST_WARNING_OBJECT (self, "no frame packing; ignoring frames-per-buffer");
+            else if (self->initialized)
+                GST_WARNING_OBJECT (self, "ports already set up; ignoring frames-per-buffer");
+            else
+                self->output_packer->frames_per_buffer = g_value_get_uint (value);
+            GST_OBJECT_UNLOCK (self);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -205,6 +389,56 @@ get_property (GObject *obj,
         case ARG_USE_TIMESTAMPS:
             g_value_set_boolean (value, self->use_timestamps);
             break;
+        case ARG_STALL_TIMEOUT:
+            g_value_set_uint (value, self->stall_timeout);
+            break;
+        case ARG_DROP_ON_STALL:
+            g_value_set_boolean (value, self->drop_on_stall);
+            break;
+        case ARG_STATS:
+            {
+                GstStructure *structure;
+
+                structure = gst_structure_empty_new ("omx-stats");
+                if (self->in_port)
+                    g_omx_port_append_stats (self->in_port, structure, "input");
+                if (self->out_port)
+                    g_omx_port_append_stats (self->out_port, structure, "output");
+                g_value_take_boxed (value, structure);
+            }
+            break;
+        case ARG_ZERO_COPY_INPUT:
+            g_value_set_boolean (value, self->zero_copy_input);
+            break;
+        case ARG_ZERO_COPY_OUTPUT:
+            g_value_set_boolean (value, self->zero_copy_output);
+            break;
+        case ARG_STATE_TIMEOUT:
+            g_value_set_uint (value, self->gomx->state_timeout);
+            break;
+        case ARG_DISPATCH_CALLBACKS:
+            g_value_set_boolean (value, self->gomx->use_dispatcher);
+            break;
+        case ARG_PRIORITY:
+            g_value_set_uint (value, self->gomx->priority);
+            break;
+        case ARG_ADMISSION_TIMEOUT:
+            g_value_set_uint (value, self->gomx->admission_timeout);
+            break;
+        case ARG_EAGER_PREPARE:
+            g_value_set_boolean (value, self->eager_prepare);
+            break;
+        case ARG_COALESCE_BYTES:
+            g_value_set_uint (value, self->coalesce_bytes);
+            break;
+        case ARG_COALESCE_TIME:
+            g_value_set_uint (value, self->coalesce_time);
+            break;
+        case ARG_FRAMES_PER_BUFFER:
+            GST_OBJECT_LOCK (self);
+            g_value_set_uint (value, self->output_packer ? self->output_packer->frames_per_buffer : 1);
+            GST_OBJECT_UNLOCK (self);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -245,6 +479,71 @@ type_class_init (gpointer g_class,
                                          g_param_spec_boolean ("use-timestamps", "Use timestamps",
                                                                "Whether or not to use timestamps",
                                                                TRUE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_STALL_TIMEOUT,
+                                         g_param_spec_uint ("stall-timeout", "Stall timeout",
+                                                            "Milliseconds to wait for the component to return a buffer (0 = forever)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_DISPATCH_CALLBACKS,
+                                         g_param_spec_boolean ("dispatch-callbacks", "Dispatch callbacks",
+                                                               "Queue the component callbacks and handle them in a separate thread",
+                                                               FALSE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_PRIORITY,
+                                         g_param_spec_uint ("priority", "Priority",
+                                                            "Priority of the component among those competing for resources (0 = highest)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_ADMISSION_TIMEOUT,
+                                         g_param_spec_uint ("admission-timeout", "Admission timeout",
+                                                            "Milliseconds to wait for a free session of a limited component (0 = fail at once)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_DROP_ON_STALL,
+                                         g_param_spec_boolean ("drop-on-stall", "Drop on stall",
+                                                               "Drop input buffers instead of erroring out when the component stalls",
+                                                               FALSE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_STATS,
+                                         g_param_spec_boxed ("stats", "Statistics",
+                                                             "Buffer residency, queue occupancy and starvation per port",
+                                                             GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_STATE_TIMEOUT,
+                                         g_param_spec_uint ("state-timeout", "State timeout",
+                                                            "Milliseconds to wait for a state change of the component (0 = forever)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_EAGER_PREPARE,
+                                         g_param_spec_boolean ("eager-prepare", "Eager prepare",
+                                                               "Prepare the component in the background as soon as the input caps are known, instead of on the first buffer",
+                                                               FALSE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_ZERO_COPY_INPUT,
+                                         g_param_spec_boolean ("zero-copy-input", "Zero-copy input",
+                                                               "Let upstream elements write directly into the input buffers of the component",
+                                                               FALSE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_ZERO_COPY_OUTPUT,
+                                         g_param_spec_boolean ("zero-copy-output", "Zero-copy output",
+                                                               "Push the output buffers of the component downstream without copying",
+                                                               FALSE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_COALESCE_BYTES,
+                                         g_param_spec_uint ("coalesce-bytes", "Coalesce bytes",
+                                                            "Gather small input buffers into one omx buffer until it holds this many bytes (0 = disabled)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_COALESCE_TIME,
+                                         g_param_spec_uint ("coalesce-time", "Coalesce time",
+                                                            "Gather small input buffers into one omx buffer until it holds this many milliseconds (0 = disabled)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_FRAMES_PER_BUFFER,
+                                         g_param_spec_uint ("frames-per-buffer", "Frames per buffer",
+                                                            "Number of codec frames packed in each output buffer (speech encoders only)",
+                                                            1, GST_OMX_PACKER_MAX_FRAMES, 1, G_PARAM_READWRITE));
     }
 }
 
@@ -256,12 +555,208 @@ push_buffer (GstOmxBaseFilter *self,
 
     /** @todo check if tainted */
     GST_LOG_OBJECT (self, "begin");
+    if (self->before_push)
+        self->before_push (self, buf);
+    g_atomic_int_set (&self->pushing, TRUE);
+    G_OMX_TRACE (G_OMX_TRACE_BEGIN, "push", self->gomx, buf);
     ret = gst_pad_push (self->srcpad, buf);
+    G_OMX_TRACE (G_OMX_TRACE_END, "push", self->gomx, buf);
+    g_atomic_int_set (&self->pushing, FALSE);
     GST_LOG_OBJECT (self, "end");
 
     return ret;
 }
 
+/* With frame packing the buffer may be held back until there are enough
+ * frames. */
+static inline GstFlowReturn
+push_output (GstOmxBaseFilter *self,
+             GstBuffer *buf)
+{
+    if (self->output_packer)
+    {
+        buf = gst_omx_packer_push (self->output_packer, buf);
+        if (!buf)
+            return GST_FLOW_OK;
+    }
+
+    return push_buffer (self, buf);
+}
+
+static inline OMX_BUFFERHEADERTYPE *
+request_buffer (GstOmxBaseFilter *self,
+                GOmxPort *port)
+{
+    GTimeVal end_time;
+
+    if (self->stall_timeout == 0)
+        return g_omx_port_request_buffer (port);
+
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, self->stall_timeout * 1000);
+
+    return g_omx_port_request_buffer_timed (port, &end_time);
+}
+
+static inline gboolean
+coalescing (GstOmxBaseFilter *self)
+{
+    return (self->coalesce_bytes || self->coalesce_time) &&
+        !self->repack_input && !self->input_packer;
+}
+
+static inline guint
+coalesce_flush_interval (GstOmxBaseFilter *self)
+{
+    return self->coalesce_time ? self->coalesce_time : COALESCE_FLUSH_INTERVAL;
+}
+
+/* While input is coalesced, the wait for output is cut short so a partly
+ * filled input buffer can be submitted when input stops; see
+ * flush_coalesced. */
+static OMX_BUFFERHEADERTYPE *
+request_output_buffer (GstOmxBaseFilter *self,
+                       GOmxPort *port)
+{
+    GTimeVal end_time;
+    guint timeout;
+
+    if (!coalescing (self))
+        return request_buffer (self, port);
+
+    timeout = coalesce_flush_interval (self);
+    if (self->stall_timeout)
+        timeout = MIN (timeout, self->stall_timeout);
+
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, timeout * 1000);
+
+    return g_omx_port_request_buffer_timed (port, &end_time);
+}
+
+/* Returns NULL when flushing, or when the component didn't give back an
+ * input buffer within stall-timeout; 'stalled' tells them apart. */
+static OMX_BUFFERHEADERTYPE *
+request_input_buffer (GstOmxBaseFilter *self,
+                      gboolean *stalled)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+    GOmxPort *in_port;
+
+    in_port = self->in_port;
+    *stalled = FALSE;
+
+    while (TRUE)
+    {
+        omx_buffer = request_buffer (self, in_port);
+
+        if (G_LIKELY (omx_buffer) ||
+            !g_atomic_int_get (&in_port->queue->enabled))
+        {
+            return omx_buffer;
+        }
+
+        /* Downstream back-pressure is not the component's fault. */
+        if (g_atomic_int_get (&self->pushing))
+        {
+            GST_DEBUG_OBJECT (self, "output blocked downstream; waiting");
+            continue;
+        }
+
+        *stalled = TRUE;
+        return NULL;
+    }
+}
+
+/* Waits for the output port to get the eos; FALSE if the component stalls.
+ * Output still coming out, or blocked downstream, keeps the wait going. */
+static gboolean
+wait_for_done (GstOmxBaseFilter *self)
+{
+    GOmxPort *out_port;
+    guint64 returned;
+
+    if (self->stall_timeout == 0)
+    {
+        g_omx_core_wait_for_done (self->gomx);
+        return TRUE;
+    }
+
+    out_port = self->out_port;
+    returned = G_MAXUINT64;
+
+    while (TRUE)
+    {
+        GTimeVal end_time;
+        guint64 last;
+
+        g_get_current_time (&end_time);
+        g_time_val_add (&end_time, self->stall_timeout * 1000);
+
+        if (g_omx_core_wait_for_done_timed (self->gomx, &end_time))
+            return TRUE;
+
+        last = returned;
+        g_mutex_lock (out_port->stats_mutex);
+        returned = out_port->stats.returned;
+        g_mutex_unlock (out_port->stats_mutex);
+
+        if (g_atomic_int_get (&self->pushing) || returned != last)
+        {
+            GST_DEBUG_OBJECT (self, "waiting for eos");
+            continue;
+        }
+
+        return FALSE;
+    }
+}
+
+static inline void
+set_timestamp (GstOmxBaseFilter *self,
+               GstBuffer *buf,
+               OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    if (self->timestamps)
+    {
+        GstClockTime hint = GST_CLOCK_TIME_NONE;
+
+        if (self->use_timestamps)
+            hint = gst_util_uint64_scale_int (omx_buffer->nTimeStamp, GST_SECOND,
+                                              OMX_TICKS_PER_SECOND);
+
+        if (gst_omx_timestamps_pop (self->timestamps, hint,
+                                    &GST_BUFFER_TIMESTAMP (buf),
+                                    &GST_BUFFER_DURATION (buf)))
+            GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+    }
+    else if (self->use_timestamps)
+    {
+        GST_BUFFER_TIMESTAMP (buf) = gst_util_uint64_scale_int (omx_buffer->nTimeStamp,
+                                                                GST_SECOND,
+                                                                OMX_TICKS_PER_SECOND);
+    }
+}
+
+static inline void
+set_buffer_flags (GstOmxBaseFilter *self,
+                  GstBuffer *buf,
+                  OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    /* Headers aren't frames; muxers take them from the caps. */
+    if (omx_buffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG)
+    {
+        GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_IN_CAPS);
+        GST_BUFFER_FLAG_UNSET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    else if (omx_buffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME)
+        GST_BUFFER_FLAG_UNSET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    else if (self->mark_delta_units)
+        GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    if ((omx_buffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) && GST_IS_OMX_BUFFER (buf))
+        GST_BUFFER_FLAG_SET (buf, GST_OMX_BUFFER_FLAG_END_OF_FRAME);
+}
+
 static void
 output_loop (gpointer data)
 {
@@ -285,18 +780,41 @@ output_loop (gpointer data)
 
     out_port = self->out_port;
 
+    /* New output settings; the input side keeps going meanwhile. */
+    if (G_UNLIKELY (g_atomic_int_get (&out_port->settings_changed)))
+    {
+        g_atomic_int_set (&out_port->settings_changed, FALSE);
+
+        g_omx_port_reconfigure (out_port);
+
+        if (gomx->settings_changed_cb)
+            gomx->settings_changed_cb (gomx);
+    }
+
     if (G_LIKELY (out_port->enabled))
     {
         OMX_BUFFERHEADERTYPE *omx_buffer = NULL;
+        gboolean wrapped = FALSE;
+        gboolean packing;
+
+        /* Held back buffers must not keep the component's own. */
+        packing = self->output_packer && self->output_packer->frames_per_buffer > 1;
 
         GST_LOG_OBJECT (self, "request buffer");
-        omx_buffer = g_omx_port_request_buffer (out_port);
+        omx_buffer = request_output_buffer (self, out_port);
 
         GST_LOG_OBJECT (self, "omx_buffer: %p", omx_buffer);
 
         if (G_UNLIKELY (!omx_buffer))
         {
-            GST_WARNING_OBJECT (self, "null buffer: leaving");
+            /* With a stall-timeout we wake up periodically, so the task
+             * can be paused even if the port wasn't. */
+            if (coalescing (self) && g_atomic_int_get (&out_port->queue->enabled))
+                flush_coalesced (self);
+            else if (self->stall_timeout && g_atomic_int_get (&out_port->queue->enabled))
+                GST_LOG_OBJECT (self, "no output within %u ms", self->stall_timeout);
+            else
+                GST_WARNING_OBJECT (self, "null buffer: leaving");
             goto leave;
         }
 
@@ -331,56 +849,59 @@ output_loop (gpointer data)
             }
 #endif
 
-            /* buf is always null when the output buffer pointer isn't shared. */
-            buf = omx_buffer->pAppPrivate;
-
-            if (buf && !(omx_buffer->nFlags & OMX_BUFFERFLAG_EOS))
+            if (self->repack_output)
             {
-                GST_BUFFER_SIZE (buf) = omx_buffer->nFilledLen;
-                if (self->use_timestamps)
+                buf = self->repack_output (self, omx_buffer);
+
+                if (G_LIKELY (buf))
                 {
-                    GST_BUFFER_TIMESTAMP (buf) = gst_util_uint64_scale_int (omx_buffer->nTimeStamp,
-                                                                            GST_SECOND,
-                                                                            OMX_TICKS_PER_SECOND);
-                }
+                    set_timestamp (self, buf, omx_buffer);
+                    set_buffer_flags (self, buf, omx_buffer);
 
-                omx_buffer->pAppPrivate = NULL;
-                omx_buffer->pBuffer = NULL;
+                    ret = push_output (self, buf);
+                }
+            }
+            else if (out_port->buffer_refs && !packing &&
+                     (buf = g_omx_port_wrap_buffer (out_port, omx_buffer)))
+            {
+                /* Downstream gets the omx buffer itself; it comes back
+                 * through the queue, empty, once the last reference is
+                 * dropped. */
+                gst_buffer_set_caps (buf, GST_PAD_CAPS (self->srcpad));
 
-                ret = push_buffer (self, buf);
+                set_timestamp (self, buf, omx_buffer);
+                set_buffer_flags (self, buf, omx_buffer);
 
-                gst_buffer_unref (buf);
+                wrapped = TRUE;
+                ret = push_output (self, buf);
             }
             else
             {
-                /* This is only meant for the first OpenMAX buffers,
-                 * which need to be pre-allocated. */
-                /* Also for the very last one. */
-                gst_pad_alloc_buffer_and_set_caps (self->srcpad,
-                                                   GST_BUFFER_OFFSET_NONE,
-                                                   omx_buffer->nFilledLen,
-                                                   GST_PAD_CAPS (self->srcpad),
-                                                   &buf);
+                if (self->partial_frames)
+                {
+                    gpointer data;
+
+                    data = g_malloc (omx_buffer->nFilledLen);
+                    buf = gst_omx_buffer_new (data, omx_buffer->nFilledLen, data, g_free);
+                    gst_buffer_set_caps (buf, GST_PAD_CAPS (self->srcpad));
+                }
+                else
+                {
+                    gst_pad_alloc_buffer_and_set_caps (self->srcpad,
+                                                       GST_BUFFER_OFFSET_NONE,
+                                                       omx_buffer->nFilledLen,
+                                                       GST_PAD_CAPS (self->srcpad),
+                                                       &buf);
+                }
 
                 if (G_LIKELY (buf))
                 {
                     memcpy (GST_BUFFER_DATA (buf), omx_buffer->pBuffer + omx_buffer->nOffset, omx_buffer->nFilledLen);
-                    if (self->use_timestamps)
-                    {
-
-                        GST_BUFFER_TIMESTAMP (buf) = gst_util_uint64_scale_int (omx_buffer->nTimeStamp,
-                                                                                GST_SECOND,
-                                                                                OMX_TICKS_PER_SECOND);
-                    }
 
-                    if (self->share_output_buffer)
-                    {
-                        GST_WARNING_OBJECT (self, "couldn't zero-copy");
-                        g_free (omx_buffer->pBuffer);
-                        omx_buffer->pBuffer = NULL;
-                    }
+                    set_timestamp (self, buf, omx_buffer);
+                    set_buffer_flags (self, buf, omx_buffer);
 
-                    ret = push_buffer (self, buf);
+                    ret = push_output (self, buf);
                 }
                 else
                 {
@@ -389,6 +910,11 @@ output_loop (gpointer data)
                 }
             }
         }
+        else if (out_port->buffer_refs)
+        {
+            /* Given back by downstream. */
+            GST_LOG_OBJECT (self, "empty buffer");
+        }
         else
         {
             GST_WARNING_OBJECT (self, "empty buffer");
@@ -397,45 +923,24 @@ output_loop (gpointer data)
         if (G_UNLIKELY (omx_buffer->nFlags & OMX_BUFFERFLAG_EOS))
         {
             GST_DEBUG_OBJECT (self, "got eos");
-            g_omx_core_set_done (gomx);
-            goto leave;
-        }
-
-        if (self->share_output_buffer &&
-            !omx_buffer->pBuffer &&
-            omx_buffer->nOffset == 0)
-        {
-            GstBuffer *buf;
-            GstFlowReturn result;
-
-            GST_LOG_OBJECT (self, "allocate buffer");
-            result = gst_pad_alloc_buffer_and_set_caps (self->srcpad,
-                                                        GST_BUFFER_OFFSET_NONE,
-                                                        omx_buffer->nAllocLen,
-                                                        GST_PAD_CAPS (self->srcpad),
-                                                        &buf);
 
-            if (G_LIKELY (result == GST_FLOW_OK))
+            /* The last packet may be short. */
+            if (self->output_packer && ret == GST_FLOW_OK)
             {
-                gst_buffer_ref (buf);
-                omx_buffer->pAppPrivate = buf;
+                GstBuffer *buf;
 
-                omx_buffer->pBuffer = GST_BUFFER_DATA (buf);
-                omx_buffer->nAllocLen = GST_BUFFER_SIZE (buf);
-            }
-            else
-            {
-                GST_WARNING_OBJECT (self, "could not pad allocate buffer, using malloc");
-                omx_buffer->pBuffer = g_malloc (omx_buffer->nAllocLen);
+                buf = gst_omx_packer_drain (self->output_packer);
+                if (buf)
+                    ret = push_buffer (self, buf);
             }
-        }
 
-        if (self->share_output_buffer &&
-            !omx_buffer->pBuffer)
-        {
-            GST_ERROR_OBJECT (self, "no input buffer to share");
+            g_omx_core_set_done (gomx);
+            goto leave;
         }
 
+        if (wrapped)
+            goto leave;
+
         omx_buffer->nFilledLen = 0;
         GST_LOG_OBJECT (self, "release_buffer");
         g_omx_port_release_buffer (out_port, omx_buffer);
@@ -457,6 +962,343 @@ leave:
     gst_object_unref (self);
 }
 
+/* Sends the component to Idle without waiting for it. */
+static void
+begin_prepare (GstOmxBaseFilter *self)
+{
+    GST_INFO_OBJECT (self, "omx: prepare");
+
+    /** @todo this should probably go after doing preparations. */
+    if (self->omx_setup)
+    {
+        self->omx_setup (self);
+    }
+
+    /* From here on frames-per-buffer can't change. */
+    GST_OBJECT_LOCK (self);
+    self->initialized = TRUE;
+    GST_OBJECT_UNLOCK (self);
+
+    setup_ports (self);
+
+    g_omx_core_set_state_async (self->gomx, OMX_StateIdle);
+}
+
+static gboolean
+prepare (GstOmxBaseFilter *self)
+{
+    if (!self->initialized)
+        begin_prepare (self);
+
+    if (G_UNLIKELY (g_omx_core_wait_for_state (self->gomx, OMX_StateIdle)))
+        return FALSE;
+
+    gst_pad_start_task (self->srcpad, output_loop, self->srcpad);
+
+    return TRUE;
+}
+
+static gboolean
+start (GstOmxBaseFilter *self,
+       gboolean *stalled)
+{
+    GST_INFO_OBJECT (self, "omx: play");
+    g_omx_core_start (self->gomx);
+
+    if (G_UNLIKELY (self->gomx->omx_error))
+        return FALSE;
+
+    /* send buffer with codec data flag */
+    /** @todo move to util */
+    if (self->codec_data)
+    {
+        OMX_BUFFERHEADERTYPE *omx_buffer;
+
+        GST_LOG_OBJECT (self, "request buffer");
+        omx_buffer = request_input_buffer (self, stalled);
+
+        if (G_LIKELY (omx_buffer))
+        {
+            omx_buffer->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
+
+            omx_buffer->nFilledLen = GST_BUFFER_SIZE (self->codec_data);
+            memcpy (omx_buffer->pBuffer + omx_buffer->nOffset, GST_BUFFER_DATA (self->codec_data), omx_buffer->nFilledLen);
+
+            GST_LOG_OBJECT (self, "release_buffer");
+            g_omx_port_release_buffer (self->in_port, omx_buffer);
+        }
+    }
+
+    return TRUE;
+}
+
+/* Called by subclasses once the sink caps have been applied to the
+ * component; with eager-prepare the component goes to Idle in the
+ * background, so the buffers of several elements get allocated in
+ * parallel. The first buffer waits for it. */
+void
+gst_omx_base_filter_eager_prepare (GstOmxBaseFilter *self)
+{
+    if (!self->eager_prepare || self->initialized)
+        return;
+
+    begin_prepare (self);
+
+    gst_pad_start_task (self->srcpad, output_loop, self->srcpad);
+}
+
+/* Whether buf completes a frame; either flagged by upstream, or all
+ * buffers are whole frames according to the caps. */
+static gboolean
+is_frame_end (GstOmxBaseFilter *self,
+              GstBuffer *buf)
+{
+    GstCaps *caps;
+
+    if (GST_OMX_BUFFER_IS_END_OF_FRAME (buf))
+        return TRUE;
+
+    caps = GST_PAD_CAPS (self->sinkpad);
+
+    if (G_UNLIKELY (caps != self->framed_caps))
+    {
+        gst_caps_replace (&self->framed_caps, caps);
+        self->framed = FALSE;
+
+        if (caps && gst_caps_get_size (caps) > 0)
+        {
+            GstStructure *structure;
+            const gchar *alignment;
+            gboolean framed = FALSE;
+
+            structure = gst_caps_get_structure (caps, 0);
+            alignment = gst_structure_get_string (structure, "alignment");
+
+            gst_structure_get_boolean (structure, "framed", &framed);
+
+            self->framed = framed ||
+                (alignment && (strcmp (alignment, "au") == 0 || strcmp (alignment, "frame") == 0));
+        }
+    }
+
+    return self->framed;
+}
+
+static void
+submit_coalesced (GstOmxBaseFilter *self,
+                  gboolean frame_end)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+
+    omx_buffer = self->coalesce_buffer;
+
+    if (!omx_buffer)
+        return;
+
+    self->coalesce_buffer = NULL;
+
+    if (frame_end)
+        omx_buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+
+    GST_LOG_OBJECT (self, "release_buffer: len=%lu", omx_buffer->nFilledLen);
+    g_omx_port_release_buffer (self->in_port, omx_buffer);
+}
+
+/* After a flush the data is stale; the buffer goes back unused. */
+static void
+drop_coalesced (GstOmxBaseFilter *self)
+{
+    if (!self->coalesce_buffer)
+        return;
+
+    self->coalesce_buffer->nFilledLen = 0;
+    g_omx_port_push_buffer (self->in_port, self->coalesce_buffer);
+    self->coalesce_buffer = NULL;
+}
+
+/* Called from the output thread; the chain function is left alone, it
+ * submits the buffer itself when more input comes. */
+static void
+flush_coalesced (GstOmxBaseFilter *self)
+{
+    if (!GST_PAD_STREAM_TRYLOCK (self->sinkpad))
+        return;
+
+    if (self->coalesce_buffer &&
+        gst_util_get_timestamp () - self->coalesce_since >= coalesce_flush_interval (self) * GST_MSECOND)
+    {
+        GST_DEBUG_OBJECT (self, "no more input; submitting %lu bytes",
+                          self->coalesce_buffer->nFilledLen);
+        submit_coalesced (self, FALSE);
+    }
+
+    GST_PAD_STREAM_UNLOCK (self->sinkpad);
+}
+
+/* Appends buf to the omx buffer being filled, which is submitted once it
+ * holds coalesce-bytes or coalesce-time worth of data, at the end of a
+ * frame, or when buf doesn't fit in it. Nothing is held back across a
+ * discontinuity. */
+static GstFlowReturn
+coalesce_input (GstOmxBaseFilter *self,
+                GstBuffer *buf,
+                gboolean *stalled)
+{
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+    GstClockTime timestamp;
+    guint offset = 0;
+    gboolean frame_end;
+    gboolean full;
+
+    timestamp = GST_BUFFER_TIMESTAMP (buf);
+    frame_end = is_frame_end (self, buf);
+
+    if (GST_BUFFER_IS_DISCONT (buf))
+        submit_coalesced (self, FALSE);
+
+    /* Output is matched to these by timestamp, however the data ends up
+     * split among omx buffers. */
+    if (self->timestamps)
+    {
+        gst_omx_timestamps_push (self->timestamps,
+                                 timestamp,
+                                 GST_BUFFER_DURATION (buf),
+                                 GST_BUFFER_IS_DISCONT (buf));
+    }
+
+    while (offset < GST_BUFFER_SIZE (buf))
+    {
+        guint remaining;
+        guint size;
+
+        remaining = GST_BUFFER_SIZE (buf) - offset;
+        omx_buffer = self->coalesce_buffer;
+
+        /* Rather start a new buffer than split buf. */
+        if (omx_buffer &&
+            remaining > omx_buffer->nAllocLen - omx_buffer->nOffset - omx_buffer->nFilledLen)
+        {
+            submit_coalesced (self, FALSE);
+            omx_buffer = NULL;
+        }
+
+        if (!omx_buffer)
+        {
+            if (self->last_pad_push_return != GST_FLOW_OK)
+                return self->last_pad_push_return;
+
+            GST_LOG_OBJECT (self, "request buffer");
+            omx_buffer = request_input_buffer (self, stalled);
+
+            if (G_UNLIKELY (!omx_buffer))
+            {
+                if (*stalled)
+                {
+                    /* Nothing of buf may stay behind, glued to later input. */
+                    drop_coalesced (self);
+                    if (offset > 0)
+                        GST_WARNING_OBJECT (self, "first %u bytes already submitted", offset);
+                    return GST_FLOW_OK;
+                }
+
+                GST_WARNING_OBJECT (self, "null buffer");
+                return self->last_pad_push_return;
+            }
+
+            omx_buffer->nFilledLen = 0;
+            omx_buffer->nFlags &= ~OMX_BUFFERFLAG_ENDOFFRAME;
+            omx_buffer->nTimeStamp = 0;
+
+            self->coalesce_buffer = omx_buffer;
+            self->coalesce_start = GST_CLOCK_TIME_NONE;
+            self->coalesce_end = GST_CLOCK_TIME_NONE;
+            self->coalesce_since = gst_util_get_timestamp ();
+        }
+
+        if (!GST_CLOCK_TIME_IS_VALID (self->coalesce_start) &&
+            GST_CLOCK_TIME_IS_VALID (timestamp))
+        {
+            self->coalesce_start = timestamp;
+
+            if (self->use_timestamps)
+            {
+                omx_buffer->nTimeStamp = gst_util_uint64_scale_int (timestamp,
+                                                                    OMX_TICKS_PER_SECOND,
+                                                                    GST_SECOND);
+            }
+        }
+
+        size = MIN (remaining, omx_buffer->nAllocLen - omx_buffer->nOffset - omx_buffer->nFilledLen);
+        memcpy (omx_buffer->pBuffer + omx_buffer->nOffset + omx_buffer->nFilledLen,
+                GST_BUFFER_DATA (buf) + offset, size);
+        omx_buffer->nFilledLen += size;
+        offset += size;
+
+        /* Bigger than a whole omx buffer. */
+        if (offset < GST_BUFFER_SIZE (buf))
+            submit_coalesced (self, FALSE);
+    }
+
+    if (!self->coalesce_buffer)
+        return GST_FLOW_OK;
+
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+    {
+        self->coalesce_end = timestamp;
+        if (GST_BUFFER_DURATION_IS_VALID (buf))
+            self->coalesce_end += GST_BUFFER_DURATION (buf);
+    }
+
+    omx_buffer = self->coalesce_buffer;
+
+    full = (self->coalesce_bytes && omx_buffer->nFilledLen >= self->coalesce_bytes) ||
+        omx_buffer->nFilledLen >= omx_buffer->nAllocLen - omx_buffer->nOffset;
+
+    if (self->coalesce_time &&
+        GST_CLOCK_TIME_IS_VALID (self->coalesce_start) &&
+        GST_CLOCK_TIME_IS_VALID (self->coalesce_end) &&
+        self->coalesce_end > self->coalesce_start &&
+        self->coalesce_end - self->coalesce_start >= self->coalesce_time * GST_MSECOND)
+        full = TRUE;
+
+    if (full || frame_end)
+        submit_coalesced (self, frame_end);
+
+    return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+pad_buffer_alloc (GstPad *pad,
+                  guint64 offset,
+                  guint size,
+                  GstCaps *caps,
+                  GstBuffer **buf)
+{
+    GstOmxBaseFilter *self;
+    GOmxPort *in_port;
+
+    self = GST_OMX_BASE_FILTER (GST_OBJECT_PARENT (pad));
+    in_port = self->in_port;
+
+    *buf = NULL;
+
+    /* The port only exists after the first buffer; until then, and whenever
+     * no omx buffer is free, the default allocation is used. Input that
+     * gets split can't be written in place. */
+    if (self->zero_copy_input && !self->repack_input && !self->input_packer &&
+        !coalescing (self) && in_port && in_port->enabled)
+    {
+        *buf = g_omx_port_alloc_gst_buffer (in_port, size);
+        if (*buf)
+        {
+            GST_BUFFER_OFFSET (*buf) = offset;
+            gst_buffer_set_caps (*buf, caps);
+        }
+    }
+
+    return GST_FLOW_OK;
+}
+
 static GstFlowReturn
 pad_chain (GstPad *pad,
            GstBuffer *buf)
@@ -465,6 +1307,7 @@ pad_chain (GstPad *pad,
     GOmxPort *in_port;
     GstOmxBaseFilter *self;
     GstFlowReturn ret = GST_FLOW_OK;
+    gboolean stalled = FALSE;
 
     self = GST_OMX_BASE_FILTER (GST_OBJECT_PARENT (pad));
 
@@ -477,20 +1320,8 @@ pad_chain (GstPad *pad,
 
     if (G_UNLIKELY (gomx->omx_state == OMX_StateLoaded))
     {
-        GST_INFO_OBJECT (self, "omx: prepare");
-
-        /** @todo this should probably go after doing preparations. */
-        if (self->omx_setup)
-        {
-            self->omx_setup (self);
-        }
-
-        setup_ports (self);
-
-        g_omx_core_prepare (self->gomx);
-
-        self->initialized = TRUE;
-        gst_pad_start_task (self->srcpad, output_loop, self->srcpad);
+        if (!prepare (self))
+            goto out_state_error;
     }
 
     in_port = self->in_port;
@@ -498,100 +1329,198 @@ pad_chain (GstPad *pad,
     if (G_LIKELY (in_port->enabled))
     {
         guint buffer_offset = 0;
+        guint frame_index = 0;
 
         if (G_UNLIKELY (gomx->omx_state == OMX_StateIdle))
         {
-            GST_INFO_OBJECT (self, "omx: play");
-            g_omx_core_start (gomx);
+            if (!start (self, &stalled))
+                goto out_state_error;
 
-            /* send buffer with codec data flag */
-            /** @todo move to util */
-            if (self->codec_data)
+            if (G_UNLIKELY (stalled))
             {
-                OMX_BUFFERHEADERTYPE *omx_buffer;
+                goto out_stalled;
+            }
+        }
 
-                GST_LOG_OBJECT (self, "request buffer");
-                omx_buffer = g_omx_port_request_buffer (in_port);
+        if (G_UNLIKELY (gomx->omx_state != OMX_StateExecuting))
+        {
+            GST_ERROR_OBJECT (self, "Whoa! very wrong");
+        }
 
-                if (G_LIKELY (omx_buffer))
-                {
-                    omx_buffer->nFlags |= 0x00000080; /* codec data flag */
+        if (self->skip_buffer && self->skip_buffer (self, buf))
+        {
+            GST_LOG_OBJECT (self, "skipping buffer");
+            goto leave;
+        }
 
-                    omx_buffer->nFilledLen = GST_BUFFER_SIZE (self->codec_data);
-                    memcpy (omx_buffer->pBuffer + omx_buffer->nOffset, GST_BUFFER_DATA (self->codec_data), omx_buffer->nFilledLen);
+        if (coalescing (self))
+        {
+            ret = coalesce_input (self, buf, &stalled);
 
-                    GST_LOG_OBJECT (self, "release_buffer");
-                    g_omx_port_release_buffer (in_port, omx_buffer);
-                }
+            if (G_UNLIKELY (stalled))
+            {
+                goto out_stalled;
             }
+
+            goto leave;
         }
 
-        if (G_UNLIKELY (gomx->omx_state != OMX_StateExecuting))
+        if (self->timestamps)
         {
-            GST_ERROR_OBJECT (self, "Whoa! very wrong");
+            gst_omx_timestamps_push (self->timestamps,
+                                     GST_BUFFER_TIMESTAMP (buf),
+                                     GST_BUFFER_DURATION (buf),
+                                     GST_BUFFER_IS_DISCONT (buf));
         }
 
         while (G_LIKELY (buffer_offset < GST_BUFFER_SIZE (buf)))
         {
             OMX_BUFFERHEADERTYPE *omx_buffer;
+            gboolean claimed;
 
             if (self->last_pad_push_return != GST_FLOW_OK)
             {
                 goto out_flushing;
             }
 
-            GST_LOG_OBJECT (self, "request buffer");
-            omx_buffer = g_omx_port_request_buffer (in_port);
+            /* Buffers from pad_buffer_alloc already live in an omx buffer. */
+            omx_buffer = self->repack_input ? NULL : g_omx_port_claim_gst_buffer (in_port, buf);
+            claimed = (omx_buffer != NULL);
+
+            if (!claimed)
+            {
+                GST_LOG_OBJECT (self, "request buffer");
+                omx_buffer = request_input_buffer (self, &stalled);
+            }
 
             GST_LOG_OBJECT (self, "omx_buffer: %p", omx_buffer);
 
+            if (G_UNLIKELY (stalled))
+            {
+                goto out_stalled;
+            }
+
             if (G_LIKELY (omx_buffer))
             {
-                GST_DEBUG_OBJECT (self, "omx_buffer: size=%lu, len=%lu, flags=%lu, offset=%lu, timestamp=%lld",
-                                  omx_buffer->nAllocLen, omx_buffer->nFilledLen, omx_buffer->nFlags,
-                                  omx_buffer->nOffset, omx_buffer->nTimeStamp);
+                OMX_BUFFERHEADERTYPE *omx_buffers[MAX_INPUT_BATCH];
+                guint count = 1;
+                guint i;
 
-                if (omx_buffer->nOffset == 0 &&
-                    self->share_input_buffer)
+                omx_buffers[0] = omx_buffer;
+
+                /* Take whatever else is free for the rest of the data, so
+                 * it's all submitted in one go. */
+                if (!claimed && !self->repack_input)
                 {
+                    guint remaining;
+                    guint needed = 0;
+
+                    remaining = GST_BUFFER_SIZE (buf) - buffer_offset;
+
+                    if (self->input_packer)
+                    {
+                        needed = gst_omx_packer_count (self->input_packer,
+                                                       GST_BUFFER_DATA (buf) + buffer_offset,
+                                                       remaining) - 1;
+                    }
+                    else
                     {
-                        GstBuffer *old_buf;
-                        old_buf = omx_buffer->pAppPrivate;
+                        guint chunk;
 
-                        if (old_buf)
-                        {
-                            gst_buffer_unref (old_buf);
-                        }
-                        else if (omx_buffer->pBuffer)
-                        {
-                            g_free (omx_buffer->pBuffer);
-                        }
+                        chunk = omx_buffer->nAllocLen - omx_buffer->nOffset;
+
+                        if (remaining > chunk && in_port->buffer_size > 0)
+                            needed = (remaining - chunk + in_port->buffer_size - 1) / in_port->buffer_size;
                     }
 
-                    omx_buffer->pBuffer = GST_BUFFER_DATA (buf);
-                    omx_buffer->nAllocLen = GST_BUFFER_SIZE (buf);
-                    omx_buffer->nFilledLen = GST_BUFFER_SIZE (buf);
-                    omx_buffer->pAppPrivate = buf;
-                }
-                else
-                {
-                    omx_buffer->nFilledLen = MIN (GST_BUFFER_SIZE (buf) - buffer_offset,
-                                                  omx_buffer->nAllocLen - omx_buffer->nOffset);
-                    memcpy (omx_buffer->pBuffer + omx_buffer->nOffset, GST_BUFFER_DATA (buf) + buffer_offset, omx_buffer->nFilledLen);
+                    if (needed > 0)
+                    {
+                        count += g_omx_port_request_buffers (in_port, omx_buffers + 1,
+                                                             MIN (needed, MAX_INPUT_BATCH - 1));
+                    }
                 }
 
-                if (self->use_timestamps)
+                for (i = 0; i < count; i++)
                 {
-                    omx_buffer->nTimeStamp = gst_util_uint64_scale_int (GST_BUFFER_TIMESTAMP (buf),
-                                                                        OMX_TICKS_PER_SECOND,
-                                                                        GST_SECOND);
-                }
+                    guint consumed;
+
+                    omx_buffer = omx_buffers[i];
+
+                    /* We took more than the data needed. */
+                    if (G_UNLIKELY (buffer_offset >= GST_BUFFER_SIZE (buf)))
+                    {
+                        guint j;
 
-                buffer_offset += omx_buffer->nFilledLen;
+                        for (j = i; j < count; j++)
+                            g_omx_port_push_buffer (in_port, omx_buffers[j]);
 
-                GST_LOG_OBJECT (self, "release_buffer");
+                        count = i;
+                        break;
+                    }
+
+                    GST_DEBUG_OBJECT (self, "omx_buffer: size=%lu, len=%lu, flags=%lu, offset=%lu, timestamp=%lld",
+                                      omx_buffer->nAllocLen, omx_buffer->nFilledLen, omx_buffer->nFlags,
+                                      omx_buffer->nOffset, omx_buffer->nTimeStamp);
+
+                    if (claimed)
+                    {
+                        omx_buffer->nOffset = 0;
+                        omx_buffer->nFilledLen = GST_BUFFER_SIZE (buf);
+                        consumed = omx_buffer->nFilledLen;
+                    }
+                    else if (self->repack_input)
+                    {
+                        self->repack_input (self, buf, omx_buffer);
+                        consumed = GST_BUFFER_SIZE (buf) - buffer_offset;
+                    }
+                    else
+                    {
+                        guint length;
+
+                        length = GST_BUFFER_SIZE (buf) - buffer_offset;
+
+                        if (self->input_packer)
+                        {
+                            length = gst_omx_packer_frame_length (self->input_packer,
+                                                                  GST_BUFFER_DATA (buf) + buffer_offset,
+                                                                  length);
+                        }
+
+                        omx_buffer->nFilledLen = MIN (length, omx_buffer->nAllocLen - omx_buffer->nOffset);
+                        memcpy (omx_buffer->pBuffer + omx_buffer->nOffset, GST_BUFFER_DATA (buf) + buffer_offset, omx_buffer->nFilledLen);
+                        consumed = omx_buffer->nFilledLen;
+                    }
+
+                    /* Only the last piece of a frame ends it. */
+                    omx_buffer->nFlags &= ~OMX_BUFFERFLAG_ENDOFFRAME;
+                    if (GST_OMX_BUFFER_IS_END_OF_FRAME (buf) &&
+                        buffer_offset + consumed >= GST_BUFFER_SIZE (buf))
+                        omx_buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+
+                    if (self->use_timestamps)
+                    {
+                        GstClockTime timestamp;
+
+                        timestamp = GST_BUFFER_TIMESTAMP (buf);
+
+                        /* Split frames follow one another. */
+                        if (self->input_packer &&
+                            GST_CLOCK_TIME_IS_VALID (timestamp) &&
+                            GST_CLOCK_TIME_IS_VALID (self->input_packer->frame_duration))
+                            timestamp += frame_index * self->input_packer->frame_duration;
+
+                        omx_buffer->nTimeStamp = gst_util_uint64_scale_int (timestamp,
+                                                                            OMX_TICKS_PER_SECOND,
+                                                                            GST_SECOND);
+                    }
+
+                    buffer_offset += consumed;
+                    frame_index++;
+                }
+
+                GST_LOG_OBJECT (self, "release_buffers: %u", count);
                 /** @todo untaint buffer */
-                g_omx_port_release_buffer (in_port, omx_buffer);
+                g_omx_port_release_buffers (in_port, omx_buffers, count);
             }
             else
             {
@@ -606,10 +1535,8 @@ pad_chain (GstPad *pad,
         ret = GST_FLOW_UNEXPECTED;
     }
 
-    if (!self->share_input_buffer)
-    {
-        gst_buffer_unref (buf);
-    }
+leave:
+    gst_buffer_unref (buf);
 
     GST_LOG_OBJECT (self, "end");
 
@@ -621,6 +1548,31 @@ out_flushing:
         gst_buffer_unref (buf);
         return self->last_pad_push_return;
     }
+
+out_stalled:
+    {
+        gst_buffer_unref (buf);
+
+        if (self->drop_on_stall)
+        {
+            GST_WARNING_OBJECT (self, "component stalled; dropping buffer");
+            return GST_FLOW_OK;
+        }
+
+        GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                           ("component didn't return an input buffer within %u ms",
+                            self->stall_timeout));
+        return GST_FLOW_ERROR;
+    }
+
+out_state_error:
+    {
+        gst_buffer_unref (buf);
+
+        GST_ELEMENT_ERROR (self, LIBRARY, STATE, (NULL),
+                           ("component state change failed: 0x%08x", gomx->omx_error));
+        return GST_FLOW_ERROR;
+    }
 }
 
 static gboolean
@@ -631,6 +1583,7 @@ pad_event (GstPad *pad,
     GOmxCore *gomx;
     GOmxPort *in_port;
     GOmxPort *out_port;
+    gboolean stalled = FALSE;
     gboolean ret;
 
     self = GST_OMX_BASE_FILTER (GST_OBJECT_PARENT (pad));
@@ -642,6 +1595,9 @@ pad_event (GstPad *pad,
 
     GST_INFO_OBJECT (self, "event: %s", GST_EVENT_TYPE_NAME (event));
 
+    if (self->sink_event)
+        self->sink_event (self, event);
+
     switch (GST_EVENT_TYPE (event))
     {
         case GST_EVENT_EOS:
@@ -652,8 +1608,19 @@ pad_event (GstPad *pad,
                 {
                     OMX_BUFFERHEADERTYPE *omx_buffer;
 
-                    GST_LOG_OBJECT (self, "request buffer");
-                    omx_buffer = g_omx_port_request_buffer (in_port);
+                    /* The eos flag goes with the last of the data. */
+                    omx_buffer = self->coalesce_buffer;
+                    self->coalesce_buffer = NULL;
+
+                    if (omx_buffer)
+                    {
+                        omx_buffer->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+                    }
+                    else
+                    {
+                        GST_LOG_OBJECT (self, "request buffer");
+                        omx_buffer = request_input_buffer (self, &stalled);
+                    }
 
                     if (G_LIKELY (omx_buffer))
                     {
@@ -663,14 +1630,30 @@ pad_event (GstPad *pad,
                         /* foo_buffer_untaint (omx_buffer); */
                         g_omx_port_release_buffer (in_port, omx_buffer);
                     }
-                    else
+                    else if (!stalled)
                     {
                         g_omx_core_set_done (gomx);
                     }
                 }
 
                 /* Wait for the output port to get the EOS. */
-                g_omx_core_wait_for_done (gomx);
+                if (G_UNLIKELY (stalled || !wait_for_done (self)))
+                {
+                    if (!self->drop_on_stall)
+                    {
+                        GST_ELEMENT_ERROR (self, STREAM, FAILED, (NULL),
+                                           ("component didn't finish the stream within %u ms",
+                                            self->stall_timeout));
+                        gst_event_unref (event);
+                        ret = FALSE;
+                        break;
+                    }
+
+                    GST_WARNING_OBJECT (self, "component stalled; pushing eos without waiting");
+                }
+
+                G_OMX_TRACE (G_OMX_TRACE_INSTANT, "EOS", gomx, NULL);
+                g_omx_trace_dump ();
             }
 
             ret = gst_pad_push_event (self->srcpad, event);
@@ -693,6 +1676,13 @@ pad_event (GstPad *pad,
 
             g_omx_core_flush_stop (gomx);
 
+            drop_coalesced (self);
+
+            if (self->timestamps)
+                gst_omx_timestamps_reset (self->timestamps);
+            if (self->output_packer)
+                gst_omx_packer_reset (self->output_packer);
+
             gst_pad_start_task (self->srcpad, output_loop, self->srcpad);
 
             ret = TRUE;
@@ -702,6 +1692,16 @@ pad_event (GstPad *pad,
             ret = gst_pad_push_event (self->srcpad, event);
             break;
 
+        case GST_EVENT_CUSTOM_DOWNSTREAM:
+        case GST_EVENT_CUSTOM_BOTH:
+            if (gst_event_get_structure (event) &&
+                gst_structure_has_name (gst_event_get_structure (event), "GstOmxTraceDump"))
+            {
+                g_omx_trace_dump ();
+            }
+            ret = gst_pad_push_event (self->srcpad, event);
+            break;
+
         default:
             ret = gst_pad_push_event (self->srcpad, event);
             break;
@@ -785,12 +1785,14 @@ type_instance_init (GTypeInstance *instance,
         GOmxCore *gomx;
         self->gomx = gomx = g_omx_core_new ();
         gomx->client_data = self;
+        gomx->state_changed_cb = state_changed;
     }
 
     self->sinkpad =
         gst_pad_new_from_template (gst_element_class_get_pad_template (element_class, "sink"), "sink");
 
     gst_pad_set_chain_function (self->sinkpad, pad_chain);
+    gst_pad_set_bufferalloc_function (self->sinkpad, pad_buffer_alloc);
     gst_pad_set_event_function (self->sinkpad, pad_event);
 
     self->srcpad =
@@ -33,10 +33,18 @@ G_BEGIN_DECLS
 typedef struct GstOmxBaseFilter GstOmxBaseFilter;
 typedef struct GstOmxBaseFilterClass GstOmxBaseFilterClass;
 typedef void (*GstOmxBaseFilterCb) (GstOmxBaseFilter *self);
+typedef void (*GstOmxBaseFilterEventCb) (GstOmxBaseFilter *self, GstEvent *event);
+typedef gboolean (*GstOmxBaseFilterBufferCb) (GstOmxBaseFilter *self, GstBuffer *buf);
 
 #include "gstomx_util.h"
+#include "gstomx_timestamps.h"
+#include "gstomx_packer.h"
+#include "gstomx_buffer.h"
 #include <async_queue.h>
 
+typedef GstBuffer *(*GstOmxBaseFilterOutputCb) (GstOmxBaseFilter *self, OMX_BUFFERHEADERTYPE *omx_buffer);
+typedef void (*GstOmxBaseFilterInputCb) (GstOmxBaseFilter *self, GstBuffer *buf, OMX_BUFFERHEADERTYPE *omx_buffer);
+
 struct GstOmxBaseFilter
 {
     GstElement element;
@@ -54,11 +62,36 @@ struct GstOmxBaseFilter
     gboolean initialized;
 
     GstOmxBaseFilterCb omx_setup;
+    GstOmxBaseFilterEventCb sink_event; /**< Peeks at serialized events before they are handled. */
+    GstOmxBaseFilterBufferCb skip_buffer; /**< TRUE drops the buffer before it reaches the component. */
+    GstOmxBaseFilterBufferCb before_push; /**< Sees each output buffer right before it's pushed; the return value is ignored. */
+    GstOmxBaseFilterOutputCb repack_output; /**< If set, builds the output buffers instead of a plain copy. */
+    GstOmxBaseFilterInputCb repack_input; /**< If set, fills an input buffer from a whole frame instead of a plain copy. */
     GstFlowReturn last_pad_push_return;
     GstBuffer *codec_data;
 
-    gboolean share_input_buffer;
-    gboolean share_output_buffer; /** @todo this is hack, OpenMAX IL spec should be revised. */
+    gboolean zero_copy_input; /**< Upstream writes directly into the input buffers. */
+    gboolean zero_copy_output; /**< Downstream gets the output buffers themselves. */
+
+    guint stall_timeout; /**< In milliseconds; 0 waits forever. */
+    gboolean drop_on_stall;
+    volatile gint pushing;
+
+    gboolean eager_prepare;
+    gboolean mark_delta_units; /**< Output not flagged as sync frame is a delta unit. */
+    gboolean partial_frames; /**< The component emits pieces of frames; output copies are GstOmxBuffers, flagged at frame ends. */
+    GstOmxTimestamps *timestamps; /**< If set, output timestamps come from here. */
+    GstOmxPacker *output_packer; /**< If set, output frames are pushed frames_per_buffer at a time; that only changes, with the object lock, while not initialized. */
+    GstOmxPacker *input_packer; /**< If set, each input frame gets an omx buffer of its own. */
+
+    guint coalesce_bytes; /**< Small input is gathered until this many bytes; 0 disables it. */
+    guint coalesce_time; /**< Same, in milliseconds of input. */
+    OMX_BUFFERHEADERTYPE *coalesce_buffer; /**< Being filled; not submitted yet. */
+    GstClockTime coalesce_start;
+    GstClockTime coalesce_end;
+    GstClockTime coalesce_since; /**< When coalesce_buffer was taken; from gst_util_get_timestamp. */
+    GstCaps *framed_caps;
+    gboolean framed; /**< The caps say every buffer is a whole frame. */
 };
 
 struct GstOmxBaseFilterClass
@@ -67,6 +100,7 @@ struct GstOmxBaseFilterClass
 };
 
 GType gst_omx_base_filter_get_type (void);
+void gst_omx_base_filter_eager_prepare (GstOmxBaseFilter *self);
 
 G_END_DECLS
 
@@ -30,7 +30,12 @@ enum
 {
     ARG_0,
     ARG_COMPONENT_NAME,
-    ARG_LIBRARY_NAME
+    ARG_LIBRARY_NAME,
+    ARG_STATS,
+    ARG_STATE_TIMEOUT,
+    ARG_DISPATCH_CALLBACKS,
+    ARG_PRIORITY,
+    ARG_ADMISSION_TIMEOUT
 };
 
 static GstElementClass *parent_class = NULL;
@@ -72,6 +77,12 @@ start (GstBaseSrc *gst_base)
     GST_LOG_OBJECT (self, "begin");
 
     g_omx_core_init (self->gomx, self->omx_library, self->omx_component);
+    if (self->gomx->omx_error == OMX_ErrorInsufficientResources)
+    {
+        GST_ELEMENT_ERROR (self, RESOURCE, BUSY, (NULL),
+                           ("no session of %s left", self->omx_component));
+        return FALSE;
+    }
     if (self->gomx->omx_error)
         return GST_STATE_CHANGE_FAILURE;
 
@@ -100,6 +111,42 @@ stop (GstBaseSrc *gst_base)
     return true;
 }
 
+/* Called from the state thread of the core, or from the component on
+ * errors outside of a state change. */
+static void
+state_changed (GOmxCore *core,
+               OMX_STATETYPE state,
+               OMX_ERRORTYPE error)
+{
+    GstOmxBaseSrc *self;
+
+    self = core->client_data;
+
+    if (error == OMX_ErrorNone)
+    {
+        GST_INFO_OBJECT (self, "component in state %d", state);
+        return;
+    }
+
+    /* Whoever waits for the state reports the failure. */
+    if (state != core->omx_state)
+    {
+        GST_WARNING_OBJECT (self, "state change to %d failed: 0x%08x", state, error);
+        return;
+    }
+
+    /* The session goes to a higher priority stream once we're shut down. */
+    if (error == OMX_ErrorResourcesPreempted)
+    {
+        GST_ELEMENT_ERROR (self, RESOURCE, BUSY, (NULL),
+                           ("component preempted by a higher priority stream"));
+        return;
+    }
+
+    GST_ELEMENT_WARNING (self, LIBRARY, FAILED, (NULL),
+                         ("component error: 0x%08x", error));
+}
+
 static void
 dispose (GObject *obj)
 {
@@ -140,6 +187,9 @@ create (GstBaseSrc *gst_base,
 
         setup_ports (self);
         g_omx_core_prepare (self->gomx);
+
+        if (G_UNLIKELY (gomx->omx_error))
+            goto out_state_error;
     }
 
     out_port = self->out_port;
@@ -152,6 +202,9 @@ create (GstBaseSrc *gst_base,
                 {
                     GST_INFO_OBJECT (self, "omx: play");
                     g_omx_core_start (gomx);
+
+                    if (G_UNLIKELY (gomx->omx_error))
+                        goto out_state_error;
                 }
                 break;
             default:
@@ -209,7 +262,7 @@ create (GstBaseSrc *gst_base,
                         }
                     }
 
-                    buf = omx_buffer->pAppPrivate;
+                    buf = G_OMX_BUFFER_DATA (omx_buffer)->client_data;
 
                     if (buf && !(omx_buffer->nFlags & OMX_BUFFERFLAG_EOS))
                     {
@@ -221,7 +274,7 @@ create (GstBaseSrc *gst_base,
                         }
 #endif
 
-                        omx_buffer->pAppPrivate = NULL;
+                        G_OMX_BUFFER_DATA (omx_buffer)->client_data = NULL;
                         omx_buffer->pBuffer = NULL;
                         omx_buffer->nFilledLen = 0;
 
@@ -278,7 +331,7 @@ create (GstBaseSrc *gst_base,
                         if (result == GST_FLOW_OK)
                         {
                             gst_buffer_ref (new_buf);
-                            omx_buffer->pAppPrivate = new_buf;
+                            G_OMX_BUFFER_DATA (omx_buffer)->client_data = new_buf;
 
                             omx_buffer->pBuffer = GST_BUFFER_DATA (new_buf);
                             omx_buffer->nAllocLen = GST_BUFFER_SIZE (new_buf);
@@ -320,6 +373,13 @@ create (GstBaseSrc *gst_base,
     GST_LOG_OBJECT (self, "end");
 
     return ret;
+    /* special conditions */
+out_state_error:
+    {
+        GST_ELEMENT_ERROR (self, LIBRARY, STATE, (NULL),
+                           ("component state change failed: 0x%08x", gomx->omx_error));
+        return GST_FLOW_ERROR;
+    }
 }
 
 static gboolean
@@ -379,6 +439,18 @@ set_property (GObject *obj,
             }
             self->omx_library = g_value_dup_string (value);
             break;
+        case ARG_STATE_TIMEOUT:
+            self->gomx->state_timeout = g_value_get_uint (value);
+            break;
+        case ARG_DISPATCH_CALLBACKS:
+            self->gomx->use_dispatcher = g_value_get_boolean (value);
+            break;
+        case ARG_PRIORITY:
+            self->gomx->priority = g_value_get_uint (value);
+            break;
+        case ARG_ADMISSION_TIMEOUT:
+            self->gomx->admission_timeout = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -403,6 +475,28 @@ get_property (GObject *obj,
         case ARG_LIBRARY_NAME:
             g_value_set_string (value, self->omx_library);
             break;
+        case ARG_STATS:
+            {
+                GstStructure *structure;
+
+                structure = gst_structure_empty_new ("omx-stats");
+                if (self->out_port)
+                    g_omx_port_append_stats (self->out_port, structure, "output");
+                g_value_take_boxed (value, structure);
+            }
+            break;
+        case ARG_STATE_TIMEOUT:
+            g_value_set_uint (value, self->gomx->state_timeout);
+            break;
+        case ARG_DISPATCH_CALLBACKS:
+            g_value_set_boolean (value, self->gomx->use_dispatcher);
+            break;
+        case ARG_PRIORITY:
+            g_value_set_uint (value, self->gomx->priority);
+            break;
+        case ARG_ADMISSION_TIMEOUT:
+            g_value_set_uint (value, self->gomx->admission_timeout);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
@@ -444,6 +538,31 @@ type_class_init (gpointer g_class,
                                          g_param_spec_string ("library-name", "Library name",
                                                               "Name of the OpenMAX IL implementation library to use",
                                                               NULL, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_STATS,
+                                         g_param_spec_boxed ("stats", "Statistics",
+                                                             "Buffer residency, queue occupancy and starvation per port",
+                                                             GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+        g_object_class_install_property (gobject_class, ARG_STATE_TIMEOUT,
+                                         g_param_spec_uint ("state-timeout", "State timeout",
+                                                            "Milliseconds to wait for a state change of the component (0 = forever)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_DISPATCH_CALLBACKS,
+                                         g_param_spec_boolean ("dispatch-callbacks", "Dispatch callbacks",
+                                                               "Queue the component callbacks and handle them in a separate thread",
+                                                               FALSE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_PRIORITY,
+                                         g_param_spec_uint ("priority", "Priority",
+                                                            "Priority of the component among those competing for resources (0 = highest)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_ADMISSION_TIMEOUT,
+                                         g_param_spec_uint ("admission-timeout", "Admission timeout",
+                                                            "Milliseconds to wait for a free session of a limited component (0 = fail at once)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
     }
 }
 
@@ -465,6 +584,7 @@ type_instance_init (GTypeInstance *instance,
         GOmxCore *gomx;
         self->gomx = gomx = g_omx_core_new ();
         gomx->client_data = self;
+        gomx->state_changed_cb = state_changed;
     }
 
     self->omx_library = g_strdup (DEFAULT_LIBRARY_NAME);
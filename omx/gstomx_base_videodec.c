@@ -20,9 +20,14 @@
  */
 
 #include "gstomx_base_videodec.h"
+#include "gstomx_convert.h"
 #include "gstomx.h"
 
 #include <stdlib.h> /* For calloc, free */
+#include <string.h> /* For memcpy */
+
+/* Beyond this, give up on the current GOP and wait for a key frame. */
+#define SKIP_TO_KEYFRAME_LATENESS (GST_SECOND / 2)
 
 static GstOmxBaseFilterClass *parent_class = NULL;
 
@@ -66,6 +71,20 @@ generate_src_template (void)
 
     gst_caps_append_structure (caps, struc);
 
+    /* Padded frames, for sinks that can take them as they are. */
+    {
+        GstStructure *strided;
+
+        strided = gst_structure_copy (struc);
+        gst_structure_set_name (strided, "video/x-raw-yuv-strided");
+        gst_structure_set (strided,
+                           "rowstride", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+                           "slice-height", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+                           NULL);
+
+        gst_caps_append_structure (caps, strided);
+    }
+
     return caps;
 }
 
@@ -87,23 +106,189 @@ type_base_init (gpointer g_class)
     }
 }
 
+static void reset_qos (GstOmxBaseVideoDec *self);
+
+static GstStateChangeReturn
+change_state (GstElement *element,
+              GstStateChange transition)
+{
+    GstOmxBaseVideoDec *self;
+    GstStateChangeReturn ret;
+
+    self = GST_OMX_BASE_VIDEODEC (element);
+
+    ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+    if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+    {
+        GST_OBJECT_LOCK (self);
+        gst_segment_init (&self->segment, GST_FORMAT_TIME);
+        GST_OBJECT_UNLOCK (self);
+        reset_qos (self);
+    }
+
+    return ret;
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
 {
+    GstElementClass *gstelement_class;
+
+    gstelement_class = GST_ELEMENT_CLASS (g_class);
+
     parent_class = g_type_class_ref (GST_OMX_BASE_FILTER_TYPE);
+
+    gstelement_class->change_state = change_state;
+}
+
+/* Row stride of tightly packed frames, as GStreamer lays them out. */
+static inline guint
+packed_stride (guint32 format,
+               guint width)
+{
+    switch (format)
+    {
+        case GST_MAKE_FOURCC ('I', '4', '2', '0'):
+            return GST_ROUND_UP_4 (width);
+        default:
+            return GST_ROUND_UP_4 (width * 2);
+    }
+}
+
+static inline void
+copy_plane (guint8 *dest,
+            guint dest_stride,
+            const guint8 *src,
+            guint src_stride,
+            guint row_size,
+            guint rows)
+{
+    guint i;
+
+    for (i = 0; i < rows; i++)
+    {
+        memcpy (dest, src, row_size);
+        dest += dest_stride;
+        src += src_stride;
+    }
+}
+
+/* Only used when downstream can't take the padded frames as they are, or
+ * when the component gives semi-planar frames. */
+static GstBuffer *
+repack_output (GstOmxBaseFilter *omx_base,
+               OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    GstOmxBaseVideoDec *self;
+    GstBuffer *buf;
+    const guint8 *src;
+    guint8 *dest;
+    guint width, height;
+    guint size;
+
+    self = GST_OMX_BASE_VIDEODEC (omx_base);
+
+    width = self->crop_width;
+    height = self->crop_height;
+
+    if (self->format == GST_MAKE_FOURCC ('I', '4', '2', '0'))
+        size = GST_ROUND_UP_4 (width) * GST_ROUND_UP_2 (height) +
+            2 * GST_ROUND_UP_4 (GST_ROUND_UP_2 (width) / 2) * (GST_ROUND_UP_2 (height) / 2);
+    else
+        size = GST_ROUND_UP_4 (width * 2) * height;
+
+    gst_pad_alloc_buffer_and_set_caps (omx_base->srcpad,
+                                       GST_BUFFER_OFFSET_NONE,
+                                       size,
+                                       GST_PAD_CAPS (omx_base->srcpad),
+                                       &buf);
+
+    if (G_UNLIKELY (!buf))
+    {
+        GST_WARNING_OBJECT (self, "couldn't allocate buffer of size %u", size);
+        return NULL;
+    }
+
+    src = omx_buffer->pBuffer + omx_buffer->nOffset;
+    dest = GST_BUFFER_DATA (buf);
+
+    if (self->semi_planar)
+    {
+        guint dest_stride;
+        const guint8 *src_uv;
+        guint8 *dest_u;
+
+        dest_stride = GST_ROUND_UP_4 (GST_ROUND_UP_2 (width) / 2);
+        dest_u = dest + GST_ROUND_UP_4 (width) * GST_ROUND_UP_2 (height);
+
+        /* UV pairs share the luma stride; keep the crop on a pair boundary. */
+        src_uv = src + self->stride * self->slice_height;
+        src_uv += (self->crop_top / 2) * self->stride + (self->crop_left & ~1);
+
+        gst_omx_convert_nv12_to_i420 (src + self->crop_top * self->stride + self->crop_left, self->stride,
+                                      src_uv, self->stride,
+                                      dest, GST_ROUND_UP_4 (width),
+                                      dest_u, dest_u + dest_stride * (GST_ROUND_UP_2 (height) / 2),
+                                      dest_stride,
+                                      width, height);
+    }
+    else if (self->format == GST_MAKE_FOURCC ('I', '4', '2', '0'))
+    {
+        guint dest_stride;
+        guint src_stride;
+        guint chroma_width;
+        guint chroma_height;
+        const guint8 *src_u;
+        const guint8 *src_v;
+        guint8 *dest_u;
+        guint8 *dest_v;
+
+        copy_plane (dest, GST_ROUND_UP_4 (width),
+                    src + self->crop_top * self->stride + self->crop_left, self->stride,
+                    width, height);
+
+        dest_stride = GST_ROUND_UP_4 (GST_ROUND_UP_2 (width) / 2);
+        src_stride = self->stride / 2;
+        chroma_width = GST_ROUND_UP_2 (width) / 2;
+        chroma_height = GST_ROUND_UP_2 (height) / 2;
+
+        src_u = src + self->stride * self->slice_height;
+        src_v = src_u + src_stride * (self->slice_height / 2);
+        dest_u = dest + GST_ROUND_UP_4 (width) * GST_ROUND_UP_2 (height);
+        dest_v = dest_u + dest_stride * chroma_height;
+
+        src_u += (self->crop_top / 2) * src_stride + self->crop_left / 2;
+        src_v += (self->crop_top / 2) * src_stride + self->crop_left / 2;
+
+        copy_plane (dest_u, dest_stride, src_u, src_stride, chroma_width, chroma_height);
+        copy_plane (dest_v, dest_stride, src_v, src_stride, chroma_width, chroma_height);
+    }
+    else
+    {
+        copy_plane (dest, GST_ROUND_UP_4 (width * 2),
+                    src + self->crop_top * self->stride + self->crop_left * 2, self->stride,
+                    width * 2, height);
+    }
+
+    return buf;
 }
 
 static void
 settings_changed_cb (GOmxCore *core)
 {
     GstOmxBaseFilter *omx_base;
+    GstOmxBaseVideoDec *self;
     guint width;
     guint height;
     guint framerate;
     guint32 format = 0;
+    gboolean semi_planar = FALSE;
+    gboolean packed;
 
     omx_base = core->client_data;
+    self = GST_OMX_BASE_VIDEODEC (omx_base);
 
     GST_DEBUG_OBJECT (omx_base, "settings changed");
 
@@ -126,6 +311,11 @@ settings_changed_cb (GOmxCore *core)
         {
             case OMX_COLOR_FormatYUV420Planar:
                 format = GST_MAKE_FOURCC ('I', '4', '2', '0'); break;
+            case OMX_COLOR_FormatYUV420SemiPlanar:
+                /* converted to I420 on the way out */
+                format = GST_MAKE_FOURCC ('I', '4', '2', '0');
+                semi_planar = TRUE;
+                break;
             case OMX_COLOR_FormatYCbYCr:
                 format = GST_MAKE_FOURCC ('Y', 'U', 'Y', '2'); break;
             case OMX_COLOR_FormatCbYCrY:
@@ -134,15 +324,105 @@ settings_changed_cb (GOmxCore *core)
                 break;
         }
 
+        /* Components that don't say are taken as packed. */
+        self->stride = param->format.video.nStride > 0 ?
+            (guint) param->format.video.nStride : packed_stride (format, width);
+        self->slice_height = param->format.video.nSliceHeight > 0 ?
+            param->format.video.nSliceHeight : height;
+
         free (param);
     }
 
+    {
+        OMX_CONFIG_RECTTYPE *rect;
+
+        rect = calloc (1, sizeof (OMX_CONFIG_RECTTYPE));
+
+        rect->nSize = sizeof (OMX_CONFIG_RECTTYPE);
+        rect->nVersion.s.nVersionMajor = 1;
+        rect->nVersion.s.nVersionMinor = 1;
+
+        rect->nPortIndex = 1;
+
+        if (OMX_GetConfig (omx_base->gomx->omx_handle, OMX_IndexConfigCommonOutputCrop, rect) == OMX_ErrorNone &&
+            rect->nWidth > 0 && rect->nHeight > 0)
+        {
+            self->crop_left = rect->nLeft;
+            self->crop_top = rect->nTop;
+            self->crop_width = rect->nWidth;
+            self->crop_height = rect->nHeight;
+        }
+        else
+        {
+            self->crop_left = 0;
+            self->crop_top = 0;
+            self->crop_width = width;
+            self->crop_height = height;
+        }
+
+        free (rect);
+    }
+
+    self->format = format;
+    self->semi_planar = semi_planar;
+
+    packed = (self->stride == packed_stride (format, self->crop_width) &&
+              self->slice_height == self->crop_height &&
+              self->crop_left == 0 && self->crop_top == 0 &&
+              !semi_planar);
+
+    /* GStreamer pads the chroma rows of I420 on their own. */
+    if (format == GST_MAKE_FOURCC ('I', '4', '2', '0'))
+        packed = packed && (self->stride / 2 == GST_ROUND_UP_4 (GST_ROUND_UP_2 (self->crop_width) / 2));
+
+    GST_INFO_OBJECT (omx_base, "%ux%u, stride %u, slice height %u, crop %u,%u %ux%u",
+                     width, height, self->stride, self->slice_height,
+                     self->crop_left, self->crop_top, self->crop_width, self->crop_height);
+
+    omx_base->repack_output = NULL;
+
+    if (!packed)
+    {
+        gboolean strided = FALSE;
+
+        /* Padding at the end of the rows and of the frame can be described
+         * in the caps; anything else has to be copied out. */
+        if (self->crop_left == 0 && self->crop_top == 0 &&
+            format != 0 && !semi_planar)
+        {
+            GstCaps *new_caps;
+
+            new_caps = gst_caps_new_simple ("video/x-raw-yuv-strided",
+                                            "width", G_TYPE_INT, self->crop_width,
+                                            "height", G_TYPE_INT, self->crop_height,
+                                            "framerate", GST_TYPE_FRACTION, framerate, 1,
+                                            "format", GST_TYPE_FOURCC, format,
+                                            "rowstride", G_TYPE_INT, self->stride,
+                                            "slice-height", G_TYPE_INT, self->slice_height,
+                                            NULL);
+
+            if (gst_pad_peer_accept_caps (omx_base->srcpad, new_caps))
+            {
+                GST_INFO_OBJECT (omx_base, "caps are: %" GST_PTR_FORMAT, new_caps);
+                strided = gst_pad_set_caps (omx_base->srcpad, new_caps);
+            }
+
+            gst_caps_unref (new_caps);
+        }
+
+        if (strided)
+            return;
+
+        GST_INFO_OBJECT (omx_base, "downstream needs packed frames; repacking");
+        omx_base->repack_output = repack_output;
+    }
+
     {
         GstCaps *new_caps;
 
         new_caps = gst_caps_new_simple ("video/x-raw-yuv",
-                                        "width", G_TYPE_INT, width,
-                                        "height", G_TYPE_INT, height,
+                                        "width", G_TYPE_INT, self->crop_width,
+                                        "height", G_TYPE_INT, self->crop_height,
                                         "framerate", GST_TYPE_FRACTION, framerate, 1,
                                         "format", GST_TYPE_FOURCC, format,
                                         NULL);
@@ -178,6 +458,16 @@ sink_setcaps (GstPad *pad,
     gst_structure_get_int (structure, "width", &width);
     gst_structure_get_int (structure, "height", &height);
 
+    {
+        const GValue *framerate;
+
+        framerate = gst_structure_get_value (structure, "framerate");
+        if (framerate && omx_base->timestamps)
+            gst_omx_timestamps_set_framerate (omx_base->timestamps,
+                                              gst_value_get_fraction_numerator (framerate),
+                                              gst_value_get_fraction_denominator (framerate));
+    }
+
     param = calloc (1, sizeof (OMX_PARAM_PORTDEFINITIONTYPE));
     param->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
     param->nVersion.s.nVersionMajor = 1;
@@ -209,9 +499,184 @@ sink_setcaps (GstPad *pad,
 
     free (param);
 
+    gst_omx_base_filter_eager_prepare (omx_base);
+
     return gst_pad_set_caps (pad, caps);
 }
 
+static void
+reset_qos (GstOmxBaseVideoDec *self)
+{
+    GST_OBJECT_LOCK (self);
+    self->proportion = 1.0;
+    self->earliest_time = GST_CLOCK_TIME_NONE;
+    self->waiting_for_keyframe = FALSE;
+    self->processed = 0;
+    self->dropped = 0;
+    GST_OBJECT_UNLOCK (self);
+}
+
+static void
+post_qos (GstOmxBaseVideoDec *self,
+          GstClockTime timestamp,
+          GstClockTime qostime,
+          GstClockTime duration,
+          GstClockTime earliest_time)
+{
+    GstMessage *msg;
+
+    msg = gst_message_new_qos (GST_OBJECT (self), FALSE, qostime,
+                               gst_segment_to_stream_time (&self->segment, GST_FORMAT_TIME, timestamp),
+                               timestamp, duration);
+    gst_message_set_qos_values (msg, GST_CLOCK_DIFF (earliest_time, qostime),
+                                self->proportion, 1000000);
+    gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, self->processed, self->dropped);
+
+    gst_element_post_message (GST_ELEMENT (self), msg);
+}
+
+static gboolean
+skip_buffer (GstOmxBaseFilter *omx_base,
+             GstBuffer *buf)
+{
+    GstOmxBaseVideoDec *self;
+    GstClockTime timestamp;
+    GstClockTime qostime = GST_CLOCK_TIME_NONE;
+    GstClockTime earliest_time;
+    gboolean keyframe;
+    gboolean skip = FALSE;
+
+    self = GST_OMX_BASE_VIDEODEC (omx_base);
+
+    timestamp = GST_BUFFER_TIMESTAMP (buf);
+    keyframe = !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    GST_OBJECT_LOCK (self);
+
+    earliest_time = self->earliest_time;
+
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+        qostime = gst_segment_to_running_time (&self->segment, GST_FORMAT_TIME, timestamp);
+
+    if (self->waiting_for_keyframe)
+    {
+        if (keyframe)
+            self->waiting_for_keyframe = FALSE;
+        else
+            skip = TRUE;
+    }
+    else if (!keyframe &&
+             GST_CLOCK_TIME_IS_VALID (qostime) &&
+             GST_CLOCK_TIME_IS_VALID (earliest_time) &&
+             qostime <= earliest_time)
+    {
+        if (earliest_time - qostime > SKIP_TO_KEYFRAME_LATENESS)
+        {
+            GST_DEBUG_OBJECT (self, "%" GST_TIME_FORMAT " late; skipping to the next key frame",
+                              GST_TIME_ARGS (earliest_time - qostime));
+            self->waiting_for_keyframe = TRUE;
+            skip = TRUE;
+        }
+        else if (self->is_droppable && self->is_droppable (self, buf))
+        {
+            skip = TRUE;
+        }
+    }
+
+    if (skip)
+        self->dropped++;
+    else
+        self->processed++;
+
+    GST_OBJECT_UNLOCK (self);
+
+    if (skip && GST_CLOCK_TIME_IS_VALID (qostime))
+        post_qos (self, timestamp, qostime, GST_BUFFER_DURATION (buf), earliest_time);
+
+    return skip;
+}
+
+static void
+sink_event (GstOmxBaseFilter *omx_base,
+            GstEvent *event)
+{
+    GstOmxBaseVideoDec *self;
+
+    self = GST_OMX_BASE_VIDEODEC (omx_base);
+
+    switch (GST_EVENT_TYPE (event))
+    {
+        case GST_EVENT_NEWSEGMENT:
+            {
+                gboolean update;
+                gdouble rate;
+                gdouble applied_rate;
+                GstFormat format;
+                gint64 start, stop, position;
+
+                gst_event_parse_new_segment_full (event, &update, &rate, &applied_rate,
+                                                  &format, &start, &stop, &position);
+
+                if (format == GST_FORMAT_TIME)
+                {
+                    GST_OBJECT_LOCK (self);
+                    gst_segment_set_newsegment_full (&self->segment, update, rate, applied_rate,
+                                                     format, start, stop, position);
+                    GST_OBJECT_UNLOCK (self);
+                }
+            }
+            break;
+        case GST_EVENT_FLUSH_STOP:
+            GST_OBJECT_LOCK (self);
+            gst_segment_init (&self->segment, GST_FORMAT_TIME);
+            GST_OBJECT_UNLOCK (self);
+            reset_qos (self);
+            break;
+        default:
+            break;
+    }
+}
+
+static gboolean
+src_event (GstPad *pad,
+           GstEvent *event)
+{
+    GstOmxBaseVideoDec *self;
+    GstOmxBaseFilter *omx_base;
+
+    self = GST_OMX_BASE_VIDEODEC (GST_OBJECT_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_QOS)
+    {
+        gdouble proportion;
+        GstClockTimeDiff diff;
+        GstClockTime timestamp;
+
+        gst_event_parse_qos (event, &proportion, &diff, &timestamp);
+
+        GST_OBJECT_LOCK (self);
+        self->proportion = proportion;
+        if (GST_CLOCK_TIME_IS_VALID (timestamp))
+        {
+            /* Being late usually gets worse before it gets better. */
+            if (diff > 0)
+                self->earliest_time = timestamp + 2 * diff;
+            else
+                self->earliest_time = timestamp + diff;
+        }
+        else
+        {
+            self->earliest_time = GST_CLOCK_TIME_NONE;
+        }
+        GST_OBJECT_UNLOCK (self);
+
+        GST_LOG_OBJECT (self, "qos: proportion=%g, diff=%" G_GINT64_FORMAT, proportion, diff);
+    }
+
+    return gst_pad_push_event (omx_base->sinkpad, event);
+}
+
 static void
 omx_setup (GstOmxBaseFilter *omx_base)
 {
@@ -301,14 +766,22 @@ type_instance_init (GTypeInstance *instance,
                     gpointer g_class)
 {
     GstOmxBaseFilter *omx_base;
+    GstOmxBaseVideoDec *self;
 
     omx_base = GST_OMX_BASE_FILTER (instance);
+    self = GST_OMX_BASE_VIDEODEC (instance);
 
     omx_base->omx_setup = omx_setup;
+    omx_base->sink_event = sink_event;
+    omx_base->skip_buffer = skip_buffer;
 
     omx_base->gomx->settings_changed_cb = settings_changed_cb;
 
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
+    gst_pad_set_event_function (omx_base->srcpad, src_event);
+
+    gst_segment_init (&self->segment, GST_FORMAT_TIME);
+    reset_qos (self);
 }
 
 GType
@@ -32,6 +32,7 @@ G_BEGIN_DECLS
 
 typedef struct GstOmxBaseVideoDec GstOmxBaseVideoDec;
 typedef struct GstOmxBaseVideoDecClass GstOmxBaseVideoDecClass;
+typedef gboolean (*GstOmxBaseVideoDecBufferCb) (GstOmxBaseVideoDec *self, GstBuffer *buf);
 
 #include "gstomx_base_filter.h"
 
@@ -40,6 +41,26 @@ struct GstOmxBaseVideoDec
     GstOmxBaseFilter omx_base;
 
     OMX_VIDEO_CODINGTYPE compression_format;
+
+    /* Output layout, as the component reports it. */
+    guint32 format;
+    gboolean semi_planar;
+    guint stride;
+    guint slice_height;
+    guint crop_left;
+    guint crop_top;
+    guint crop_width;
+    guint crop_height;
+
+    /* QoS; protected by the object lock. */
+    GstSegment segment;
+    gdouble proportion;
+    GstClockTime earliest_time;
+    gboolean waiting_for_keyframe;
+    guint64 processed;
+    guint64 dropped;
+
+    GstOmxBaseVideoDecBufferCb is_droppable; /**< Nothing refers to this frame. */
 };
 
 struct GstOmxBaseVideoDecClass
@@ -20,6 +20,7 @@
  */
 
 #include "gstomx_base_videoenc.h"
+#include "gstomx_convert.h"
 #include "gstomx.h"
 
 #include <stdlib.h> /* For calloc, free */
@@ -28,10 +29,40 @@
 enum
 {
     ARG_0,
-    ARG_BITRATE
+    ARG_BITRATE,
+    ARG_CONTROL_RATE,
+    ARG_GOP_LENGTH,
+    ARG_B_FRAMES
 };
 
 #define DEFAULT_BITRATE 500000
+#define DEFAULT_CONTROL_RATE OMX_Video_ControlRateVariable
+#define DEFAULT_GOP_LENGTH 0
+#define DEFAULT_B_FRAMES -1
+
+#define GST_OMX_VIDEOENC_CONTROL_RATE_TYPE (gst_omx_videoenc_control_rate_get_type ())
+
+static GType
+gst_omx_videoenc_control_rate_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY (type == 0))
+    {
+        static const GEnumValue values[] = {
+            { OMX_Video_ControlRateDisable, "Disable rate control", "disable" },
+            { OMX_Video_ControlRateVariable, "Variable bit-rate", "variable" },
+            { OMX_Video_ControlRateConstant, "Constant bit-rate", "constant" },
+            { OMX_Video_ControlRateVariableSkipFrames, "Variable bit-rate, frames may be skipped", "variable-skip-frames" },
+            { OMX_Video_ControlRateConstantSkipFrames, "Constant bit-rate, frames may be skipped", "constant-skip-frames" },
+            { 0, NULL, NULL }
+        };
+
+        type = g_enum_register_static ("GstOmxVideoEncControlRate", values);
+    }
+
+    return type;
+}
 
 static GstOmxBaseFilterClass *parent_class = NULL;
 
@@ -96,6 +127,257 @@ type_base_init (gpointer g_class)
     }
 }
 
+/* Can be used while the component is running. */
+static void
+update_bitrate (GstOmxBaseVideoEnc *self)
+{
+    GOmxCore *gomx;
+    OMX_VIDEO_CONFIG_BITRATETYPE *config;
+    OMX_ERRORTYPE error;
+
+    gomx = (GOmxCore *) self->omx_base.gomx;
+
+    config = calloc (1, sizeof (OMX_VIDEO_CONFIG_BITRATETYPE));
+    config->nSize = sizeof (OMX_VIDEO_CONFIG_BITRATETYPE);
+    config->nVersion.s.nVersionMajor = 1;
+    config->nVersion.s.nVersionMinor = 1;
+    config->nPortIndex = 1;
+
+    config->nEncodeBitrate = self->bitrate;
+
+    error = OMX_SetConfig (gomx->omx_handle, OMX_IndexConfigVideoBitrate, config);
+
+    if (error != OMX_ErrorNone)
+        GST_WARNING_OBJECT (self, "couldn't change bit-rate: 0x%08x", error);
+    else
+        GST_INFO_OBJECT (self, "bit-rate: %u", self->bitrate);
+
+    free (config);
+}
+
+static void
+request_keyframe (GstOmxBaseVideoEnc *self)
+{
+    GOmxCore *gomx;
+    OMX_CONFIG_INTRAREFRESHVOPTYPE *config;
+    OMX_ERRORTYPE error;
+
+    gomx = (GOmxCore *) self->omx_base.gomx;
+
+    /* The first frame is a key frame anyway. */
+    if (gomx->omx_state != OMX_StateExecuting &&
+        gomx->omx_state != OMX_StatePause)
+        return;
+
+    config = calloc (1, sizeof (OMX_CONFIG_INTRAREFRESHVOPTYPE));
+    config->nSize = sizeof (OMX_CONFIG_INTRAREFRESHVOPTYPE);
+    config->nVersion.s.nVersionMajor = 1;
+    config->nVersion.s.nVersionMinor = 1;
+    config->nPortIndex = 1;
+
+    config->IntraRefreshVOP = OMX_TRUE;
+
+    error = OMX_SetConfig (gomx->omx_handle, OMX_IndexConfigVideoIntraVOPRefresh, config);
+
+    if (error != OMX_ErrorNone)
+        GST_WARNING_OBJECT (self, "couldn't force key frame: 0x%08x", error);
+    else
+        GST_DEBUG_OBJECT (self, "forced key frame");
+
+    free (config);
+}
+
+static inline gboolean
+is_force_key_unit (GstEvent *event)
+{
+    const GstStructure *structure;
+
+    if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_DOWNSTREAM &&
+        GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_UPSTREAM)
+        return FALSE;
+
+    structure = gst_event_get_structure (event);
+
+    return structure && gst_structure_has_name (structure, "GstForceKeyUnit");
+}
+
+/* Downstream requests are still forwarded, so muxers know what's coming. */
+static void
+sink_event (GstOmxBaseFilter *omx_base,
+            GstEvent *event)
+{
+    if (is_force_key_unit (event))
+        request_keyframe (GST_OMX_BASE_VIDEOENC (omx_base));
+}
+
+static gboolean
+src_event (GstPad *pad,
+           GstEvent *event)
+{
+    GstOmxBaseVideoEnc *self;
+
+    self = GST_OMX_BASE_VIDEOENC (GST_OBJECT_PARENT (pad));
+
+    if (is_force_key_unit (event))
+    {
+        GstEvent *downstream;
+
+        /* Downstream learns where the key frame is once it's out. */
+        downstream = gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM,
+                                           gst_structure_copy (gst_event_get_structure (event)));
+
+        GST_OBJECT_LOCK (self);
+        if (self->key_unit_event)
+            gst_event_unref (self->key_unit_event);
+        self->key_unit_event = downstream;
+        GST_OBJECT_UNLOCK (self);
+
+        request_keyframe (self);
+        gst_event_unref (event);
+        return TRUE;
+    }
+
+    return gst_pad_event_default (pad, event);
+}
+
+static gboolean
+before_push (GstOmxBaseFilter *omx_base,
+             GstBuffer *buf)
+{
+    GstOmxBaseVideoEnc *self;
+    GstEvent *event;
+    GstStructure *structure;
+
+    self = GST_OMX_BASE_VIDEOENC (omx_base);
+
+    if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT) ||
+        GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_IN_CAPS))
+        return TRUE;
+
+    GST_OBJECT_LOCK (self);
+    event = self->key_unit_event;
+    self->key_unit_event = NULL;
+    GST_OBJECT_UNLOCK (self);
+
+    if (!event)
+        return TRUE;
+
+    structure = (GstStructure *) gst_event_get_structure (event);
+    gst_structure_set (structure,
+                       "timestamp", G_TYPE_UINT64, GST_BUFFER_TIMESTAMP (buf),
+                       NULL);
+
+    GST_DEBUG_OBJECT (self, "key unit at %" GST_TIME_FORMAT,
+                      GST_TIME_ARGS (GST_BUFFER_TIMESTAMP (buf)));
+
+    gst_pad_push_event (omx_base->srcpad, event);
+
+    return TRUE;
+}
+
+/* Number of P and B frames between I frames; FALSE if nothing was set. */
+static gboolean
+get_gop (GstOmxBaseVideoEnc *self,
+         OMX_U32 *p_frames,
+         OMX_U32 *b_frames)
+{
+    if (self->b_frames >= 0)
+        *b_frames = self->b_frames;
+
+    if (self->gop_length > 0)
+    {
+        if (*b_frames >= self->gop_length)
+            *b_frames = self->gop_length - 1;
+        *p_frames = self->gop_length - 1 - *b_frames;
+    }
+
+    return self->gop_length > 0 || self->b_frames >= 0;
+}
+
+static void
+setup_gop (GstOmxBaseVideoEnc *self)
+{
+    GOmxCore *gomx;
+    OMX_ERRORTYPE error = OMX_ErrorNone;
+
+    gomx = (GOmxCore *) self->omx_base.gomx;
+
+    switch (self->compression_format)
+    {
+        case OMX_VIDEO_CodingAVC:
+            {
+                OMX_VIDEO_PARAM_AVCTYPE *param;
+
+                param = calloc (1, sizeof (OMX_VIDEO_PARAM_AVCTYPE));
+                param->nSize = sizeof (OMX_VIDEO_PARAM_AVCTYPE);
+                param->nVersion.s.nVersionMajor = 1;
+                param->nVersion.s.nVersionMinor = 1;
+                param->nPortIndex = 1;
+
+                OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoAvc, param);
+
+                if (get_gop (self, &param->nPFrames, &param->nBFrames))
+                {
+                    if (param->nBFrames > 0)
+                        param->nAllowedPictureTypes |= OMX_VIDEO_PictureTypeB;
+                    error = OMX_SetParameter (gomx->omx_handle, OMX_IndexParamVideoAvc, param);
+                }
+
+                free (param);
+            }
+            break;
+        case OMX_VIDEO_CodingMPEG4:
+            {
+                OMX_VIDEO_PARAM_MPEG4TYPE *param;
+
+                param = calloc (1, sizeof (OMX_VIDEO_PARAM_MPEG4TYPE));
+                param->nSize = sizeof (OMX_VIDEO_PARAM_MPEG4TYPE);
+                param->nVersion.s.nVersionMajor = 1;
+                param->nVersion.s.nVersionMinor = 1;
+                param->nPortIndex = 1;
+
+                OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoMpeg4, param);
+
+                if (get_gop (self, &param->nPFrames, &param->nBFrames))
+                {
+                    if (param->nBFrames > 0)
+                        param->nAllowedPictureTypes |= OMX_VIDEO_PictureTypeB;
+                    error = OMX_SetParameter (gomx->omx_handle, OMX_IndexParamVideoMpeg4, param);
+                }
+
+                free (param);
+            }
+            break;
+        case OMX_VIDEO_CodingH263:
+            {
+                OMX_VIDEO_PARAM_H263TYPE *param;
+
+                param = calloc (1, sizeof (OMX_VIDEO_PARAM_H263TYPE));
+                param->nSize = sizeof (OMX_VIDEO_PARAM_H263TYPE);
+                param->nVersion.s.nVersionMajor = 1;
+                param->nVersion.s.nVersionMinor = 1;
+                param->nPortIndex = 1;
+
+                OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoH263, param);
+
+                if (get_gop (self, &param->nPFrames, &param->nBFrames))
+                {
+                    if (param->nBFrames > 0)
+                        param->nAllowedPictureTypes |= OMX_VIDEO_PictureTypeB;
+                    error = OMX_SetParameter (gomx->omx_handle, OMX_IndexParamVideoH263, param);
+                }
+
+                free (param);
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (error != OMX_ErrorNone)
+        GST_WARNING_OBJECT (self, "couldn't set GOP structure: 0x%08x", error);
+}
+
 static void
 set_property (GObject *obj,
               guint prop_id,
@@ -110,6 +392,24 @@ set_property (GObject *obj,
     {
         case ARG_BITRATE:
             self->bitrate = g_value_get_uint (value);
+            {
+                GOmxCore *gomx;
+
+                gomx = (GOmxCore *) self->omx_base.gomx;
+
+                if (gomx->omx_state == OMX_StateExecuting ||
+                    gomx->omx_state == OMX_StatePause)
+                    update_bitrate (self);
+            }
+            break;
+        case ARG_CONTROL_RATE:
+            self->control_rate = g_value_get_enum (value);
+            break;
+        case ARG_GOP_LENGTH:
+            self->gop_length = g_value_get_uint (value);
+            break;
+        case ARG_B_FRAMES:
+            self->b_frames = g_value_get_int (value);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
@@ -130,15 +430,39 @@ get_property (GObject *obj,
     switch (prop_id)
     {
         case ARG_BITRATE:
-            /** @todo propagate this to OpenMAX when processing. */
             g_value_set_uint (value, self->bitrate);
             break;
+        case ARG_CONTROL_RATE:
+            g_value_set_enum (value, self->control_rate);
+            break;
+        case ARG_GOP_LENGTH:
+            g_value_set_uint (value, self->gop_length);
+            break;
+        case ARG_B_FRAMES:
+            g_value_set_int (value, self->b_frames);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
             break;
     }
 }
 
+static void
+dispose (GObject *obj)
+{
+    GstOmxBaseVideoEnc *self;
+
+    self = GST_OMX_BASE_VIDEOENC (obj);
+
+    if (self->key_unit_event)
+    {
+        gst_event_unref (self->key_unit_event);
+        self->key_unit_event = NULL;
+    }
+
+    G_OBJECT_CLASS (parent_class)->dispose (obj);
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
@@ -149,6 +473,8 @@ type_class_init (gpointer g_class,
 
     parent_class = g_type_class_ref (GST_OMX_BASE_FILTER_TYPE);
 
+    gobject_class->dispose = dispose;
+
     /* Properties stuff */
     {
         gobject_class->set_property = set_property;
@@ -156,9 +482,95 @@ type_class_init (gpointer g_class,
 
         g_object_class_install_property (gobject_class, ARG_BITRATE,
                                          g_param_spec_uint ("bitrate", "Bit-rate",
-                                                            "Encoding bit-rate",
+                                                            "Encoding bit-rate; can be changed while playing",
                                                             0, G_MAXUINT, DEFAULT_BITRATE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_CONTROL_RATE,
+                                         g_param_spec_enum ("control-rate", "Control rate",
+                                                            "Rate control mode; applied when the component is set up",
+                                                            GST_OMX_VIDEOENC_CONTROL_RATE_TYPE,
+                                                            DEFAULT_CONTROL_RATE, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_GOP_LENGTH,
+                                         g_param_spec_uint ("gop-length", "GOP length",
+                                                            "Frames from one I frame to the next (0 = component default)",
+                                                            0, G_MAXUINT, DEFAULT_GOP_LENGTH, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_B_FRAMES,
+                                         g_param_spec_int ("b-frames", "B frames",
+                                                           "B frames per GOP; the rest are P frames (-1 = component default)",
+                                                           -1, G_MAXINT, DEFAULT_B_FRAMES, G_PARAM_READWRITE));
+    }
+}
+
+/* Whether the input port lists color_format among the ones it takes. */
+static gboolean
+has_color_format (GOmxCore *gomx,
+                  OMX_COLOR_FORMATTYPE color_format)
+{
+    OMX_VIDEO_PARAM_PORTFORMATTYPE *param;
+    gboolean found = FALSE;
+    guint i;
+
+    param = calloc (1, sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE));
+    param->nSize = sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE);
+    param->nVersion.s.nVersionMajor = 1;
+    param->nVersion.s.nVersionMinor = 1;
+
+    param->nPortIndex = 0;
+
+    for (i = 0; !found; i++)
+    {
+        param->nIndex = i;
+        if (OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoPortFormat, param) != OMX_ErrorNone)
+            break;
+
+        found = (param->eColorFormat == color_format);
+    }
+
+    free (param);
+
+    return found;
+}
+
+/* Converts a packed I420 frame into the component's NV12 layout. */
+static void
+repack_input (GstOmxBaseFilter *omx_base,
+              GstBuffer *buf,
+              OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    GstOmxBaseVideoEnc *self;
+    const guint8 *src;
+    guint8 *dest;
+    guint y_stride, uv_stride;
+    guint chroma_height;
+
+    self = GST_OMX_BASE_VIDEOENC (omx_base);
+
+    y_stride = GST_ROUND_UP_4 (self->width);
+    uv_stride = GST_ROUND_UP_4 (GST_ROUND_UP_2 (self->width) / 2);
+    chroma_height = GST_ROUND_UP_2 (self->height) / 2;
+
+    omx_buffer->nFilledLen = self->stride * (self->slice_height + chroma_height);
+
+    if (G_UNLIKELY (GST_BUFFER_SIZE (buf) < y_stride * GST_ROUND_UP_2 (self->height) + 2 * uv_stride * chroma_height ||
+                    omx_buffer->nAllocLen - omx_buffer->nOffset < omx_buffer->nFilledLen))
+    {
+        GST_WARNING_OBJECT (self, "frame doesn't fit; dropping it");
+        omx_buffer->nFilledLen = 0;
+        return;
     }
+
+    src = GST_BUFFER_DATA (buf);
+    dest = omx_buffer->pBuffer + omx_buffer->nOffset;
+
+    gst_omx_convert_i420_to_nv12 (src, y_stride,
+                                  src + y_stride * GST_ROUND_UP_2 (self->height),
+                                  src + y_stride * GST_ROUND_UP_2 (self->height) + uv_stride * chroma_height,
+                                  uv_stride,
+                                  dest, self->stride,
+                                  dest + self->stride * self->slice_height, self->stride,
+                                  self->width, self->height);
 }
 
 static gboolean
@@ -167,6 +579,7 @@ sink_setcaps (GstPad *pad,
 {
     GstStructure *structure;
     GstOmxBaseFilter *omx_base;
+    GstOmxBaseVideoEnc *self;
     GOmxCore *gomx;
     OMX_COLOR_FORMATTYPE color_format = OMX_COLOR_FormatUnused;
     gint width = 0;
@@ -174,6 +587,7 @@ sink_setcaps (GstPad *pad,
     gint framerate = 0;
 
     omx_base = GST_OMX_BASE_FILTER (GST_PAD_PARENT (pad));
+    self = GST_OMX_BASE_VIDEOENC (omx_base);
     gomx = (GOmxCore *) omx_base->gomx;
 
     GST_INFO_OBJECT (omx_base, "setcaps (sink): %" GST_PTR_FORMAT, caps);
@@ -217,6 +631,17 @@ sink_setcaps (GstPad *pad,
         }
     }
 
+    /* Plenty of components only take semi-planar input. */
+    self->semi_planar = (color_format == OMX_COLOR_FormatYUV420Planar &&
+                         !has_color_format (gomx, OMX_COLOR_FormatYUV420Planar) &&
+                         has_color_format (gomx, OMX_COLOR_FormatYUV420SemiPlanar));
+
+    if (self->semi_planar)
+    {
+        GST_INFO_OBJECT (omx_base, "converting I420 input to semi-planar");
+        color_format = OMX_COLOR_FormatYUV420SemiPlanar;
+    }
+
     {
         OMX_PARAM_PORTDEFINITIONTYPE *param;
         param = calloc (1, sizeof (OMX_PARAM_PORTDEFINITIONTYPE));
@@ -237,9 +662,24 @@ sink_setcaps (GstPad *pad,
             OMX_SetParameter (gomx->omx_handle, OMX_IndexParamPortDefinition, param);
         }
 
+        /* The component may have padded the planes. */
+        if (self->semi_planar)
+        {
+            OMX_GetParameter (gomx->omx_handle, OMX_IndexParamPortDefinition, param);
+
+            self->width = width;
+            self->height = height;
+            self->stride = param->format.video.nStride > 0 ?
+                (guint) param->format.video.nStride : GST_ROUND_UP_2 (width);
+            self->slice_height = param->format.video.nSliceHeight > 0 ?
+                param->format.video.nSliceHeight : (guint) height;
+        }
+
         free (param);
     }
 
+    omx_base->repack_input = self->semi_planar ? repack_input : NULL;
+
     return gst_pad_set_caps (pad, caps);
 }
 
@@ -271,13 +711,42 @@ omx_setup (GstOmxBaseFilter *omx_base)
             OMX_GetParameter (gomx->omx_handle, OMX_IndexParamPortDefinition, param);
 
             param->format.video.eCompressionFormat = self->compression_format;
-
-            /** @todo this should be set with a property */
             param->format.video.nBitrate = self->bitrate;
 
             OMX_SetParameter (gomx->omx_handle, OMX_IndexParamPortDefinition, param);
         }
 
+        {
+            OMX_VIDEO_PARAM_BITRATETYPE *bitrate_param;
+            OMX_ERRORTYPE error;
+
+            bitrate_param = calloc (1, sizeof (OMX_VIDEO_PARAM_BITRATETYPE));
+            bitrate_param->nSize = sizeof (OMX_VIDEO_PARAM_BITRATETYPE);
+            bitrate_param->nVersion.s.nVersionMajor = 1;
+            bitrate_param->nVersion.s.nVersionMinor = 1;
+            bitrate_param->nPortIndex = 1;
+
+            error = OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoBitrate, bitrate_param);
+
+            if (error == OMX_ErrorNone)
+            {
+                bitrate_param->eControlRate = self->control_rate;
+                bitrate_param->nTargetBitrate = self->bitrate;
+
+                error = OMX_SetParameter (gomx->omx_handle, OMX_IndexParamVideoBitrate, bitrate_param);
+            }
+
+            if (error != OMX_ErrorNone)
+                GST_WARNING_OBJECT (omx_base, "couldn't set rate control: 0x%08x", error);
+
+            free (bitrate_param);
+        }
+
+        setup_gop (self);
+
+        if (self->codec_setup)
+            self->codec_setup (omx_base);
+
         /* some workarounds. */
         /* required for TI components. */
 #if 1
@@ -341,10 +810,17 @@ type_instance_init (GTypeInstance *instance,
     self = GST_OMX_BASE_VIDEOENC (instance);
 
     omx_base->omx_setup = omx_setup;
+    omx_base->sink_event = sink_event;
+    omx_base->before_push = before_push;
+    omx_base->mark_delta_units = TRUE;
 
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
+    gst_pad_set_event_function (omx_base->srcpad, src_event);
 
     self->bitrate = DEFAULT_BITRATE;
+    self->control_rate = DEFAULT_CONTROL_RATE;
+    self->gop_length = DEFAULT_GOP_LENGTH;
+    self->b_frames = DEFAULT_B_FRAMES;
 }
 
 GType
@@ -40,6 +40,19 @@ struct GstOmxBaseVideoEnc
 
     OMX_VIDEO_CODINGTYPE compression_format;
     guint bitrate;
+    OMX_VIDEO_CONTROLRATETYPE control_rate;
+    guint gop_length;
+    gint b_frames;
+
+    gboolean semi_planar; /**< Component takes NV12; input is converted from I420. */
+    guint width;
+    guint height;
+    guint stride;
+    guint slice_height;
+
+    GstEvent *key_unit_event; /**< Pushed before the next key frame; with the object lock. */
+
+    GstOmxBaseFilterCb codec_setup; /**< Codec specific parameters, after ours. */
 };
 
 struct GstOmxBaseVideoEncClass
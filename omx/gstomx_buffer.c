@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstomx_buffer.h"
+
+static GstBufferClass *parent_class = NULL;
+
+static void
+finalize (GstMiniObject *obj)
+{
+    GstOmxBuffer *self;
+
+    self = GST_OMX_BUFFER (obj);
+
+    if (self->notify)
+        self->notify (self->user_data);
+
+    /* The data belongs to somebody else. */
+    GST_BUFFER_MALLOCDATA (self) = NULL;
+
+    GST_MINI_OBJECT_CLASS (parent_class)->finalize (obj);
+}
+
+static void
+type_class_init (gpointer g_class,
+                 gpointer class_data)
+{
+    GstMiniObjectClass *mini_object_class;
+
+    mini_object_class = GST_MINI_OBJECT_CLASS (g_class);
+
+    parent_class = g_type_class_peek_parent (g_class);
+
+    mini_object_class->finalize = finalize;
+}
+
+GType
+gst_omx_buffer_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY (type == 0))
+    {
+        GTypeInfo *type_info;
+
+        type_info = g_new0 (GTypeInfo, 1);
+        type_info->class_size = sizeof (GstOmxBufferClass);
+        type_info->class_init = type_class_init;
+        type_info->instance_size = sizeof (GstOmxBuffer);
+
+        type = g_type_register_static (GST_TYPE_BUFFER, "GstOmxBuffer", type_info, 0);
+        g_free (type_info);
+    }
+
+    return type;
+}
+
+GstBuffer *
+gst_omx_buffer_new (gpointer data,
+                    guint size,
+                    gpointer user_data,
+                    GDestroyNotify notify)
+{
+    GstOmxBuffer *self;
+
+    self = (GstOmxBuffer *) gst_mini_object_new (GST_OMX_BUFFER_TYPE);
+
+    GST_BUFFER_DATA (self) = data;
+    GST_BUFFER_SIZE (self) = size;
+
+    self->user_data = user_data;
+    self->notify = notify;
+
+    return GST_BUFFER (self);
+}
+
+/* A GstOmxBuffer with its own copy of data. */
+GstBuffer *
+gst_omx_buffer_new_copy (gconstpointer data,
+                         guint size)
+{
+    gpointer copy;
+
+    copy = g_memdup (data, size);
+
+    return gst_omx_buffer_new (copy, size, copy, g_free);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_BUFFER_H
+#define GSTOMX_BUFFER_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_OMX_BUFFER(obj) (GstOmxBuffer *) (obj)
+#define GST_OMX_BUFFER_TYPE (gst_omx_buffer_get_type ())
+#define GST_IS_OMX_BUFFER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_OMX_BUFFER_TYPE))
+
+/* A GstOmxBuffer that completes a frame; GST_BUFFER_FLAG_LAST and up are
+ * for subclasses, so other buffers never carry it. Elements that split
+ * frames use it to tell each other where frames end; anything else
+ * downstream goes by the caps (alignment=nal or au). */
+#define GST_OMX_BUFFER_FLAG_END_OF_FRAME GST_BUFFER_FLAG_LAST
+
+#define GST_OMX_BUFFER_IS_END_OF_FRAME(buf) \
+    (GST_IS_OMX_BUFFER (buf) && GST_BUFFER_FLAG_IS_SET (buf, GST_OMX_BUFFER_FLAG_END_OF_FRAME))
+
+typedef struct GstOmxBuffer GstOmxBuffer;
+typedef struct GstOmxBufferClass GstOmxBufferClass;
+
+/* A GstBuffer that doesn't own its data; notify is called with user_data
+ * when the last reference goes away, so the memory can be handed back to
+ * whoever owns it. */
+
+struct GstOmxBuffer
+{
+    GstBuffer buffer;
+
+    gpointer user_data;
+    GDestroyNotify notify;
+};
+
+struct GstOmxBufferClass
+{
+    GstBufferClass parent_class;
+};
+
+GType gst_omx_buffer_get_type (void);
+GstBuffer *gst_omx_buffer_new (gpointer data, guint size, gpointer user_data, GDestroyNotify notify);
+GstBuffer *gst_omx_buffer_new_copy (gconstpointer data, guint size);
+
+G_END_DECLS
+
+#endif /* GSTOMX_BUFFER_H */
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstomx_convert.h"
+
+#include <string.h> /* For memcpy */
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/* Splits count interleaved UV pairs. */
+static inline void
+deinterleave_row (const guint8 *uv,
+                  guint8 *u,
+                  guint8 *v,
+                  guint count)
+{
+    guint i = 0;
+
+#if defined (__SSE2__)
+    {
+        const __m128i mask = _mm_set1_epi16 (0x00ff);
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i a, b;
+
+            a = _mm_loadu_si128 ((const __m128i *) (uv + 2 * i));
+            b = _mm_loadu_si128 ((const __m128i *) (uv + 2 * i + 16));
+
+            _mm_storeu_si128 ((__m128i *) (u + i),
+                              _mm_packus_epi16 (_mm_and_si128 (a, mask), _mm_and_si128 (b, mask)));
+            _mm_storeu_si128 ((__m128i *) (v + i),
+                              _mm_packus_epi16 (_mm_srli_epi16 (a, 8), _mm_srli_epi16 (b, 8)));
+        }
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x2_t pairs;
+
+        pairs = vld2q_u8 (uv + 2 * i);
+        vst1q_u8 (u + i, pairs.val[0]);
+        vst1q_u8 (v + i, pairs.val[1]);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+    }
+}
+
+/* Merges count U and V samples into pairs. */
+static inline void
+interleave_row (const guint8 *u,
+                const guint8 *v,
+                guint8 *uv,
+                guint count)
+{
+    guint i = 0;
+
+#if defined (__SSE2__)
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a, b;
+
+        a = _mm_loadu_si128 ((const __m128i *) (u + i));
+        b = _mm_loadu_si128 ((const __m128i *) (v + i));
+
+        _mm_storeu_si128 ((__m128i *) (uv + 2 * i), _mm_unpacklo_epi8 (a, b));
+        _mm_storeu_si128 ((__m128i *) (uv + 2 * i + 16), _mm_unpackhi_epi8 (a, b));
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x2_t pairs;
+
+        pairs.val[0] = vld1q_u8 (u + i);
+        pairs.val[1] = vld1q_u8 (v + i);
+        vst2q_u8 (uv + 2 * i, pairs);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        uv[2 * i] = u[i];
+        uv[2 * i + 1] = v[i];
+    }
+}
+
+static inline void
+copy_plane (const guint8 *src,
+            guint src_stride,
+            guint8 *dest,
+            guint dest_stride,
+            guint row_size,
+            guint rows)
+{
+    guint i;
+
+    for (i = 0; i < rows; i++)
+        memcpy (dest + i * dest_stride, src + i * src_stride, row_size);
+}
+
+void
+gst_omx_convert_nv12_to_i420 (const guint8 *src_y,
+                              guint src_y_stride,
+                              const guint8 *src_uv,
+                              guint src_uv_stride,
+                              guint8 *dest_y,
+                              guint dest_y_stride,
+                              guint8 *dest_u,
+                              guint8 *dest_v,
+                              guint dest_uv_stride,
+                              guint width,
+                              guint height)
+{
+    guint chroma_width;
+    guint chroma_height;
+    guint i;
+
+    chroma_width = (width + 1) / 2;
+    chroma_height = (height + 1) / 2;
+
+    copy_plane (src_y, src_y_stride, dest_y, dest_y_stride, width, height);
+
+    for (i = 0; i < chroma_height; i++)
+    {
+        deinterleave_row (src_uv + i * src_uv_stride,
+                          dest_u + i * dest_uv_stride,
+                          dest_v + i * dest_uv_stride,
+                          chroma_width);
+    }
+}
+
+void
+gst_omx_convert_i420_to_nv12 (const guint8 *src_y,
+                              guint src_y_stride,
+                              const guint8 *src_u,
+                              const guint8 *src_v,
+                              guint src_uv_stride,
+                              guint8 *dest_y,
+                              guint dest_y_stride,
+                              guint8 *dest_uv,
+                              guint dest_uv_stride,
+                              guint width,
+                              guint height)
+{
+    guint chroma_width;
+    guint chroma_height;
+    guint i;
+
+    chroma_width = (width + 1) / 2;
+    chroma_height = (height + 1) / 2;
+
+    copy_plane (src_y, src_y_stride, dest_y, dest_y_stride, width, height);
+
+    for (i = 0; i < chroma_height; i++)
+    {
+        interleave_row (src_u + i * src_uv_stride,
+                        src_v + i * src_uv_stride,
+                        dest_uv + i * dest_uv_stride,
+                        chroma_width);
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_CONVERT_H
+#define GSTOMX_CONVERT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Colour format conversion, done while copying between omx buffers and
+ * GstBuffers so it costs no extra pass. Uses SSE2 or NEON when the
+ * compiler targets them, plain C otherwise. */
+
+void gst_omx_convert_nv12_to_i420 (const guint8 *src_y, guint src_y_stride,
+                                   const guint8 *src_uv, guint src_uv_stride,
+                                   guint8 *dest_y, guint dest_y_stride,
+                                   guint8 *dest_u, guint8 *dest_v, guint dest_uv_stride,
+                                   guint width, guint height);
+
+void gst_omx_convert_i420_to_nv12 (const guint8 *src_y, guint src_y_stride,
+                                   const guint8 *src_u, const guint8 *src_v, guint src_uv_stride,
+                                   guint8 *dest_y, guint dest_y_stride,
+                                   guint8 *dest_uv, guint dest_uv_stride,
+                                   guint width, guint height);
+
+G_END_DECLS
+
+#endif /* GSTOMX_CONVERT_H */
@@ -182,6 +182,8 @@ sink_setcaps (GstPad *pad,
         gst_caps_unref (tmp_caps);
     }
 
+    gst_omx_base_filter_eager_prepare (omx_base);
+
     ret = gst_pad_set_caps (pad, caps);
 
     return ret;
@@ -228,6 +228,9 @@ type_instance_init (GTypeInstance *instance,
     omx_base->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->omx_setup = omx_setup;
 
+    /* Samples; a frame is taken as 10 ms. */
+    omx_base->output_packer = gst_omx_packer_new (80, 160, 10 * GST_MSECOND, NULL);
+
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
 }
 
@@ -219,6 +219,9 @@ type_instance_init (GTypeInstance *instance,
     omx_base->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->omx_setup = omx_setup;
 
+    omx_base->output_packer = gst_omx_packer_new (10, 160, 10 * GST_MSECOND,
+                                                  gst_omx_packer_g729_frame_length);
+
     self->dtx = TRUE;
 }
 
@@ -22,10 +22,42 @@
 #include "gstomx_h264dec.h"
 #include "gstomx.h"
 
+#include <string.h> /* For strcmp */
+
 #define OMX_COMPONENT_NAME "OMX.st.video_decoder.avc"
 
+enum
+{
+    ARG_0,
+    ARG_FRAMING
+};
+
+#define DEFAULT_FRAMING GST_OMX_H264DEC_FRAMING_NONE
+
+#define GST_OMX_H264DEC_FRAMING_TYPE (gst_omx_h264dec_framing_get_type ())
+
 static GstOmxBaseVideoDecClass *parent_class = NULL;
 
+static GType
+gst_omx_h264dec_framing_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY (type == 0))
+    {
+        static const GEnumValue values[] = {
+            { GST_OMX_H264DEC_FRAMING_NONE, "Pass input buffers as they come", "none" },
+            { GST_OMX_H264DEC_FRAMING_NAL, "One NAL unit per buffer", "nal" },
+            { GST_OMX_H264DEC_FRAMING_AU, "One access unit per buffer", "au" },
+            { 0, NULL, NULL }
+        };
+
+        type = g_enum_register_static ("GstOmxH264DecFraming", values);
+    }
+
+    return type;
+}
+
 static GstCaps *
 generate_sink_template (void)
 {
@@ -74,11 +106,263 @@ type_base_init (gpointer g_class)
     }
 }
 
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxH264Dec *self;
+
+    self = GST_OMX_H264DEC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_FRAMING:
+            self->framing = g_value_get_enum (value);
+            self->parse->split_nals = (self->framing == GST_OMX_H264DEC_FRAMING_NAL);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxH264Dec *self;
+
+    self = GST_OMX_H264DEC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_FRAMING:
+            g_value_set_enum (value, self->framing);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+dispose (GObject *obj)
+{
+    GstOmxH264Dec *self;
+
+    self = GST_OMX_H264DEC (obj);
+
+    if (self->parse)
+    {
+        gst_omx_h264_parse_free (self->parse);
+        self->parse = NULL;
+    }
+
+    G_OBJECT_CLASS (parent_class)->dispose (obj);
+}
+
+static GstStateChangeReturn
+change_state (GstElement *element,
+              GstStateChange transition)
+{
+    GstOmxH264Dec *self;
+    GstStateChangeReturn ret;
+
+    self = GST_OMX_H264DEC (element);
+
+    ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+    if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+        gst_omx_h264_parse_reset (self->parse);
+
+    return ret;
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
 {
+    GObjectClass *gobject_class;
+    GstElementClass *gstelement_class;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+    gstelement_class = GST_ELEMENT_CLASS (g_class);
+
     parent_class = g_type_class_ref (GST_OMX_BASE_VIDEODEC_TYPE);
+
+    gobject_class->dispose = dispose;
+    gstelement_class->change_state = change_state;
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_FRAMING,
+                                         g_param_spec_enum ("framing", "Framing",
+                                                            "How input is cut before it's passed to the component",
+                                                            GST_OMX_H264DEC_FRAMING_TYPE,
+                                                            DEFAULT_FRAMING,
+                                                            G_PARAM_READWRITE));
+    }
+}
+
+static GstFlowReturn
+push_unit (GstBuffer *buf,
+           gpointer user_data)
+{
+    GstOmxH264Dec *self;
+    GstOmxBaseFilter *omx_base;
+
+    self = GST_OMX_H264DEC (user_data);
+    omx_base = GST_OMX_BASE_FILTER (self);
+
+    return self->base_chain (omx_base->sinkpad, buf);
+}
+
+static GstFlowReturn
+pad_chain (GstPad *pad,
+           GstBuffer *buf)
+{
+    GstOmxH264Dec *self;
+
+    self = GST_OMX_H264DEC (GST_OBJECT_PARENT (pad));
+
+    if (self->framing == GST_OMX_H264DEC_FRAMING_NONE)
+        return self->base_chain (pad, buf);
+
+    return gst_omx_h264_parse_push (self->parse, buf, self->aligned, push_unit, self);
+}
+
+/* With framing, avcC codec_data is turned into SPS and PPS NAL units, so it
+ * has to be converted before the component gets it. */
+static gboolean
+sink_setcaps (GstPad *pad,
+              GstCaps *caps)
+{
+    GstOmxH264Dec *self;
+    GstOmxBaseFilter *omx_base;
+    GstStructure *structure;
+    const gchar *alignment;
+    const gchar *stream_format;
+    gboolean eager_prepare;
+    gboolean ret;
+
+    self = GST_OMX_H264DEC (GST_PAD_PARENT (pad));
+    omx_base = GST_OMX_BASE_FILTER (self);
+
+    structure = gst_caps_get_structure (caps, 0);
+    stream_format = gst_structure_get_string (structure, "stream-format");
+    self->byte_stream = !gst_structure_has_field (structure, "codec_data") &&
+        !(stream_format && strcmp (stream_format, "avc") == 0);
+
+    if (self->framing == GST_OMX_H264DEC_FRAMING_NONE)
+        return self->base_setcaps (pad, caps);
+
+    /* What's pending belongs to the old caps. */
+    gst_omx_h264_parse_drain (self->parse, push_unit, self);
+
+    eager_prepare = omx_base->eager_prepare;
+    omx_base->eager_prepare = FALSE;
+    ret = self->base_setcaps (pad, caps);
+    omx_base->eager_prepare = eager_prepare;
+
+    if (!ret)
+        return FALSE;
+
+    alignment = gst_structure_get_string (structure, "alignment");
+    self->aligned = alignment && strcmp (alignment, "au") == 0;
+
+    self->parse->nal_length_size = 0;
+
+    if (omx_base->codec_data)
+    {
+        GstBuffer *codec_data;
+
+        codec_data = gst_omx_h264_codec_data_to_byte_stream (omx_base->codec_data,
+                                                             &self->parse->nal_length_size);
+
+        if (codec_data)
+        {
+            gst_buffer_unref (omx_base->codec_data);
+            omx_base->codec_data = codec_data;
+        }
+    }
+
+    /* Length prefixes get turned into start codes. */
+    if (self->parse->nal_length_size)
+        self->byte_stream = TRUE;
+
+    gst_omx_base_filter_eager_prepare (omx_base);
+
+    return TRUE;
+}
+
+static void
+sink_event (GstOmxBaseFilter *omx_base,
+            GstEvent *event)
+{
+    GstOmxH264Dec *self;
+
+    self = GST_OMX_H264DEC (omx_base);
+
+    switch (GST_EVENT_TYPE (event))
+    {
+        case GST_EVENT_EOS:
+            if (self->framing != GST_OMX_H264DEC_FRAMING_NONE)
+                gst_omx_h264_parse_drain (self->parse, push_unit, self);
+            break;
+        case GST_EVENT_FLUSH_STOP:
+            gst_omx_h264_parse_reset (self->parse);
+            break;
+        default:
+            break;
+    }
+
+    self->base_sink_event (omx_base, event);
+}
+
+/* Slices with nal_ref_idc 0 are never used as reference; only byte-stream
+ * input is looked at. */
+static gboolean
+is_droppable (GstOmxBaseVideoDec *self,
+              GstBuffer *buf)
+{
+    GstOmxH264Dec *h264dec;
+    const guint8 *data;
+    guint size;
+    guint i;
+
+    h264dec = GST_OMX_H264DEC (self);
+
+    /* A length prefix can look like a start code. */
+    if (!h264dec->byte_stream)
+        return FALSE;
+
+    data = GST_BUFFER_DATA (buf);
+    size = GST_BUFFER_SIZE (buf);
+
+    for (i = 0; i + 3 < size; i++)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+        {
+            guint nal_type;
+
+            nal_type = data[i + 3] & 0x1f;
+
+            /* The first slice decides. */
+            if (nal_type >= 1 && nal_type <= 5)
+                return (data[i + 3] & 0x60) == 0;
+
+            i += 2;
+        }
+    }
+
+    return FALSE;
 }
 
 static void
@@ -93,6 +377,28 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base_filter->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->compression_format = OMX_VIDEO_CodingAVC;
+    omx_base->is_droppable = is_droppable;
+
+    /* B-frames come out reordered. */
+    omx_base_filter->timestamps = gst_omx_timestamps_new ();
+
+    {
+        GstOmxH264Dec *self;
+
+        self = GST_OMX_H264DEC (instance);
+
+        self->framing = DEFAULT_FRAMING;
+        self->parse = gst_omx_h264_parse_new ();
+
+        self->base_sink_event = omx_base_filter->sink_event;
+        omx_base_filter->sink_event = sink_event;
+
+        self->base_chain = GST_PAD_CHAINFUNC (omx_base_filter->sinkpad);
+        self->base_setcaps = GST_PAD_SETCAPSFUNC (omx_base_filter->sinkpad);
+
+        gst_pad_set_chain_function (omx_base_filter->sinkpad, pad_chain);
+        gst_pad_set_setcaps_function (omx_base_filter->sinkpad, sink_setcaps);
+    }
 }
 
 GType
@@ -33,10 +33,25 @@ typedef struct GstOmxH264Dec GstOmxH264Dec;
 typedef struct GstOmxH264DecClass GstOmxH264DecClass;
 
 #include "gstomx_base_videodec.h"
+#include "gstomx_h264parse.h"
+
+typedef enum
+{
+    GST_OMX_H264DEC_FRAMING_NONE,
+    GST_OMX_H264DEC_FRAMING_NAL,
+    GST_OMX_H264DEC_FRAMING_AU
+} GstOmxH264DecFraming;
 
 struct GstOmxH264Dec
 {
     GstOmxBaseVideoDec omx_base;
+    GstOmxH264DecFraming framing;
+    GstOmxH264Parse *parse;
+    gboolean aligned; /**< Upstream buffers end access units. */
+    gboolean byte_stream; /**< What the base class gets has start codes. */
+    GstPadChainFunction base_chain;
+    GstPadSetCapsFunction base_setcaps;
+    GstOmxBaseFilterEventCb base_sink_event;
 };
 
 struct GstOmxH264DecClass
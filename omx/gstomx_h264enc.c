@@ -26,6 +26,13 @@
 
 #define OMX_COMPONENT_NAME "OMX.st.video_encoder.avc"
 
+enum
+{
+    ARG_0,
+    ARG_SLICES_PER_FRAME,
+    ARG_BYTES_PER_SLICE
+};
+
 static GstOmxBaseFilterClass *parent_class = NULL;
 
 static GstCaps *
@@ -73,11 +80,169 @@ type_base_init (gpointer g_class)
     }
 }
 
+static void
+set_property (GObject *obj,
+              guint prop_id,
+              const GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxH264Enc *self;
+
+    self = GST_OMX_H264ENC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_SLICES_PER_FRAME:
+            self->slices_per_frame = g_value_get_uint (value);
+            break;
+        case ARG_BYTES_PER_SLICE:
+            self->bytes_per_slice = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+get_property (GObject *obj,
+              guint prop_id,
+              GValue *value,
+              GParamSpec *pspec)
+{
+    GstOmxH264Enc *self;
+
+    self = GST_OMX_H264ENC (obj);
+
+    switch (prop_id)
+    {
+        case ARG_SLICES_PER_FRAME:
+            g_value_set_uint (value, self->slices_per_frame);
+            break;
+        case ARG_BYTES_PER_SLICE:
+            g_value_set_uint (value, self->bytes_per_slice);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+            break;
+    }
+}
+
 static void
 type_class_init (gpointer g_class,
                  gpointer class_data)
 {
+    GObjectClass *gobject_class;
+
+    gobject_class = G_OBJECT_CLASS (g_class);
+
     parent_class = g_type_class_ref (GST_OMX_BASE_FILTER_TYPE);
+
+    /* Properties stuff */
+    {
+        gobject_class->set_property = set_property;
+        gobject_class->get_property = get_property;
+
+        g_object_class_install_property (gobject_class, ARG_SLICES_PER_FRAME,
+                                         g_param_spec_uint ("slices-per-frame", "Slices per frame",
+                                                            "Split each frame in this many slices, pushed as soon as they are encoded (0 = whole frames)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+        g_object_class_install_property (gobject_class, ARG_BYTES_PER_SLICE,
+                                         g_param_spec_uint ("bytes-per-slice", "Bytes per slice",
+                                                            "Limit the size of the slices instead; takes precedence over slices-per-frame (0 = disabled)",
+                                                            0, G_MAXUINT, 0, G_PARAM_READWRITE));
+    }
+}
+
+/* Slices come out of the component as separate buffers, so each one is
+ * pushed downstream on its own, with alignment=nal caps; the last one of
+ * a frame carries GST_OMX_BUFFER_FLAG_END_OF_FRAME. */
+static void
+codec_setup (GstOmxBaseFilter *omx_base)
+{
+    GstOmxH264Enc *self;
+    GOmxCore *gomx;
+    OMX_VIDEO_AVCSLICEMODETYPE slice_mode;
+    guint spacing;
+
+    self = GST_OMX_H264ENC (omx_base);
+    gomx = (GOmxCore *) omx_base->gomx;
+
+    omx_base->partial_frames = FALSE;
+
+    if (self->bytes_per_slice > 0)
+    {
+        slice_mode = OMX_VIDEO_SLICEMODE_AVCByteSlice;
+        spacing = self->bytes_per_slice;
+    }
+    else if (self->slices_per_frame > 1)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *param;
+        guint macroblocks;
+
+        param = calloc (1, sizeof (OMX_PARAM_PORTDEFINITIONTYPE));
+        param->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
+        param->nVersion.s.nVersionMajor = 1;
+        param->nVersion.s.nVersionMinor = 1;
+
+        param->nPortIndex = 0;
+        OMX_GetParameter (gomx->omx_handle, OMX_IndexParamPortDefinition, param);
+
+        macroblocks = ((param->format.video.nFrameWidth + 15) / 16) *
+            ((param->format.video.nFrameHeight + 15) / 16);
+
+        free (param);
+
+        slice_mode = OMX_VIDEO_SLICEMODE_AVCMBSlice;
+        spacing = (macroblocks + self->slices_per_frame - 1) / self->slices_per_frame;
+    }
+    else
+    {
+        return;
+    }
+
+    GST_INFO_OBJECT (self, "slice mode: %d, spacing: %u", slice_mode, spacing);
+
+    {
+        OMX_VIDEO_PARAM_AVCSLICEFMO *param;
+
+        param = calloc (1, sizeof (OMX_VIDEO_PARAM_AVCSLICEFMO));
+        param->nSize = sizeof (OMX_VIDEO_PARAM_AVCSLICEFMO);
+        param->nVersion.s.nVersionMajor = 1;
+        param->nVersion.s.nVersionMinor = 1;
+        param->nPortIndex = 1;
+
+        OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoSliceFMO, param);
+
+        param->eSliceMode = slice_mode;
+
+        if (OMX_SetParameter (gomx->omx_handle, OMX_IndexParamVideoSliceFMO, param) != OMX_ErrorNone)
+            GST_WARNING_OBJECT (self, "slice mode not supported");
+        else
+            omx_base->partial_frames = TRUE;
+
+        free (param);
+    }
+
+    {
+        OMX_VIDEO_PARAM_AVCTYPE *param;
+
+        param = calloc (1, sizeof (OMX_VIDEO_PARAM_AVCTYPE));
+        param->nSize = sizeof (OMX_VIDEO_PARAM_AVCTYPE);
+        param->nVersion.s.nVersionMajor = 1;
+        param->nVersion.s.nVersionMinor = 1;
+        param->nPortIndex = 1;
+
+        OMX_GetParameter (gomx->omx_handle, OMX_IndexParamVideoAvc, param);
+
+        /* Macroblocks or bytes, depending on the slice mode. */
+        param->nSliceHeaderSpacing = spacing;
+
+        OMX_SetParameter (gomx->omx_handle, OMX_IndexParamVideoAvc, param);
+
+        free (param);
+    }
 }
 
 static void
@@ -118,6 +283,8 @@ settings_changed_cb (GOmxCore *core)
                                         "width", G_TYPE_INT, width,
                                         "height", G_TYPE_INT, height,
                                         "framerate", GST_TYPE_FRACTION, framerate, 1,
+                                        "alignment", G_TYPE_STRING,
+                                        omx_base->partial_frames ? "nal" : "au",
                                         NULL);
 
         GST_INFO_OBJECT (omx_base, "caps are: %" GST_PTR_FORMAT, new_caps);
@@ -137,6 +304,7 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base_filter->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->compression_format = OMX_VIDEO_CodingAVC;
+    omx_base->codec_setup = codec_setup;
 
     omx_base_filter->gomx->settings_changed_cb = settings_changed_cb;
 }
@@ -37,6 +37,9 @@ typedef struct GstOmxH264EncClass GstOmxH264EncClass;
 struct GstOmxH264Enc
 {
     GstOmxBaseVideoEnc omx_base;
+
+    guint slices_per_frame; /**< 0 disables; ignored with bytes_per_slice. */
+    guint bytes_per_slice; /**< 0 disables. */
 };
 
 struct GstOmxH264EncClass
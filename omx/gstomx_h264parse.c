@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstomx_h264parse.h"
+#include "gstomx_buffer.h"
+
+#include <string.h> /* For memchr, memcpy */
+
+#define NAL_TYPE(header) ((header) & 0x1f)
+
+static const guint8 start_code[] = { 0, 0, 0, 1 };
+
+/* Returns the first "00 00 01" in data, or NULL. memchr does the heavy
+ * lifting; 0x01 is rare enough in coded data. */
+const guint8 *
+gst_omx_h264_find_start_code (const guint8 *data,
+                              const guint8 *end)
+{
+    const guint8 *p;
+
+    p = data + 2;
+
+    while (p < end)
+    {
+        p = memchr (p, 0x01, end - p);
+
+        if (!p)
+            return NULL;
+
+        if (p[-1] == 0 && p[-2] == 0)
+            return p - 2;
+
+        p++;
+    }
+
+    return NULL;
+}
+
+/* avcC (ISO/IEC 14496-15) to SPS and PPS NAL units with start codes; NULL
+ * if codec_data isn't avcC. */
+GstBuffer *
+gst_omx_h264_codec_data_to_byte_stream (GstBuffer *codec_data,
+                                        guint *nal_length_size)
+{
+    const guint8 *data;
+    const guint8 *end;
+    GByteArray *out;
+    GstBuffer *buf;
+    guint lists;
+
+    data = GST_BUFFER_DATA (codec_data);
+    end = data + GST_BUFFER_SIZE (codec_data);
+
+    if (GST_BUFFER_SIZE (codec_data) < 7 || data[0] != 1)
+        return NULL;
+
+    *nal_length_size = (data[4] & 0x03) + 1;
+
+    out = g_byte_array_new ();
+    data += 5;
+
+    /* SPS, then PPS */
+    for (lists = 0; lists < 2; lists++)
+    {
+        guint count;
+
+        if (data >= end)
+            goto out_invalid;
+
+        count = *data++;
+        if (lists == 0)
+            count &= 0x1f;
+
+        while (count--)
+        {
+            guint length;
+
+            if (data + 2 > end)
+                goto out_invalid;
+
+            length = GST_READ_UINT16_BE (data);
+            data += 2;
+
+            if (data + length > end)
+                goto out_invalid;
+
+            g_byte_array_append (out, start_code, sizeof (start_code));
+            g_byte_array_append (out, data, length);
+            data += length;
+        }
+    }
+
+    buf = gst_buffer_new_and_alloc (out->len);
+    memcpy (GST_BUFFER_DATA (buf), out->data, out->len);
+    g_byte_array_free (out, TRUE);
+
+    return buf;
+
+out_invalid:
+    g_byte_array_free (out, TRUE);
+    return NULL;
+}
+
+GstOmxH264Parse *
+gst_omx_h264_parse_new (void)
+{
+    GstOmxH264Parse *parse;
+
+    parse = g_new0 (GstOmxH264Parse, 1);
+
+    parse->pending = g_byte_array_new ();
+    parse->nals = g_array_new (FALSE, FALSE, sizeof (guint));
+
+    gst_omx_h264_parse_reset (parse);
+
+    return parse;
+}
+
+void
+gst_omx_h264_parse_free (GstOmxH264Parse *parse)
+{
+    g_byte_array_free (parse->pending, TRUE);
+    g_array_free (parse->nals, TRUE);
+
+    g_free (parse);
+}
+
+void
+gst_omx_h264_parse_reset (GstOmxH264Parse *parse)
+{
+    g_byte_array_set_size (parse->pending, 0);
+    g_array_set_size (parse->nals, 0);
+
+    parse->scan_offset = 0;
+    parse->has_slice = FALSE;
+    parse->keyframe = FALSE;
+    parse->timestamp = GST_CLOCK_TIME_NONE;
+    parse->next_timestamp = GST_CLOCK_TIME_NONE;
+    parse->discont = TRUE;
+}
+
+static inline GstBuffer *
+new_unit (GstOmxH264Parse *parse,
+          const guint8 *data,
+          guint size)
+{
+    GstBuffer *buf;
+
+    /* So that it can be flagged GST_OMX_BUFFER_FLAG_END_OF_FRAME. */
+    buf = gst_omx_buffer_new_copy (data, size);
+
+    if (!parse->keyframe)
+        GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    return buf;
+}
+
+/* The first unit gets the timestamp, the last one ends the frame. */
+static GstFlowReturn
+push_unit (GstOmxH264Parse *parse,
+           GstBuffer *buf,
+           gboolean first,
+           gboolean last,
+           GstOmxH264ParseFunc func,
+           gpointer user_data)
+{
+    if (first)
+    {
+        GST_BUFFER_TIMESTAMP (buf) = parse->timestamp;
+
+        if (parse->discont)
+        {
+            GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+            parse->discont = FALSE;
+        }
+    }
+
+    if (last)
+        GST_BUFFER_FLAG_SET (buf, GST_OMX_BUFFER_FLAG_END_OF_FRAME);
+
+    return func (buf, user_data);
+}
+
+/* Pushes the first size bytes of pending, which hold a whole access unit,
+ * and starts gathering the next one. */
+static GstFlowReturn
+finish_unit (GstOmxH264Parse *parse,
+             guint size,
+             GstOmxH264ParseFunc func,
+             gpointer user_data)
+{
+    GstFlowReturn ret = GST_FLOW_OK;
+    const guint8 *data;
+
+    data = parse->pending->data;
+
+    if (parse->split_nals)
+    {
+        guint i;
+
+        for (i = 0; i < parse->nals->len && ret == GST_FLOW_OK; i++)
+        {
+            guint start;
+            guint end;
+
+            start = g_array_index (parse->nals, guint, i);
+            end = i + 1 < parse->nals->len ? g_array_index (parse->nals, guint, i + 1) : size;
+
+            ret = push_unit (parse, new_unit (parse, data + start, end - start),
+                             i == 0, i + 1 == parse->nals->len, func, user_data);
+        }
+    }
+    else
+    {
+        ret = push_unit (parse, new_unit (parse, data, size), TRUE, TRUE, func, user_data);
+    }
+
+    g_byte_array_remove_range (parse->pending, 0, size);
+    g_array_set_size (parse->nals, 0);
+
+    parse->scan_offset = parse->scan_offset > size ? parse->scan_offset - size : 0;
+    parse->has_slice = FALSE;
+    parse->keyframe = FALSE;
+    parse->timestamp = GST_CLOCK_TIME_NONE;
+
+    return ret;
+}
+
+/* Whether a NAL unit of this type starts a new access unit (7.4.1.2.3);
+ * the first slice of a picture has first_mb_in_slice 0, coded as '1'. */
+static inline gboolean
+starts_unit (GstOmxH264Parse *parse,
+             guint8 header,
+             guint8 next)
+{
+    if (!parse->has_slice)
+        return FALSE;
+
+    switch (NAL_TYPE (header))
+    {
+        case 1:
+        case 5:
+            return (next & 0x80) != 0;
+        case 6:
+        case 7:
+        case 8:
+        case 9:
+        case 14:
+        case 15:
+        case 16:
+        case 17:
+        case 18:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+static inline void
+add_nal (GstOmxH264Parse *parse,
+         guint offset,
+         guint8 header)
+{
+    if (parse->nals->len == 0)
+    {
+        parse->timestamp = parse->next_timestamp;
+        parse->next_timestamp = GST_CLOCK_TIME_NONE;
+    }
+
+    g_array_append_val (parse->nals, offset);
+
+    if (NAL_TYPE (header) >= 1 && NAL_TYPE (header) <= 5)
+        parse->has_slice = TRUE;
+    if (NAL_TYPE (header) == 5)
+        parse->keyframe = TRUE;
+}
+
+static GstFlowReturn
+scan_byte_stream (GstOmxH264Parse *parse,
+                  GstOmxH264ParseFunc func,
+                  gpointer user_data)
+{
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    while (ret == GST_FLOW_OK)
+    {
+        const guint8 *data;
+        const guint8 *sc;
+        guint offset;
+        guint len;
+
+        data = parse->pending->data;
+        len = parse->pending->len;
+
+        sc = gst_omx_h264_find_start_code (data + parse->scan_offset, data + len);
+
+        if (!sc)
+        {
+            /* A start code, four byte ones included, may straddle
+             * buffers. */
+            if (len > 3)
+                parse->scan_offset = MAX (parse->scan_offset, len - 3);
+
+            /* Nothing before the first start code is of any use. */
+            if (parse->nals->len == 0 && parse->scan_offset > 0)
+            {
+                g_byte_array_remove_range (parse->pending, 0, parse->scan_offset);
+                parse->scan_offset = 0;
+            }
+            break;
+        }
+
+        offset = sc - data;
+
+        /* The NAL header, and the start of the slice header. */
+        if (offset + 5 > len)
+        {
+            parse->scan_offset = offset;
+            break;
+        }
+
+        parse->scan_offset = offset + 3;
+
+        /* A four byte start code goes with the unit it starts. */
+        if (offset > 0 && data[offset - 1] == 0 &&
+            (parse->nals->len == 0 || g_array_index (parse->nals, guint, parse->nals->len - 1) < offset - 1))
+            offset--;
+
+        if (parse->nals->len == 0 && offset > 0)
+        {
+            g_byte_array_remove_range (parse->pending, 0, offset);
+            parse->scan_offset -= offset;
+            offset = 0;
+            data = parse->pending->data;
+        }
+        else if (starts_unit (parse, sc[3], sc[4]))
+        {
+            guint8 header;
+
+            header = sc[3];
+
+            ret = finish_unit (parse, offset, func, user_data);
+            offset = 0;
+            add_nal (parse, offset, header);
+            continue;
+        }
+
+        add_nal (parse, offset, data[parse->scan_offset]);
+    }
+
+    return ret;
+}
+
+/* AVC input is already one access unit per buffer. */
+static GstFlowReturn
+convert_avc (GstOmxH264Parse *parse,
+             GstBuffer *buf,
+             GstOmxH264ParseFunc func,
+             gpointer user_data)
+{
+    const guint8 *data;
+    const guint8 *end;
+
+    data = GST_BUFFER_DATA (buf);
+    end = data + GST_BUFFER_SIZE (buf);
+
+    while (data + parse->nal_length_size < end)
+    {
+        guint length = 0;
+        guint i;
+
+        for (i = 0; i < parse->nal_length_size; i++)
+            length = (length << 8) | data[i];
+
+        data += parse->nal_length_size;
+
+        if (length == 0 || data + length > end)
+            break;
+
+        add_nal (parse, parse->pending->len, data[0]);
+        g_byte_array_append (parse->pending, start_code, sizeof (start_code));
+        g_byte_array_append (parse->pending, data, length);
+
+        data += length;
+    }
+
+    parse->scan_offset = parse->pending->len;
+
+    if (parse->nals->len == 0)
+        return GST_FLOW_OK;
+
+    return finish_unit (parse, parse->pending->len, func, user_data);
+}
+
+/* Takes ownership of buf. With aligned set, buf ends an access unit, so
+ * it's pushed right away instead of when the next one starts. */
+GstFlowReturn
+gst_omx_h264_parse_push (GstOmxH264Parse *parse,
+                         GstBuffer *buf,
+                         gboolean aligned,
+                         GstOmxH264ParseFunc func,
+                         gpointer user_data)
+{
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    /* Whatever is pending is all there'll be of it. */
+    if (GST_BUFFER_IS_DISCONT (buf))
+    {
+        ret = gst_omx_h264_parse_drain (parse, func, user_data);
+        parse->discont = TRUE;
+    }
+
+    if (GST_BUFFER_TIMESTAMP_IS_VALID (buf))
+        parse->next_timestamp = GST_BUFFER_TIMESTAMP (buf);
+
+    if (ret != GST_FLOW_OK)
+        goto leave;
+
+    if (parse->nal_length_size)
+    {
+        ret = convert_avc (parse, buf, func, user_data);
+        goto leave;
+    }
+
+    g_byte_array_append (parse->pending, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
+
+    ret = scan_byte_stream (parse, func, user_data);
+
+    if (ret == GST_FLOW_OK && aligned)
+        ret = gst_omx_h264_parse_drain (parse, func, user_data);
+
+leave:
+    gst_buffer_unref (buf);
+
+    return ret;
+}
+
+/* Pushes the access unit being gathered; at EOS, or when the input is
+ * known to end one. */
+GstFlowReturn
+gst_omx_h264_parse_drain (GstOmxH264Parse *parse,
+                          GstOmxH264ParseFunc func,
+                          gpointer user_data)
+{
+    if (parse->nals->len == 0)
+    {
+        g_byte_array_set_size (parse->pending, 0);
+        parse->scan_offset = 0;
+        return GST_FLOW_OK;
+    }
+
+    return finish_unit (parse, parse->pending->len, func, user_data);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_H264PARSE_H
+#define GSTOMX_H264PARSE_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct GstOmxH264Parse GstOmxH264Parse;
+
+/* Gets each access unit, or NAL unit, as it's complete; takes ownership. */
+typedef GstFlowReturn (*GstOmxH264ParseFunc) (GstBuffer *buf, gpointer user_data);
+
+/* Cuts H.264 input into whole access units, or NAL units, in byte-stream
+ * format. Byte-stream input may be sliced anywhere; an access unit is
+ * complete once the first NAL unit of the next one shows up, or at the end
+ * of an aligned input buffer. AVC input (length prefixed, as in MP4) comes
+ * one access unit per buffer, and only gets its prefixes replaced by start
+ * codes. Output that ends an access unit is flagged
+ * GST_OMX_BUFFER_FLAG_END_OF_FRAME. */
+
+struct GstOmxH264Parse
+{
+    gboolean split_nals; /**< One buffer per NAL unit instead of per access unit. */
+    guint nal_length_size; /**< Of the AVC length prefixes; 0 for byte-stream input. */
+
+    GByteArray *pending; /**< Starts with the access unit being gathered. */
+    GArray *nals; /**< Offsets of its NAL units. */
+    guint scan_offset;
+    gboolean has_slice;
+    gboolean keyframe;
+    GstClockTime timestamp; /**< Of the access unit being gathered. */
+    GstClockTime next_timestamp; /**< Of the input; given to the next access unit. */
+    gboolean discont;
+};
+
+const guint8 *gst_omx_h264_find_start_code (const guint8 *data, const guint8 *end);
+GstBuffer *gst_omx_h264_codec_data_to_byte_stream (GstBuffer *codec_data, guint *nal_length_size);
+
+GstOmxH264Parse *gst_omx_h264_parse_new (void);
+void gst_omx_h264_parse_free (GstOmxH264Parse *parse);
+void gst_omx_h264_parse_reset (GstOmxH264Parse *parse);
+GstFlowReturn gst_omx_h264_parse_push (GstOmxH264Parse *parse, GstBuffer *buf, gboolean aligned, GstOmxH264ParseFunc func, gpointer user_data);
+GstFlowReturn gst_omx_h264_parse_drain (GstOmxH264Parse *parse, GstOmxH264ParseFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* GSTOMX_H264PARSE_H */
@@ -149,6 +149,13 @@ sink_setcaps (GstPad *pad,
 
     mode = gst_structure_get_name (structure);
 
+    {
+        gint frame_mode = 20;
+
+        gst_structure_get_int (structure, "mode", &frame_mode);
+        gst_omx_packer_set_ilbc_mode (omx_base->input_packer, frame_mode);
+    }
+
     /* set caps on the srcpad */
     {
         GstCaps *tmp_caps;
@@ -168,6 +175,8 @@ sink_setcaps (GstPad *pad,
         gst_caps_unref (tmp_caps);
     }
 
+    gst_omx_base_filter_eager_prepare (omx_base);
+
     return gst_pad_set_caps (pad, caps);
 }
 
@@ -182,6 +191,7 @@ type_instance_init (GTypeInstance *instance,
     self = GST_OMX_ILBCDEC (instance);
 
     omx_base->omx_component = g_strdup (OMX_COMPONENT_NAME);
+    omx_base->input_packer = gst_omx_packer_new (38, 320, 20 * GST_MSECOND, NULL);
 
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
 }
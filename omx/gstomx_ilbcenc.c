@@ -155,8 +155,13 @@ sink_setcaps (GstPad *pad,
 
         if (gst_caps_is_fixed (tmp_caps))
         {
+            gint mode = 20;
+
             GST_INFO_OBJECT (omx_base, "fixated to: %" GST_PTR_FORMAT, tmp_caps);
             gst_pad_set_caps (omx_base->srcpad, tmp_caps);
+
+            gst_structure_get_int (gst_caps_get_structure (tmp_caps, 0), "mode", &mode);
+            gst_omx_packer_set_ilbc_mode (omx_base->output_packer, mode);
         }
 
         gst_caps_unref (tmp_caps);
@@ -192,6 +197,8 @@ type_instance_init (GTypeInstance *instance,
     omx_base->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->omx_setup = omx_setup;
 
+    omx_base->output_packer = gst_omx_packer_new (38, 320, 20 * GST_MSECOND, NULL);
+
     gst_pad_set_setcaps_function (omx_base->sinkpad, sink_setcaps);
 }
 
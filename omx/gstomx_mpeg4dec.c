@@ -108,6 +108,27 @@ type_class_init (gpointer g_class,
     parent_class = g_type_class_ref (GST_OMX_BASE_VIDEODEC_TYPE);
 }
 
+/* B-VOPs are never used as reference. */
+static gboolean
+is_droppable (GstOmxBaseVideoDec *self,
+              GstBuffer *buf)
+{
+    const guint8 *data;
+    guint size;
+    guint i;
+
+    data = GST_BUFFER_DATA (buf);
+    size = GST_BUFFER_SIZE (buf);
+
+    for (i = 0; i + 4 < size; i++)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && data[i + 3] == 0xb6)
+            return (data[i + 4] >> 6) == 2;
+    }
+
+    return FALSE;
+}
+
 static void
 type_instance_init (GTypeInstance *instance,
                     gpointer g_class)
@@ -120,6 +141,10 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base_filter->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->compression_format = OMX_VIDEO_CodingMPEG4;
+    omx_base->is_droppable = is_droppable;
+
+    /* B-VOPs come out reordered. */
+    omx_base_filter->timestamps = gst_omx_timestamps_new ();
 }
 
 GType
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstomx_packer.h"
+
+#include <string.h> /* For memcpy */
+
+/* Frame sizes of the AMR storage format (RFC 4867, section 5), header
+ * included, by frame type. */
+static const guint8 amrnb_frame_sizes[16] = {
+    13, 14, 16, 18, 20, 21, 27, 32, 6, 1, 1, 1, 1, 1, 1, 1
+};
+
+static const guint8 amrwb_frame_sizes[16] = {
+    18, 24, 33, 37, 41, 47, 51, 59, 61, 6, 1, 1, 1, 1, 1, 1
+};
+
+guint
+gst_omx_packer_amrnb_frame_length (const guint8 *data,
+                                   guint size)
+{
+    return amrnb_frame_sizes[(data[0] >> 3) & 0x0f];
+}
+
+guint
+gst_omx_packer_amrwb_frame_length (const guint8 *data,
+                                   guint size)
+{
+    return amrwb_frame_sizes[(data[0] >> 3) & 0x0f];
+}
+
+/* iLBC frames are 38 bytes every 20 ms, or 50 bytes every 30 ms. */
+void
+gst_omx_packer_set_ilbc_mode (GstOmxPacker *packer,
+                              gint mode)
+{
+    if (mode == 30)
+    {
+        packer->frame_size = 50;
+        packer->raw_frame_size = 480;
+        packer->frame_duration = 30 * GST_MSECOND;
+    }
+    else
+    {
+        packer->frame_size = 38;
+        packer->raw_frame_size = 320;
+        packer->frame_duration = 20 * GST_MSECOND;
+    }
+}
+
+/* Annex B comfort noise frames are 2 bytes, and only ever come last. */
+guint
+gst_omx_packer_g729_frame_length (const guint8 *data,
+                                  guint size)
+{
+    return size >= 10 ? 10 : 2;
+}
+
+GstOmxPacker *
+gst_omx_packer_new (guint frame_size,
+                    guint raw_frame_size,
+                    GstClockTime frame_duration,
+                    GstOmxFrameLengthFunc frame_length)
+{
+    GstOmxPacker *packer;
+
+    packer = g_new0 (GstOmxPacker, 1);
+
+    packer->frames_per_buffer = 1;
+    packer->frame_size = frame_size;
+    packer->raw_frame_size = raw_frame_size;
+    packer->frame_duration = frame_duration;
+    packer->frame_length = frame_length;
+    packer->pending = g_queue_new ();
+
+    return packer;
+}
+
+void
+gst_omx_packer_free (GstOmxPacker *packer)
+{
+    gst_omx_packer_reset (packer);
+    g_queue_free (packer->pending);
+
+    g_free (packer);
+}
+
+void
+gst_omx_packer_reset (GstOmxPacker *packer)
+{
+    GstBuffer *buf;
+
+    while ((buf = g_queue_pop_head (packer->pending)))
+        gst_buffer_unref (buf);
+
+    packer->pending_size = 0;
+    packer->pending_frames = 0;
+}
+
+/* Never 0 for a non-empty buffer; garbage is taken as a single frame. */
+guint
+gst_omx_packer_frame_length (GstOmxPacker *packer,
+                             const guint8 *data,
+                             guint size)
+{
+    guint length;
+
+    if (packer->frame_length)
+        length = packer->frame_length (data, size);
+    else
+        length = packer->frame_size;
+
+    if (length == 0 || length > size)
+        length = size;
+
+    return length;
+}
+
+guint
+gst_omx_packer_count (GstOmxPacker *packer,
+                      const guint8 *data,
+                      guint size)
+{
+    guint offset = 0;
+    guint count = 0;
+
+    while (offset < size)
+    {
+        offset += gst_omx_packer_frame_length (packer, data + offset, size - offset);
+        count++;
+    }
+
+    return count;
+}
+
+static inline void
+set_duration (GstOmxPacker *packer,
+              GstBuffer *buf,
+              guint frames)
+{
+    if (GST_CLOCK_TIME_IS_VALID (packer->frame_duration))
+        GST_BUFFER_DURATION (buf) = frames * packer->frame_duration;
+}
+
+/* Takes ownership of buf; returns a buffer once there are enough frames.
+ * Output that is already big enough goes through untouched. */
+GstBuffer *
+gst_omx_packer_push (GstOmxPacker *packer,
+                     GstBuffer *buf)
+{
+    guint frames;
+
+    frames = gst_omx_packer_count (packer, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
+
+    if (packer->pending_frames == 0 && frames >= packer->frames_per_buffer)
+    {
+        set_duration (packer, buf, frames);
+        return buf;
+    }
+
+    g_queue_push_tail (packer->pending, buf);
+    packer->pending_size += GST_BUFFER_SIZE (buf);
+    packer->pending_frames += frames;
+
+    if (packer->pending_frames < packer->frames_per_buffer)
+        return NULL;
+
+    return gst_omx_packer_drain (packer);
+}
+
+/* Whatever is pending, even if it's short of frames_per_buffer. The
+ * timestamp and flags are those of the first frame. */
+GstBuffer *
+gst_omx_packer_drain (GstOmxPacker *packer)
+{
+    GstBuffer *buf;
+
+    if (packer->pending_frames == 0)
+        return NULL;
+
+    if (g_queue_get_length (packer->pending) == 1)
+    {
+        buf = g_queue_pop_head (packer->pending);
+    }
+    else
+    {
+        GstBuffer *first;
+        GstBuffer *frame;
+        guint offset = 0;
+
+        first = g_queue_peek_head (packer->pending);
+
+        buf = gst_buffer_new_and_alloc (packer->pending_size);
+        gst_buffer_copy_metadata (buf, first,
+                                  GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_CAPS);
+
+        while ((frame = g_queue_pop_head (packer->pending)))
+        {
+            memcpy (GST_BUFFER_DATA (buf) + offset, GST_BUFFER_DATA (frame), GST_BUFFER_SIZE (frame));
+            offset += GST_BUFFER_SIZE (frame);
+            gst_buffer_unref (frame);
+        }
+    }
+
+    set_duration (packer, buf, packer->pending_frames);
+
+    packer->pending_size = 0;
+    packer->pending_frames = 0;
+
+    return buf;
+}
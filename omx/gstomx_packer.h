@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_PACKER_H
+#define GSTOMX_PACKER_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct GstOmxPacker GstOmxPacker;
+
+#define GST_OMX_PACKER_MAX_FRAMES 64
+
+/* Returns the length of the coded frame at the start of data; 0 if it's
+ * not a valid one. */
+typedef guint (*GstOmxFrameLengthFunc) (const guint8 *data, guint size);
+
+/* Frame packing for speech codecs, whose frames are a few bytes long.
+ * Encoder output is gathered until it holds frames_per_buffer frames, so
+ * it's pushed as one buffer; decoder input is cut on frame boundaries, so
+ * each frame gets its own omx buffer. Only used from one thread at a
+ * time. */
+
+struct GstOmxPacker
+{
+    guint frames_per_buffer;
+    guint frame_size; /**< Largest coded frame, in bytes. */
+    guint raw_frame_size; /**< Decoded frame, in bytes. */
+    GstClockTime frame_duration;
+    GstOmxFrameLengthFunc frame_length; /**< If NULL, all frames are frame_size long. */
+
+    GQueue *pending;
+    guint pending_size;
+    guint pending_frames;
+};
+
+GstOmxPacker *gst_omx_packer_new (guint frame_size, guint raw_frame_size, GstClockTime frame_duration, GstOmxFrameLengthFunc frame_length);
+void gst_omx_packer_free (GstOmxPacker *packer);
+void gst_omx_packer_reset (GstOmxPacker *packer);
+guint gst_omx_packer_frame_length (GstOmxPacker *packer, const guint8 *data, guint size);
+guint gst_omx_packer_count (GstOmxPacker *packer, const guint8 *data, guint size);
+GstBuffer *gst_omx_packer_push (GstOmxPacker *packer, GstBuffer *buf);
+GstBuffer *gst_omx_packer_drain (GstOmxPacker *packer);
+
+guint gst_omx_packer_amrnb_frame_length (const guint8 *data, guint size);
+guint gst_omx_packer_amrwb_frame_length (const guint8 *data, guint size);
+guint gst_omx_packer_g729_frame_length (const guint8 *data, guint size);
+void gst_omx_packer_set_ilbc_mode (GstOmxPacker *packer, gint mode);
+
+G_END_DECLS
+
+#endif /* GSTOMX_PACKER_H */
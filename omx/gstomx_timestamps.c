@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstomx_timestamps.h"
+
+/* Enough for the deepest B-frame reordering; anything beyond that was
+ * dropped by the component and would only drag the output behind. */
+#define MAX_ENTRIES 32
+
+/* How far the timestamp of the component may be off; it's rounded to
+ * OpenMAX ticks. */
+#define HINT_TOLERANCE GST_USECOND
+
+typedef struct Entry Entry;
+
+struct Entry
+{
+    GstClockTime timestamp;
+    GstClockTime duration;
+};
+
+static gint
+entry_compare (gconstpointer a,
+               gconstpointer b,
+               gpointer user_data)
+{
+    const Entry *entry_a = a;
+    const Entry *entry_b = b;
+
+    if (entry_a->timestamp < entry_b->timestamp)
+        return -1;
+    if (entry_a->timestamp > entry_b->timestamp)
+        return 1;
+    return 0;
+}
+
+static void
+entry_free (gpointer data,
+            gpointer user_data)
+{
+    g_slice_free (Entry, data);
+}
+
+GstOmxTimestamps *
+gst_omx_timestamps_new (void)
+{
+    GstOmxTimestamps *ts;
+
+    ts = g_new0 (GstOmxTimestamps, 1);
+
+    ts->entries = g_queue_new ();
+    ts->frame_duration = GST_CLOCK_TIME_NONE;
+    ts->last_timestamp = GST_CLOCK_TIME_NONE;
+    ts->mutex = g_mutex_new ();
+
+    return ts;
+}
+
+void
+gst_omx_timestamps_free (GstOmxTimestamps *ts)
+{
+    g_queue_foreach (ts->entries, entry_free, NULL);
+    g_queue_free (ts->entries);
+    g_mutex_free (ts->mutex);
+
+    g_free (ts);
+}
+
+void
+gst_omx_timestamps_reset (GstOmxTimestamps *ts)
+{
+    Entry *entry;
+
+    g_mutex_lock (ts->mutex);
+
+    while ((entry = g_queue_pop_head (ts->entries)))
+        entry_free (entry, NULL);
+    ts->last_timestamp = GST_CLOCK_TIME_NONE;
+    ts->discont = TRUE;
+
+    g_mutex_unlock (ts->mutex);
+}
+
+void
+gst_omx_timestamps_set_framerate (GstOmxTimestamps *ts,
+                                  gint num,
+                                  gint denom)
+{
+    g_mutex_lock (ts->mutex);
+
+    if (num > 0 && denom > 0)
+        ts->frame_duration = gst_util_uint64_scale_int (GST_SECOND, denom, num);
+    else
+        ts->frame_duration = GST_CLOCK_TIME_NONE;
+
+    g_mutex_unlock (ts->mutex);
+}
+
+/* Called once per input GstBuffer, however many omx buffers it takes. */
+void
+gst_omx_timestamps_push (GstOmxTimestamps *ts,
+                         GstClockTime timestamp,
+                         GstClockTime duration,
+                         gboolean discont)
+{
+    g_mutex_lock (ts->mutex);
+
+    if (discont)
+    {
+        ts->discont = TRUE;
+        ts->last_timestamp = GST_CLOCK_TIME_NONE;
+    }
+
+    /* Nothing to hand out later; the output gets interpolated. */
+    if (GST_CLOCK_TIME_IS_VALID (timestamp))
+    {
+        Entry *entry;
+
+        entry = g_slice_new (Entry);
+        entry->timestamp = timestamp;
+        entry->duration = duration;
+
+        g_queue_insert_sorted (ts->entries, entry, entry_compare, NULL);
+
+        if (G_UNLIKELY (g_queue_get_length (ts->entries) > MAX_ENTRIES))
+            entry_free (g_queue_pop_head (ts->entries), NULL);
+    }
+
+    g_mutex_unlock (ts->mutex);
+}
+
+/* The entry of hint; the ones before it belong to frames the component
+ * dropped or merged, so they go too. */
+static Entry *
+pop_matching (GstOmxTimestamps *ts,
+              GstClockTime hint)
+{
+    GList *link;
+
+    for (link = ts->entries->head; link; link = link->next)
+    {
+        Entry *entry;
+
+        entry = link->data;
+
+        if (entry->timestamp + HINT_TOLERANCE <= hint)
+            continue;
+
+        if (entry->timestamp >= hint + HINT_TOLERANCE)
+            break;
+
+        while (ts->entries->head != link)
+            entry_free (g_queue_pop_head (ts->entries), NULL);
+
+        return g_queue_pop_head (ts->entries);
+    }
+
+    return NULL;
+}
+
+/* Called once per output frame, with the timestamp the component gave it,
+ * or GST_CLOCK_TIME_NONE; returns TRUE if it's a discontinuity. */
+gboolean
+gst_omx_timestamps_pop (GstOmxTimestamps *ts,
+                        GstClockTime hint,
+                        GstClockTime *timestamp,
+                        GstClockTime *duration)
+{
+    GstClockTime next = GST_CLOCK_TIME_NONE;
+    Entry *entry = NULL;
+    gboolean discont;
+
+    g_mutex_lock (ts->mutex);
+
+    if (GST_CLOCK_TIME_IS_VALID (ts->last_timestamp) &&
+        GST_CLOCK_TIME_IS_VALID (ts->frame_duration))
+        next = ts->last_timestamp + ts->frame_duration;
+
+    if (GST_CLOCK_TIME_IS_VALID (hint))
+        entry = pop_matching (ts, hint);
+
+    if (!entry)
+        entry = g_queue_pop_head (ts->entries);
+
+    if (entry)
+    {
+        *timestamp = entry->timestamp;
+        *duration = entry->duration;
+        entry_free (entry, NULL);
+
+        /* Duplicated, or left over from a frame the component dropped. */
+        if (GST_CLOCK_TIME_IS_VALID (ts->last_timestamp) &&
+            *timestamp <= ts->last_timestamp)
+            *timestamp = next;
+    }
+    else
+    {
+        *timestamp = next;
+        *duration = GST_CLOCK_TIME_NONE;
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID (*duration))
+        *duration = ts->frame_duration;
+
+    if (GST_CLOCK_TIME_IS_VALID (*timestamp))
+        ts->last_timestamp = *timestamp;
+
+    discont = ts->discont;
+    ts->discont = FALSE;
+
+    g_mutex_unlock (ts->mutex);
+
+    return discont;
+}
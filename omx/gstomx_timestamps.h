@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_TIMESTAMPS_H
+#define GSTOMX_TIMESTAMPS_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct GstOmxTimestamps GstOmxTimestamps;
+
+/* Input timestamps, handed out again in presentation order as output
+ * frames come out of the component; nTimeStamp is only a hint. Decoders
+ * output frames in presentation order, so each output frame gets the
+ * smallest pending timestamp, unless its nTimeStamp matches a later one;
+ * then the frames before it were dropped. Missing ones are interpolated
+ * from the frame duration. */
+
+struct GstOmxTimestamps
+{
+    GQueue *entries; /**< Sorted, smallest first. */
+    GstClockTime frame_duration;
+    GstClockTime last_timestamp;
+    gboolean discont;
+    GMutex *mutex;
+};
+
+GstOmxTimestamps *gst_omx_timestamps_new (void);
+void gst_omx_timestamps_free (GstOmxTimestamps *ts);
+void gst_omx_timestamps_reset (GstOmxTimestamps *ts);
+void gst_omx_timestamps_set_framerate (GstOmxTimestamps *ts, gint num, gint denom);
+void gst_omx_timestamps_push (GstOmxTimestamps *ts, GstClockTime timestamp, GstClockTime duration, gboolean discont);
+gboolean gst_omx_timestamps_pop (GstOmxTimestamps *ts, GstClockTime hint, GstClockTime *timestamp, GstClockTime *duration);
+
+G_END_DECLS
+
+#endif /* GSTOMX_TIMESTAMPS_H */
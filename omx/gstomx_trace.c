@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "gstomx_trace.h"
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h> /* For getenv */
+#include <unistd.h> /* For getpid */
+
+/* Events kept per thread; older ones are overwritten. */
+#define RING_SIZE 4096
+#define RING_MASK (RING_SIZE - 1)
+
+typedef struct TraceEvent TraceEvent;
+typedef struct TraceRing TraceRing;
+
+struct TraceEvent
+{
+    guint64 timestamp; /**< Microseconds. */
+    const gchar *name;
+    gconstpointer object;
+    gconstpointer data;
+    guint thread_id;
+    gchar phase;
+};
+
+/* Only the owning thread writes to a ring, so recording needs no lock;
+ * a dump taken while the thread runs may show a torn event or two. */
+struct TraceRing
+{
+    TraceEvent events[RING_SIZE];
+    volatile gint head;
+    guint thread_id;
+    gboolean in_use;
+    TraceRing *next;
+};
+
+gboolean g_omx_trace_enabled;
+
+static const gchar *file_name;
+static GStaticPrivate ring_key = G_STATIC_PRIVATE_INIT;
+static GStaticMutex rings_lock = G_STATIC_MUTEX_INIT;
+static TraceRing *rings;
+static guint last_thread_id;
+
+/* Monotonic, so wall clock adjustments don't reorder events. */
+static inline guint64
+now (void)
+{
+    return gst_util_get_timestamp () / GST_USECOND;
+}
+
+/* Rings outlive their threads so their events still make it to the dump;
+ * new threads take over the ones that were left behind. */
+static void
+ring_release (gpointer data)
+{
+    TraceRing *ring;
+
+    ring = data;
+
+    g_static_mutex_lock (&rings_lock);
+    ring->in_use = FALSE;
+    g_static_mutex_unlock (&rings_lock);
+}
+
+static TraceRing *
+ring_get (void)
+{
+    TraceRing *ring;
+
+    ring = g_static_private_get (&ring_key);
+    if (G_LIKELY (ring))
+        return ring;
+
+    g_static_mutex_lock (&rings_lock);
+
+    for (ring = rings; ring; ring = ring->next)
+    {
+        if (!ring->in_use)
+            break;
+    }
+
+    if (!ring)
+    {
+        ring = g_new0 (TraceRing, 1);
+        ring->next = rings;
+        rings = ring;
+    }
+
+    ring->in_use = TRUE;
+    ring->thread_id = ++last_thread_id;
+
+    g_static_mutex_unlock (&rings_lock);
+
+    g_static_private_set (&ring_key, ring, ring_release);
+
+    return ring;
+}
+
+void
+g_omx_trace_init (void)
+{
+    file_name = getenv ("GST_OMX_TRACE");
+    g_omx_trace_enabled = (file_name && *file_name);
+}
+
+void
+g_omx_trace_event (GOmxTracePhase phase,
+                   const gchar *name,
+                   gconstpointer object,
+                   gconstpointer data)
+{
+    TraceRing *ring;
+    TraceEvent *event;
+    gint head;
+
+    ring = ring_get ();
+
+    head = ring->head;
+    event = &ring->events[head & RING_MASK];
+
+    event->timestamp = now ();
+    event->name = name;
+    event->object = object;
+    event->data = data;
+    event->thread_id = ring->thread_id;
+    event->phase = phase;
+
+    g_atomic_int_set (&ring->head, head + 1);
+}
+
+/* Writes everything recorded so far to the GST_OMX_TRACE file, with the
+ * number of the dump appended; streams ending at the same time would
+ * otherwise overwrite each other's. */
+gboolean
+g_omx_trace_dump (void)
+{
+    static GStaticMutex dump_lock = G_STATIC_MUTEX_INIT;
+    static guint dump_count;
+    TraceRing *ring;
+    FILE *file;
+    gchar *dump_name;
+    gboolean first = TRUE;
+
+    if (!g_omx_trace_enabled)
+        return FALSE;
+
+    g_static_mutex_lock (&dump_lock);
+
+    dump_name = g_strdup_printf ("%s.%u", file_name, ++dump_count);
+    file = fopen (dump_name, "w");
+    g_free (dump_name);
+    if (!file)
+    {
+        g_static_mutex_unlock (&dump_lock);
+        return FALSE;
+    }
+
+    fprintf (file, "{\"traceEvents\": [\n");
+
+    g_static_mutex_lock (&rings_lock);
+    ring = rings;
+    g_static_mutex_unlock (&rings_lock);
+
+    /* Rings are only ever prepended, so the list can be walked unlocked. */
+    for (; ring; ring = ring->next)
+    {
+        guint head;
+        guint i;
+
+        head = (guint) g_atomic_int_get (&ring->head);
+
+        for (i = head > RING_SIZE ? head - RING_SIZE : 0; i < head; i++)
+        {
+            TraceEvent event;
+
+            event = ring->events[i & RING_MASK];
+
+            fprintf (file, "%s{\"name\": \"%s\", \"cat\": \"omx\", \"ph\": \"%c\", "
+                     "\"ts\": %" G_GUINT64_FORMAT ", \"pid\": %d, \"tid\": %u, %s"
+                     "\"args\": {\"object\": \"%p\", \"data\": \"%p\"}}",
+                     first ? "" : ",\n",
+                     event.name, event.phase, event.timestamp,
+                     (gint) getpid (), event.thread_id,
+                     event.phase == G_OMX_TRACE_INSTANT ? "\"s\": \"t\", " : "",
+                     event.object, event.data);
+
+            first = FALSE;
+        }
+    }
+
+    fprintf (file, "\n]}\n");
+    fclose (file);
+
+    g_static_mutex_unlock (&dump_lock);
+
+    return TRUE;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef GSTOMX_TRACE_H
+#define GSTOMX_TRACE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Cheap enough to leave compiled in; set GST_OMX_TRACE to a file name to
+ * record buffer and command traffic, which is written out as Chrome
+ * trace-event JSON (chrome://tracing, Perfetto) on EOS, or whenever a
+ * "GstOmxTraceDump" custom event goes through a filter. Each dump goes to
+ * a file of its own, named after GST_OMX_TRACE plus ".1", ".2" and so on. */
+
+typedef enum
+{
+    G_OMX_TRACE_INSTANT = 'i',
+    G_OMX_TRACE_BEGIN = 'B',
+    G_OMX_TRACE_END = 'E'
+} GOmxTracePhase;
+
+extern gboolean g_omx_trace_enabled;
+
+/* name must be a static string; object tells streams apart, data is
+ * usually the buffer. */
+#define G_OMX_TRACE(phase, name, object, data) \
+    G_STMT_START { \
+        if (G_UNLIKELY (g_omx_trace_enabled)) \
+            g_omx_trace_event (phase, name, object, data); \
+    } G_STMT_END
+
+void g_omx_trace_init (void);
+void g_omx_trace_event (GOmxTracePhase phase, const gchar *name, gconstpointer object, gconstpointer data);
+gboolean g_omx_trace_dump (void);
+
+G_END_DECLS
+
+#endif /* GSTOMX_TRACE_H */
@@ -22,8 +22,12 @@
 
 #include "gstomx_util.h"
 #include <dlfcn.h>
+#include <stdlib.h> /* For atoi, calloc, free */
+#include <string.h> /* For memset, strcmp */
 
 #include "gstomx.h"
+#include "gstomx_buffer.h"
+#include "gstomx_trace.h"
 
 GST_DEBUG_CATEGORY (gstomx_util_debug);
 
@@ -32,17 +36,50 @@ GST_DEBUG_CATEGORY (gstomx_util_debug);
 
 /* #define USE_ALLOCATE_BUFFER */
 
+/* Histograms are halved every STATS_WINDOW samples so they follow the
+ * recent behaviour of the port. */
+#define STATS_WINDOW 1024
+
+/* Ports of a pooled handle that get their definitions reset. */
+#define HANDLE_MAX_PORTS 8
+
+typedef struct BufferRef BufferRef;
+typedef struct BufferRefLock BufferRefLock;
+
+/* Guards the BufferRefs of a zero-copy port. The port and each of its
+ * BufferRefs hold a reference, since the BufferRefs may outlive it. No
+ * OpenMAX call is made with it held. */
+struct BufferRefLock
+{
+    GMutex *mutex;
+    volatile gint refcount;
+};
+
+/* On zero-copy ports a header can be held by the component and by
+ * GstBuffers wrapping its data at the same time; it's only recycled once
+ * all of them are done with it. */
+struct BufferRef
+{
+    GOmxPort *port; /**< NULL once the port has freed its buffers. */
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+    gpointer data;
+    GstBuffer *owner; /**< Buffer the data belongs to, if not ours. */
+    BufferRefLock *lock;
+    guint holders;
+    gboolean in_component;
+};
+
 /*
  * Forward declarations
  */
 
 static inline void
-change_state (GOmxCore *core,
-              OMX_STATETYPE state);
+send_state (GOmxCore *core,
+            OMX_STATETYPE state);
 
 static inline void
-wait_for_state (GOmxCore *core,
-                OMX_STATETYPE state);
+fail_state_changes (GOmxCore *core,
+                    OMX_ERRORTYPE error);
 
 static inline void
 in_port_cb (GOmxPort *port,
@@ -93,6 +130,65 @@ static OMX_CALLBACKTYPE callbacks = { EventHandler, EmptyBufferDone, FillBufferD
 static GHashTable *implementations;
 static gboolean initialized;
 
+/* Component handles are given back to the pool in Loaded state, and
+ * picked up again by the next core that asks for the same component, with
+ * the port definitions the component first came with. The
+ * callbacks of a handle point to its GOmxHandle, so they reach whichever
+ * core owns it at the moment. */
+struct GOmxHandle
+{
+    GOmxCore *core; /**< NULL while the handle is in the pool. */
+    OMX_HANDLETYPE omx_handle;
+    GOmxImp *imp;
+    gchar *key;
+    GArray *port_defs; /**< As the component came, to undo what the last core set. */
+};
+
+static GHashTable *handle_pool; /* "library:component" -> GQueue of GOmxHandle */
+static guint handle_pool_size; /* Per component; 0 disables the pool. */
+G_LOCK_DEFINE_STATIC (handles);
+
+/* Milliseconds a core that preempted another waits for the session,
+ * whatever its admission-timeout. */
+#define PREEMPT_TIMEOUT 5000
+
+/* Components can be limited to a number of concurrent cores; the rest
+ * wait, highest priority first, or fail. A session lasts from
+ * g_omx_core_init to g_omx_core_deinit. */
+typedef struct GOmxSessions GOmxSessions;
+
+struct GOmxSessions
+{
+    guint limit;
+    GList *admitted;
+    GList *waiting;
+};
+
+static GHashTable *sessions; /* component -> GOmxSessions */
+static GMutex *sessions_mutex;
+static GCond *sessions_cond;
+static gboolean preempt_sessions; /**< Ask lower priority cores to give their session up. */
+
+/* Callbacks queued for the dispatcher thread of a core; a buffer done
+ * carries the port index in data_1. */
+typedef struct CoreEvent CoreEvent;
+
+struct CoreEvent
+{
+    OMX_EVENTTYPE event;
+    OMX_U32 data_1;
+    OMX_U32 data_2;
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+};
+
+/* Events of a core besides the buffers of its ports; commands, errors,
+ * port settings changes. */
+#define DISPATCH_EVENT_HEADROOM 32
+
+static void dispatcher_start (GOmxCore *core);
+static void dispatcher_stop (GOmxCore *core);
+static inline void report_error (GOmxCore *core, OMX_ERRORTYPE error);
+
 static void
 g_ptr_array_clear (GPtrArray *array)
 {
@@ -192,12 +288,137 @@ release_imp (GOmxImp *imp)
     }
 }
 
+static void
+handle_free (GOmxHandle *handle)
+{
+    handle->imp->sym_table.free_handle (handle->omx_handle);
+
+    G_LOCK (handles);
+    release_imp (handle->imp);
+    G_UNLOCK (handles);
+
+    g_array_free (handle->port_defs, TRUE);
+    g_free (handle->key);
+    g_free (handle);
+}
+
+/* Ports are numbered from 0 on; the first one missing ends the list. */
+static void
+handle_save_port_defs (GOmxHandle *handle)
+{
+    guint index;
+
+    handle->port_defs = g_array_new (FALSE, TRUE, sizeof (OMX_PARAM_PORTDEFINITIONTYPE));
+
+    for (index = 0; index < HANDLE_MAX_PORTS; index++)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *param;
+
+        g_array_set_size (handle->port_defs, index + 1);
+        param = &g_array_index (handle->port_defs, OMX_PARAM_PORTDEFINITIONTYPE, index);
+
+        param->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
+        param->nVersion.s.nVersionMajor = 1;
+        param->nVersion.s.nVersionMinor = 1;
+        param->nPortIndex = index;
+
+        if (OMX_GetParameter (handle->omx_handle, OMX_IndexParamPortDefinition, param) != OMX_ErrorNone)
+        {
+            g_array_set_size (handle->port_defs, index);
+            break;
+        }
+    }
+}
+
+/* A pooled handle still has whatever its last core configured. */
+static void
+handle_restore_port_defs (GOmxHandle *handle)
+{
+    guint index;
+
+    for (index = 0; index < handle->port_defs->len; index++)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *param;
+        OMX_ERRORTYPE error;
+
+        param = &g_array_index (handle->port_defs, OMX_PARAM_PORTDEFINITIONTYPE, index);
+
+        error = OMX_SetParameter (handle->omx_handle, OMX_IndexParamPortDefinition, param);
+        if (error != OMX_ErrorNone)
+            GST_DEBUG ("couldn't reset port %u: 0x%08x", index, error);
+    }
+}
+
+static void
+pool_free_queue (gpointer key,
+                 gpointer value,
+                 gpointer user_data)
+{
+    GQueue *queue;
+    GOmxHandle *handle;
+
+    queue = value;
+
+    while ((handle = g_queue_pop_head (queue)))
+        handle_free (handle);
+
+    g_queue_free (queue);
+}
+
+static void
+sessions_free (gpointer data)
+{
+    GOmxSessions *entry;
+
+    entry = data;
+
+    g_list_free (entry->admitted);
+    g_list_free (entry->waiting);
+    g_free (entry);
+}
+
 void
 g_omx_init (void)
 {
     if (!initialized)
     {
+        const gchar *pool_size;
+        const gchar *limits;
+
         implementations = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) imp_free);
+        handle_pool = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        sessions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, sessions_free);
+        sessions_mutex = g_mutex_new ();
+        sessions_cond = g_cond_new ();
+
+        pool_size = g_getenv ("GST_OMX_HANDLE_POOL");
+        if (pool_size)
+            handle_pool_size = atoi (pool_size);
+
+        /* "OMX.foo.video.decoder:2,OMX.foo.video.encoder:1" */
+        limits = g_getenv ("GST_OMX_SESSION_LIMITS");
+        if (limits)
+        {
+            gchar **entries;
+            guint i;
+
+            entries = g_strsplit (limits, ",", 0);
+            for (i = 0; entries[i]; i++)
+            {
+                gchar *separator;
+
+                separator = strrchr (entries[i], ':');
+                if (!separator)
+                    continue;
+
+                *separator = '\0';
+                g_omx_set_session_limit (g_strstrip (entries[i]), atoi (separator + 1));
+            }
+            g_strfreev (entries);
+        }
+
+        preempt_sessions = (g_getenv ("GST_OMX_PREEMPT") != NULL);
+
         initialized = true;
     }
 }
@@ -207,11 +428,51 @@ g_omx_deinit (void)
 {
     if (initialized)
     {
+        /* Pooled handles keep their implementation busy. */
+        g_hash_table_foreach (handle_pool, pool_free_queue, NULL);
+        g_hash_table_destroy (handle_pool);
+
         g_hash_table_destroy (implementations);
+
+        g_hash_table_destroy (sessions);
+        g_cond_free (sessions_cond);
+        g_mutex_free (sessions_mutex);
+
         initialized = false;
     }
 }
 
+void
+g_omx_set_handle_pool_size (guint size)
+{
+    G_LOCK (handles);
+    handle_pool_size = size;
+    G_UNLOCK (handles);
+}
+
+/* 0 lifts the limit. */
+void
+g_omx_set_session_limit (const gchar *component_name,
+                         guint limit)
+{
+    GOmxSessions *entry;
+
+    g_mutex_lock (sessions_mutex);
+
+    entry = g_hash_table_lookup (sessions, component_name);
+    if (!entry)
+    {
+        entry = g_new0 (GOmxSessions, 1);
+        g_hash_table_insert (sessions, g_strdup (component_name), entry);
+    }
+
+    entry->limit = limit > 0 ? limit : G_MAXUINT;
+
+    g_cond_broadcast (sessions_cond);
+
+    g_mutex_unlock (sessions_mutex);
+}
+
 /*
  * Core
  */
@@ -228,22 +489,51 @@ g_omx_core_new (void)
     core->omx_state_condition = g_cond_new ();
     core->omx_state_mutex = g_mutex_new ();
 
+    core->pending_state = OMX_StateMax;
+    core->state_queue = g_queue_new ();
+
     core->done_sem = g_omx_sem_new ();
     core->flush_sem = g_omx_sem_new ();
     core->port_sem = g_omx_sem_new ();
 
+    core->dispatch_mutex = g_mutex_new ();
+    core->dispatch_cond = g_cond_new ();
+
     core->omx_state = OMX_StateInvalid;
 
     return core;
 }
 
+static void
+state_thread_stop (GOmxCore *core)
+{
+    g_mutex_lock (core->omx_state_mutex);
+    core->state_thread_quit = TRUE;
+    /* Nobody is going to wait for it anymore. */
+    if (core->pending_state != OMX_StateMax)
+        fail_state_changes (core, OMX_ErrorTimeout);
+    g_cond_broadcast (core->omx_state_condition);
+    g_mutex_unlock (core->omx_state_mutex);
+
+    g_thread_join (core->state_thread);
+    core->state_thread = NULL;
+    core->state_thread_quit = FALSE;
+}
+
 void
 g_omx_core_free (GOmxCore *core)
 {
+    if (core->state_thread)
+        state_thread_stop (core);
+
     g_omx_sem_free (core->port_sem);
     g_omx_sem_free (core->flush_sem);
     g_omx_sem_free (core->done_sem);
 
+    g_cond_free (core->dispatch_cond);
+    g_mutex_free (core->dispatch_mutex);
+
+    g_queue_free (core->state_queue);
     g_mutex_free (core->omx_state_mutex);
     g_cond_free (core->omx_state_condition);
 
@@ -252,387 +542,1581 @@ g_omx_core_free (GOmxCore *core)
     g_free (core);
 }
 
-void
-g_omx_core_init (GOmxCore *core,
-                 const gchar *library_name,
-                 const gchar *component_name)
+static inline gint
+compare_priority (gconstpointer a,
+                  gconstpointer b)
 {
-    core->imp = request_imp (library_name);
-
-    if (!core->imp)
-    {
-        core->omx_error = OMX_ErrorUndefined;
-        return;
-    }
+    const GOmxCore *core_a = a;
+    const GOmxCore *core_b = b;
 
-    core->omx_error = core->imp->sym_table.get_handle (&core->omx_handle, (gchar *) component_name, core, &callbacks);
-    core->omx_state = OMX_StateLoaded;
+    return (core_a->priority > core_b->priority) - (core_a->priority < core_b->priority);
 }
 
-void
-g_omx_core_deinit (GOmxCore *core)
+typedef struct PoolSearch PoolSearch;
+
+struct PoolSearch
 {
-    if (!core->imp)
-        return;
+    gchar *suffix; /**< ":component", which ends the keys of its handles. */
+    const gchar *key; /**< Searched last. */
+    guint count;
+    GQueue *queue;
+};
 
-    core->omx_error = core->imp->sym_table.free_handle (core->omx_handle);
+static void
+pool_search_cb (gpointer key,
+                gpointer value,
+                gpointer user_data)
+{
+    PoolSearch *search;
+    GQueue *queue;
 
-    if (core->omx_error)
+    search = user_data;
+    queue = value;
+
+    if (g_queue_is_empty (queue) || !g_str_has_suffix (key, search->suffix))
         return;
 
-    release_imp (core->imp);
-    core->imp = NULL;
+    search->count += g_queue_get_length (queue);
+
+    if (!search->queue || strcmp (key, search->key) != 0)
+        search->queue = queue;
 }
 
-typedef void (*GOmxPortFunc) (GOmxPort *port);
+/* Pooled handles of a component hold a session of their own; finds how
+ * many there are, and the queue to evict one from, preferring those of
+ * other libraries. With the handles lock. */
+static inline guint
+pool_search (const gchar *component_name,
+             const gchar *key,
+             GQueue **queue)
+{
+    PoolSearch search;
 
-static void inline
-core_for_each_port (GOmxCore *core,
-                    GOmxPortFunc func)
+    search.suffix = g_strconcat (":", component_name, NULL);
+    search.key = key;
+    search.count = 0;
+    search.queue = NULL;
+
+    g_hash_table_foreach (handle_pool, pool_search_cb, &search);
+
+    g_free (search.suffix);
+
+    *queue = search.queue;
+
+    return search.count;
+}
+
+/* The admitted core with the lowest priority below that of core, if it
+ * hasn't been asked already; with sessions_mutex. */
+static inline GOmxCore *
+find_preemptible (GOmxSessions *entry,
+                  GOmxCore *core)
 {
-    guint index;
+    GOmxCore *victim = NULL;
+    GList *cur;
 
-    for (index = 0; index < core->ports->len; index++)
+    for (cur = entry->admitted; cur; cur = g_list_next (cur))
     {
-        GOmxPort *port;
+        GOmxCore *candidate;
 
-        port = g_omx_core_get_port (core, index);
+        candidate = cur->data;
 
-        if (port)
-            func (port);
+        if (candidate->priority > core->priority &&
+            (!victim || candidate->priority > victim->priority))
+        {
+            victim = candidate;
+        }
     }
+
+    if (victim && victim->preempted)
+        return NULL;
+
+    return victim;
 }
 
-void
-g_omx_core_prepare (GOmxCore *core)
+/* Pooled handles count against the limit, and are evicted before
+ * anybody has to wait for them. An admitted core may get the pooled
+ * handle it's going to use in 'handle'. */
+static gboolean
+session_admit (GOmxCore *core,
+               const gchar *component_name,
+               const gchar *key,
+               GOmxHandle **handle)
 {
-    change_state (core, OMX_StateIdle);
+    GOmxSessions *entry;
+    GTimeVal end_time;
+    GSList *evicted = NULL;
+    gboolean admitted = FALSE;
+    gboolean preempting = FALSE;
 
-    /* Allocate buffers. */
-    core_for_each_port (core, port_allocate_buffers);
+    g_mutex_lock (sessions_mutex);
 
-    wait_for_state (core, OMX_StateIdle);
-}
+    entry = g_hash_table_lookup (sessions, component_name);
+    if (!entry)
+    {
+        g_mutex_unlock (sessions_mutex);
+        return TRUE;
+    }
 
-void
-g_omx_core_start (GOmxCore *core)
-{
-    change_state (core, OMX_StateExecuting);
-    wait_for_state (core, OMX_StateExecuting);
+    g_get_current_time (&end_time);
+    end_time.tv_sec += core->admission_timeout / 1000;
+    g_time_val_add (&end_time, (core->admission_timeout % 1000) * 1000);
 
-    core_for_each_port (core, port_start_buffers);
-}
+    entry->waiting = g_list_insert_sorted (entry->waiting, core, compare_priority);
 
-void
-g_omx_core_pause (GOmxCore *core)
-{
-    change_state (core, OMX_StatePause);
-    wait_for_state (core, OMX_StatePause);
-}
+    while (TRUE)
+    {
+        GQueue *own_queue;
+        GQueue *evict_queue;
+        guint in_use;
+        gboolean full;
 
-void
-g_omx_core_finish (GOmxCore *core)
-{
-    change_state (core, OMX_StateIdle);
-    wait_for_state (core, OMX_StateIdle);
+        G_LOCK (handles);
 
-    change_state (core, OMX_StateLoaded);
-    core_for_each_port (core, port_free_buffers);
-    wait_for_state (core, OMX_StateLoaded);
+        in_use = g_list_length (entry->admitted) + pool_search (component_name, key, &evict_queue);
 
-    core_for_each_port (core, g_omx_port_free);
-    g_ptr_array_clear (core->ports);
-}
+        /* Taking a handle out of the pool doesn't add a session. */
+        own_queue = g_hash_table_lookup (handle_pool, key);
+        if (own_queue && !g_queue_is_empty (own_queue))
+            in_use--;
 
-GOmxPort *
-g_omx_core_setup_port (GOmxCore *core,
-                       OMX_PARAM_PORTDEFINITIONTYPE *omx_port)
-{
-    GOmxPort *port;
-    guint index;
+        full = (in_use >= entry->limit);
 
-    index = omx_port->nPortIndex;
-    port = g_omx_core_get_port (core, index);
+        if (entry->waiting->data == core)
+        {
+            if (!full)
+            {
+                if (own_queue)
+                    *handle = g_queue_pop_head (own_queue);
+                admitted = TRUE;
+            }
+            else if (g_list_length (entry->admitted) < entry->limit)
+            {
+                evicted = g_slist_prepend (evicted, g_queue_pop_head (evict_queue));
+                G_UNLOCK (handles);
+                continue;
+            }
+        }
 
-    if (!port)
+        G_UNLOCK (handles);
+
+        if (admitted)
+            break;
+
+        if (preempt_sessions && full && entry->waiting->data == core)
+        {
+            GOmxCore *victim;
+
+            victim = find_preemptible (entry, core);
+            if (victim)
+            {
+                GST_INFO ("preempting core %p of %s (priority %u) for %u",
+                          victim, component_name, victim->priority, core->priority);
+
+                /* The client is expected to tear the core down;
+                 * session_release waits for the report, so it can go
+                 * out without the lock. */
+                victim->preempted = TRUE;
+                victim->preempt_reporting = TRUE;
+                g_mutex_unlock (sessions_mutex);
+
+                report_error (victim, OMX_ErrorResourcesPreempted);
+
+                g_mutex_lock (sessions_mutex);
+                victim->preempt_reporting = FALSE;
+                g_cond_broadcast (sessions_cond);
+
+                /* The victim keeps its session until its client shuts it
+                 * down; that's worth waiting for. */
+                if (!preempting)
+                {
+                    GTimeVal preempt_end;
+
+                    g_get_current_time (&preempt_end);
+                    g_time_val_add (&preempt_end, PREEMPT_TIMEOUT * 1000);
+
+                    if (core->admission_timeout == 0 ||
+                        preempt_end.tv_sec > end_time.tv_sec ||
+                        (preempt_end.tv_sec == end_time.tv_sec && preempt_end.tv_usec > end_time.tv_usec))
+                    {
+                        end_time = preempt_end;
+                    }
+
+                    preempting = TRUE;
+                }
+                continue;
+            }
+        }
+
+        if ((core->admission_timeout == 0 && !preempting) ||
+            !g_cond_timed_wait (sessions_cond, sessions_mutex, &end_time))
+        {
+            break;
+        }
+    }
+
+    entry->waiting = g_list_remove (entry->waiting, core);
+
+    if (admitted)
     {
-        port = g_omx_port_new (core);
-        g_ptr_array_insert (core->ports, index, port);
+        entry->admitted = g_list_prepend (entry->admitted, core);
+        core->session = entry;
+    }
+    else
+    {
+        GST_WARNING ("no session left for %s; %u in use", component_name, entry->limit);
     }
 
-    g_omx_port_setup (port, omx_port);
+    /* Whoever waits behind us may go now. */
+    g_cond_broadcast (sessions_cond);
 
-    return port;
-}
+    g_mutex_unlock (sessions_mutex);
 
-static inline GOmxPort *
-g_omx_core_get_port (GOmxCore *core,
-                     guint index)
-{
-    if (G_LIKELY (index < core->ports->len))
+    while (evicted)
     {
-        return g_ptr_array_index (core->ports, index);
+        GST_DEBUG ("evicting pooled handle %p of %s",
+                   ((GOmxHandle *) evicted->data)->omx_handle, component_name);
+        handle_free (evicted->data);
+        evicted = g_slist_delete_link (evicted, evicted);
     }
 
-    return NULL;
+    return admitted;
 }
 
-void
-g_omx_core_set_done (GOmxCore *core)
+static void
+session_release (GOmxCore *core)
 {
-    g_omx_sem_up (core->done_sem);
-}
+    GOmxSessions *entry;
 
-void
-g_omx_core_wait_for_done (GOmxCore *core)
-{
-    g_omx_sem_down (core->done_sem);
+    if (!core->session)
+        return;
+
+    g_mutex_lock (sessions_mutex);
+
+    while (core->preempt_reporting)
+        g_cond_wait (sessions_cond, sessions_mutex);
+
+    entry = core->session;
+    entry->admitted = g_list_remove (entry->admitted, core);
+    core->session = NULL;
+    core->preempted = FALSE;
+
+    g_cond_broadcast (sessions_cond);
+
+    g_mutex_unlock (sessions_mutex);
 }
 
-void
-g_omx_core_flush_start (GOmxCore *core)
+/* Lets the component's own resource manager know too. */
+static inline void
+set_priority (GOmxCore *core)
 {
-    core_for_each_port (core, g_omx_port_pause);
+    OMX_PRIORITYMGMTTYPE *param;
+    OMX_ERRORTYPE error;
+
+    param = calloc (1, sizeof (OMX_PRIORITYMGMTTYPE));
+
+    param->nSize = sizeof (OMX_PRIORITYMGMTTYPE);
+    param->nVersion.s.nVersionMajor = 1;
+    param->nVersion.s.nVersionMinor = 1;
+
+    param->nGroupPriority = core->priority;
+
+    error = OMX_SetParameter (core->omx_handle, OMX_IndexParamPriorityMgmt, param);
+    if (error != OMX_ErrorNone)
+        GST_DEBUG ("couldn't set priority: 0x%08x", error);
+
+    free (param);
 }
 
 void
-g_omx_core_flush_stop (GOmxCore *core)
+g_omx_core_init (GOmxCore *core,
+                 const gchar *library_name,
+                 const gchar *component_name)
 {
-    core_for_each_port (core, g_omx_port_flush);
-    core_for_each_port (core, g_omx_port_resume);
-}
+    GOmxHandle *handle = NULL;
+    gboolean reused = FALSE;
+    gchar *key;
 
-/*
- * Port
- */
+    key = g_strdup_printf ("%s:%s", library_name, component_name);
 
-GOmxPort *
+    if (!session_admit (core, component_name, key, &handle))
+    {
+        g_free (key);
+        core->omx_error = OMX_ErrorInsufficientResources;
+        return;
+    }
+
+    G_LOCK (handles);
+
+    if (!handle)
+    {
+        GQueue *queue;
+
+        queue = g_hash_table_lookup (handle_pool, key);
+        if (queue)
+            handle = g_queue_pop_head (queue);
+    }
+
+    if (handle)
+    {
+        GST_DEBUG ("reusing handle %p of %s", handle->omx_handle, key);
+        g_free (key);
+        reused = TRUE;
+    }
+    else
+    {
+        GOmxImp *imp;
+
+        imp = request_imp (library_name);
+
+        if (!imp)
+        {
+            G_UNLOCK (handles);
+            g_free (key);
+            session_release (core);
+            core->omx_error = OMX_ErrorUndefined;
+            return;
+        }
+
+        handle = g_new0 (GOmxHandle, 1);
+        handle->imp = imp;
+        handle->key = key;
+    }
+
+    G_UNLOCK (handles);
+
+    handle->core = core;
+    core->handle = handle;
+    core->imp = handle->imp;
+    core->omx_error = OMX_ErrorNone;
+
+    if (!handle->omx_handle)
+    {
+        core->omx_error = core->imp->sym_table.get_handle (&handle->omx_handle, (gchar *) component_name, handle, &callbacks);
+
+        if (core->omx_error)
+        {
+            G_LOCK (handles);
+            release_imp (handle->imp);
+            G_UNLOCK (handles);
+
+            g_free (handle->key);
+            g_free (handle);
+            core->handle = NULL;
+            core->imp = NULL;
+            session_release (core);
+            return;
+        }
+
+        handle_save_port_defs (handle);
+    }
+    else
+    {
+        handle_restore_port_defs (handle);
+    }
+
+    core->omx_handle = handle->omx_handle;
+    core->omx_state = OMX_StateLoaded;
+    core->component_error = OMX_ErrorNone;
+
+    /* A reused handle may have the priority of its last core. */
+    if (core->priority > 0 || reused)
+        set_priority (core);
+}
+
+void
+g_omx_core_deinit (GOmxCore *core)
+{
+    GOmxHandle *handle;
+
+    if (!core->imp)
+        return;
+
+    if (core->state_thread)
+        state_thread_stop (core);
+
+    if (core->dispatcher)
+        dispatcher_stop (core);
+
+    handle = core->handle;
+
+    /* The session is released only once the handle is in the pool or
+     * gone, so admission never counts fewer than the hardware has. */
+
+    /* Only clean handles are worth keeping. */
+    if (core->omx_state == OMX_StateLoaded &&
+        core->omx_error == OMX_ErrorNone &&
+        core->component_error == OMX_ErrorNone)
+    {
+        gboolean pooled = FALSE;
+
+        G_LOCK (handles);
+
+        if (handle_pool_size > 0)
+        {
+            GQueue *queue;
+
+            queue = g_hash_table_lookup (handle_pool, handle->key);
+            if (!queue)
+            {
+                queue = g_queue_new ();
+                g_hash_table_insert (handle_pool, g_strdup (handle->key), queue);
+            }
+
+            if (g_queue_get_length (queue) < handle_pool_size)
+            {
+                handle->core = NULL;
+                g_queue_push_tail (queue, handle);
+                pooled = TRUE;
+            }
+        }
+
+        G_UNLOCK (handles);
+
+        if (pooled)
+        {
+            GST_DEBUG ("keeping handle %p of %s", handle->omx_handle, handle->key);
+            core->handle = NULL;
+            core->imp = NULL;
+            session_release (core);
+            return;
+        }
+    }
+
+    core->omx_error = core->imp->sym_table.free_handle (core->omx_handle);
+
+    if (core->omx_error)
+    {
+        session_release (core);
+        return;
+    }
+
+    G_LOCK (handles);
+    release_imp (core->imp);
+    G_UNLOCK (handles);
+
+    core->imp = NULL;
+    core->handle = NULL;
+
+    g_array_free (handle->port_defs, TRUE);
+    g_free (handle->key);
+    g_free (handle);
+
+    session_release (core);
+}
+
+typedef void (*GOmxPortFunc) (GOmxPort *port);
+
+static void inline
+core_for_each_port (GOmxCore *core,
+                    GOmxPortFunc func)
+{
+    guint index;
+
+    for (index = 0; index < core->ports->len; index++)
+    {
+        GOmxPort *port;
+
+        port = g_omx_core_get_port (core, index);
+
+        if (port)
+            func (port);
+    }
+}
+
+/* Sends the queued states one at a time. Buffers are allocated and freed
+ * along with the commands, which mustn't happen in an OpenMAX callback. */
+static gpointer
+state_thread (gpointer data)
+{
+    GOmxCore *core;
+
+    core = data;
+
+    g_mutex_lock (core->omx_state_mutex);
+
+    while (TRUE)
+    {
+        OMX_STATETYPE state;
+        OMX_ERRORTYPE error;
+
+        while (g_queue_is_empty (core->state_queue) && !core->state_thread_quit)
+            g_cond_wait (core->omx_state_condition, core->omx_state_mutex);
+
+        if (core->state_thread_quit)
+            break;
+
+        state = GPOINTER_TO_INT (g_queue_pop_head (core->state_queue));
+        core->pending_state = state;
+
+        g_mutex_unlock (core->omx_state_mutex);
+
+        send_state (core, state);
+        error = g_omx_core_wait_for_state (core, state);
+
+        g_mutex_lock (core->omx_state_mutex);
+        if (core->pending_state == state)
+            core->pending_state = OMX_StateMax;
+        g_mutex_unlock (core->omx_state_mutex);
+
+        if (core->state_changed_cb)
+            core->state_changed_cb (core, state, error);
+
+        g_mutex_lock (core->omx_state_mutex);
+    }
+
+    g_mutex_unlock (core->omx_state_mutex);
+
+    return NULL;
+}
+
+/* Queue a state change; it's sent as soon as the previous one completes.
+ * Completion is reported through state_changed_cb and
+ * g_omx_core_wait_for_state. */
+void
+g_omx_core_set_state_async (GOmxCore *core,
+                            OMX_STATETYPE state)
+{
+    g_mutex_lock (core->omx_state_mutex);
+
+    /* Nothing in flight; whatever failed before is over. Errors of the
+     * component itself stay in component_error. */
+    if (core->pending_state == OMX_StateMax &&
+        g_queue_is_empty (core->state_queue))
+    {
+        core->omx_error = OMX_ErrorNone;
+    }
+
+    if (!core->state_thread)
+        core->state_thread = g_thread_create (state_thread, core, TRUE, NULL);
+
+    g_queue_push_tail (core->state_queue, GINT_TO_POINTER (state));
+    g_cond_broadcast (core->omx_state_condition);
+
+    g_mutex_unlock (core->omx_state_mutex);
+}
+
+/* Returns OMX_ErrorNone once the component is in state, OMX_ErrorTimeout if
+ * state_timeout expires first, or the error the component reported. Either
+ * error drops the queued states. */
+OMX_ERRORTYPE
+g_omx_core_wait_for_state (GOmxCore *core,
+                           OMX_STATETYPE state)
+{
+    GTimeVal end_time;
+    GTimeVal *deadline = NULL;
+    OMX_ERRORTYPE error;
+
+    if (core->state_timeout)
+    {
+        g_get_current_time (&end_time);
+        g_time_val_add (&end_time, core->state_timeout * 1000);
+        deadline = &end_time;
+    }
+
+    g_mutex_lock (core->omx_state_mutex);
+
+    while (core->omx_state != state &&
+           core->omx_error == OMX_ErrorNone)
+    {
+        if (!g_cond_timed_wait (core->omx_state_condition, core->omx_state_mutex, deadline))
+        {
+            if (core->omx_state != state)
+            {
+                GST_ERROR ("timed out waiting for state %d (in %d)", state, core->omx_state);
+                fail_state_changes (core, OMX_ErrorTimeout);
+            }
+            break;
+        }
+    }
+
+    error = (core->omx_state == state) ? OMX_ErrorNone : core->omx_error;
+
+    g_mutex_unlock (core->omx_state_mutex);
+
+    return error;
+}
+
+void
+g_omx_core_prepare (GOmxCore *core)
+{
+    g_omx_core_set_state_async (core, OMX_StateIdle);
+    g_omx_core_wait_for_state (core, OMX_StateIdle);
+}
+
+void
+g_omx_core_start (GOmxCore *core)
+{
+    g_omx_core_set_state_async (core, OMX_StateExecuting);
+
+    if (g_omx_core_wait_for_state (core, OMX_StateExecuting) == OMX_ErrorNone)
+        core_for_each_port (core, port_start_buffers);
+}
+
+void
+g_omx_core_pause (GOmxCore *core)
+{
+    g_omx_core_set_state_async (core, OMX_StatePause);
+    g_omx_core_wait_for_state (core, OMX_StatePause);
+}
+
+void
+g_omx_core_finish (GOmxCore *core)
+{
+    OMX_ERRORTYPE error;
+
+    g_omx_core_set_state_async (core, OMX_StateIdle);
+    error = g_omx_core_wait_for_state (core, OMX_StateIdle);
+
+    /* Go on even on errors; the buffers and ports have to be freed. */
+    g_omx_core_set_state_async (core, OMX_StateLoaded);
+    g_omx_core_wait_for_state (core, OMX_StateLoaded);
+
+    core_for_each_port (core, g_omx_port_free);
+    g_ptr_array_clear (core->ports);
+
+    if (error != OMX_ErrorNone)
+        core->omx_error = error;
+}
+
+GOmxPort *
+g_omx_core_setup_port (GOmxCore *core,
+                       OMX_PARAM_PORTDEFINITIONTYPE *omx_port)
+{
+    GOmxPort *port;
+    guint index;
+
+    index = omx_port->nPortIndex;
+    port = g_omx_core_get_port (core, index);
+
+    if (!port)
+    {
+        port = g_omx_port_new (core);
+        g_ptr_array_insert (core->ports, index, port);
+    }
+
+    g_omx_port_setup (port, omx_port);
+
+    return port;
+}
+
+static inline GOmxPort *
+g_omx_core_get_port (GOmxCore *core,
+                     guint index)
+{
+    if (G_LIKELY (index < core->ports->len))
+    {
+        return g_ptr_array_index (core->ports, index);
+    }
+
+    return NULL;
+}
+
+void
+g_omx_core_set_done (GOmxCore *core)
+{
+    g_omx_sem_up (core->done_sem);
+}
+
+void
+g_omx_core_wait_for_done (GOmxCore *core)
+{
+    g_omx_sem_down (core->done_sem);
+}
+
+/* Returns FALSE if end_time passes first. */
+gboolean
+g_omx_core_wait_for_done_timed (GOmxCore *core,
+                                GTimeVal *end_time)
+{
+    return g_omx_sem_down_timed (core->done_sem, end_time);
+}
+
+void
+g_omx_core_flush_start (GOmxCore *core)
+{
+    core_for_each_port (core, g_omx_port_pause);
+}
+
+void
+g_omx_core_flush_stop (GOmxCore *core)
+{
+    core_for_each_port (core, g_omx_port_flush);
+    core_for_each_port (core, g_omx_port_resume);
+}
+
+/*
+ * Port
+ */
+
+static inline BufferRefLock *
+buffer_ref_lock_new (void)
+{
+    BufferRefLock *lock;
+
+    lock = g_new0 (BufferRefLock, 1);
+    lock->mutex = g_mutex_new ();
+    lock->refcount = 1;
+
+    return lock;
+}
+
+static inline BufferRefLock *
+buffer_ref_lock_ref (BufferRefLock *lock)
+{
+    g_atomic_int_inc (&lock->refcount);
+
+    return lock;
+}
+
+static inline void
+buffer_ref_lock_unref (BufferRefLock *lock)
+{
+    if (g_atomic_int_dec_and_test (&lock->refcount))
+    {
+        g_mutex_free (lock->mutex);
+        g_free (lock);
+    }
+}
+
+GOmxPort *
 g_omx_port_new (GOmxCore *core)
 {
-    GOmxPort *port;
-    port = g_new0 (GOmxPort, 1);
+    GOmxPort *port;
+    port = g_new0 (GOmxPort, 1);
+
+    port->core = core;
+    port->num_buffers = 0;
+    port->buffer_size = 0;
+    port->buffers = NULL;
+
+    port->enabled = TRUE;
+    port->mutex = g_mutex_new ();
+    port->drained = g_cond_new ();
+    port->stats_mutex = g_mutex_new ();
+
+    return port;
+}
+
+void
+g_omx_port_free (GOmxPort *port)
+{
+    g_cond_free (port->drained);
+    g_mutex_free (port->mutex);
+    g_mutex_free (port->stats_mutex);
+    if (port->queue)
+        async_ring_free (port->queue);
+
+    if (port->buffer_refs)
+        g_hash_table_destroy (port->buffer_refs);
+
+    if (port->buffer_refs_lock)
+        buffer_ref_lock_unref (port->buffer_refs_lock);
+
+    g_free (port->buffers);
+    g_free (port);
+}
+
+/* The queue never holds more than the buffers of the port, so it can be
+ * sized up-front. A reconfigured port may need a bigger one; it's swapped
+ * with the mutex held, as g_omx_port_pause can come from another thread
+ * meanwhile, and stays disabled if the old one was. */
+static void
+port_setup_queue (GOmxPort *port)
+{
+    AsyncRing *queue;
+
+    if (port->queue && port->queue->capacity >= port->num_buffers)
+        return;
+
+    queue = async_ring_new (port->num_buffers);
+
+    g_mutex_lock (port->mutex);
+    if (port->queue)
+    {
+        if (!g_atomic_int_get (&port->queue->enabled))
+            async_ring_disable (queue);
+        async_ring_free (port->queue);
+    }
+    port->queue = queue;
+    g_mutex_unlock (port->mutex);
+}
+
+/* Unlike g_omx_port_pause, doesn't stop a later enable. */
+static inline void
+port_queue_disable (GOmxPort *port)
+{
+    g_mutex_lock (port->mutex);
+    async_ring_disable (port->queue);
+    g_mutex_unlock (port->mutex);
+}
+
+/* Leaves the queue alone while the port is paused; the resume enables it. */
+static inline void
+port_queue_enable (GOmxPort *port)
+{
+    g_mutex_lock (port->mutex);
+    if (!port->paused)
+        async_ring_enable (port->queue);
+    g_mutex_unlock (port->mutex);
+}
+
+void
+g_omx_port_setup (GOmxPort *port,
+                  OMX_PARAM_PORTDEFINITIONTYPE *omx_port)
+{
+    GOmxPortType type = -1;
+
+    switch (omx_port->eDir)
+    {
+        case OMX_DirInput:
+            type = GOMX_PORT_INPUT;
+            break;
+        case OMX_DirOutput:
+            type = GOMX_PORT_OUTPUT;
+            break;
+        default:
+            break;
+    }
+
+    port->type = type;
+    /** @todo should it be nBufferCountMin? */
+    port->num_buffers = omx_port->nBufferCountActual;
+    port->buffer_size = omx_port->nBufferSize;
+    port->port_index = omx_port->nPortIndex;
+
+    g_free (port->buffers);
+    port->buffers = g_new0 (OMX_BUFFERHEADERTYPE *, port->num_buffers);
+
+    g_omx_port_reset_stats (port);
+
+    port_setup_queue (port);
+}
+
+static void
+port_allocate_buffers (GOmxPort *port)
+{
+    guint i;
+
+    if (port->zero_copy && !port->buffer_refs)
+        port->buffer_refs = g_hash_table_new (NULL, NULL);
+
+    if (port->zero_copy && !port->buffer_refs_lock)
+        port->buffer_refs_lock = buffer_ref_lock_new ();
+
+    port->in_component = 0;
+
+    for (i = 0; i < port->num_buffers; i++)
+    {
+        GOmxBufferData *data;
+        gpointer buffer_data;
+        guint size;
+
+        size = port->buffer_size;
+        buffer_data = g_malloc (size);
+        data = g_new0 (GOmxBufferData, 1);
+
+        /* The memory of zero-copy ports is ours (or the client's), so it
+         * can outlive the header if a GstBuffer still points to it. */
+        if (port->zero_copy)
+        {
+            BufferRef *ref;
+            GstBuffer *owner = NULL;
+
+            if (port->alloc_cb)
+                owner = port->alloc_cb (port, size);
+
+            if (owner && GST_BUFFER_SIZE (owner) >= size)
+            {
+                g_free (buffer_data);
+                buffer_data = GST_BUFFER_DATA (owner);
+            }
+            else if (owner)
+            {
+                gst_buffer_unref (owner);
+                owner = NULL;
+            }
+
+            OMX_UseBuffer (port->core->omx_handle,
+                           &port->buffers[i],
+                           port->port_index,
+                           data,
+                           size,
+                           buffer_data);
+
+            ref = g_new0 (BufferRef, 1);
+            ref->port = port;
+            ref->omx_buffer = port->buffers[i];
+            ref->data = buffer_data;
+            ref->owner = owner;
+            ref->lock = buffer_ref_lock_ref (port->buffer_refs_lock);
+
+            g_hash_table_insert (port->buffer_refs, buffer_data, ref);
+            continue;
+        }
+
+#ifdef USE_ALLOCATE_BUFFER
+        OMX_AllocateBuffer (port->core->omx_handle,
+                            &port->buffers[i],
+                            port->port_index,
+                            data,
+                            size);
+#else
+        OMX_UseBuffer (port->core->omx_handle,
+                       &port->buffers[i],
+                       port->port_index,
+                       data,
+                       size,
+                       buffer_data);
+#endif /* USE_ALLOCATE_BUFFER */
+    }
+}
+
+/* Without the lock held; it may go away with ref. */
+static inline void
+buffer_ref_free (BufferRef *ref)
+{
+    if (ref->owner)
+        gst_buffer_unref (ref->owner);
+    else
+        g_free (ref->data);
+
+    buffer_ref_lock_unref (ref->lock);
+    g_free (ref);
+}
+
+static void
+port_free_buffers (GOmxPort *port)
+{
+    guint i;
+
+    for (i = 0; i < port->num_buffers; i++)
+    {
+        OMX_BUFFERHEADERTYPE *omx_buffer;
+        GOmxBufferData *data;
+
+        omx_buffer = port->buffers[i];
+
+        if (!omx_buffer)
+            continue;
+
+        data = G_OMX_BUFFER_DATA (omx_buffer);
+
+        if (port->buffer_refs)
+        {
+            BufferRef *ref;
+            gboolean unused = FALSE;
+
+            ref = g_hash_table_lookup (port->buffer_refs, omx_buffer->pBuffer);
+
+            OMX_FreeBuffer (port->core->omx_handle, port->port_index, omx_buffer);
+            port->buffers[i] = NULL;
+
+            if (G_LIKELY (ref))
+            {
+                g_mutex_lock (ref->lock->mutex);
+                ref->port = NULL;
+                ref->omx_buffer = NULL;
+                if (ref->in_component)
+                {
+                    ref->in_component = FALSE;
+                    ref->holders--;
+                }
+                unused = (ref->holders == 0);
+                g_mutex_unlock (ref->lock->mutex);
+            }
+
+            if (unused)
+                buffer_ref_free (ref);
+        }
+        else
+        {
+#ifdef USE_ALLOCATE_BUFFER
+            g_free (omx_buffer->pBuffer);
+            omx_buffer->pBuffer = NULL;
+#endif /* USE_ALLOCATE_BUFFER */
+
+            OMX_FreeBuffer (port->core->omx_handle, port->port_index, omx_buffer);
+            port->buffers[i] = NULL;
+        }
+
+        g_free (data);
+    }
+
+    if (port->buffer_refs)
+    {
+        g_hash_table_destroy (port->buffer_refs);
+        port->buffer_refs = NULL;
+    }
+}
+
+static void
+port_start_buffers (GOmxPort *port)
+{
+    guint i;
 
-    port->core = core;
-    port->num_buffers = 0;
-    port->buffer_size = 0;
-    port->buffers = NULL;
+    for (i = 0; i < port->num_buffers; i++)
+    {
+        OMX_BUFFERHEADERTYPE *omx_buffer;
 
-    port->enabled = TRUE;
-    port->queue = async_queue_new ();
-    port->mutex = g_mutex_new ();
+        omx_buffer = port->buffers[i];
 
-    return port;
+        /* If it's an input port we will need to fill the buffer, so put it in
+         * the queue, otherwise send to omx for processing (fill it up). */
+        if (port->type == GOMX_PORT_INPUT)
+            g_omx_port_push_buffer (port, omx_buffer);
+        else
+            g_omx_port_release_buffer (port, omx_buffer);
+    }
 }
 
 void
-g_omx_port_free (GOmxPort *port)
+g_omx_port_push_buffer (GOmxPort *port,
+                        OMX_BUFFERHEADERTYPE *omx_buffer)
 {
-    g_mutex_free (port->mutex);
-    async_queue_free (port->queue);
+    /* The queue has room for every buffer of the port; if it's full, a
+     * buffer got pushed twice, most likely returned twice by the
+     * component. The header is dropped and the core marked as broken. */
+    if (G_UNLIKELY (!async_ring_push (port->queue, omx_buffer)))
+    {
+        GST_ERROR ("queue of port %u full; dropping omx_buffer=%p", port->port_index, omx_buffer);
+        report_error (port->core, OMX_ErrorUndefined);
+    }
+}
 
-    g_free (port->buffers);
-    g_free (port);
+/* In microseconds, from a monotonic clock. */
+static inline guint64
+stats_now (void)
+{
+    return gst_util_get_timestamp () / GST_USECOND;
+}
+
+static inline guint
+stats_bucket (guint64 value)
+{
+    guint bucket = 0;
+
+    while (value > 1 && bucket < GOMX_PORT_STATS_BUCKETS - 1)
+    {
+        value >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static inline void
+stats_decay (guint *histogram)
+{
+    guint i;
+
+    for (i = 0; i < GOMX_PORT_STATS_BUCKETS; i++)
+        histogram[i] >>= 1;
+}
+
+/* A request for count buffers, with available in the queue at the time. */
+static inline void
+stats_request (GOmxPort *port,
+               guint available,
+               guint count)
+{
+    GOmxPortStats *stats;
+    guint64 requested;
+
+    stats = &port->stats;
+
+    g_mutex_lock (port->stats_mutex);
+
+    if (available == 0)
+        stats->starved++;
+
+    stats->occupancy[MIN (available, GOMX_PORT_STATS_BUCKETS - 1)]++;
+
+    requested = stats->requested;
+    stats->requested += count;
+
+    if (requested / STATS_WINDOW != stats->requested / STATS_WINDOW)
+        stats_decay (stats->occupancy);
+
+    g_mutex_unlock (port->stats_mutex);
+}
+
+static inline void
+stats_release (GOmxPort *port,
+               OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    GOmxBufferData *data;
+    guint64 now;
+
+    data = G_OMX_BUFFER_DATA (omx_buffer);
+    now = stats_now ();
+
+    g_mutex_lock (port->stats_mutex);
+
+    if (G_LIKELY (data))
+        data->release_time = now;
+
+    port->stats.released++;
+
+    g_mutex_unlock (port->stats_mutex);
+}
+
+static inline void
+stats_return (GOmxPort *port,
+              OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    GOmxPortStats *stats;
+    GOmxBufferData *data;
+    guint64 now;
+
+    stats = &port->stats;
+    data = G_OMX_BUFFER_DATA (omx_buffer);
+    now = stats_now ();
+
+    g_mutex_lock (port->stats_mutex);
+
+    /* Input buffers are queued once at start without being released. */
+    if (G_LIKELY (data && data->release_time != 0))
+    {
+        guint64 residency;
+
+        residency = now - data->release_time;
+        data->release_time = 0;
+
+        stats->residency_sum += residency;
+        if (residency > stats->residency_max)
+            stats->residency_max = residency;
+        stats->residency[stats_bucket (residency)]++;
+
+        if (++stats->returned % STATS_WINDOW == 0)
+            stats_decay (stats->residency);
+    }
+
+    g_mutex_unlock (port->stats_mutex);
+}
+
+OMX_BUFFERHEADERTYPE *
+g_omx_port_request_buffer (GOmxPort *port)
+{
+    stats_request (port, async_ring_length (port->queue), 1);
+    return async_ring_pop (port->queue);
+}
+
+/* Returns NULL if the port is paused, or if no buffer came back from the
+ * component before end_time. */
+OMX_BUFFERHEADERTYPE *
+g_omx_port_request_buffer_timed (GOmxPort *port,
+                                 GTimeVal *end_time)
+{
+    stats_request (port, async_ring_length (port->queue), 1);
+    return async_ring_pop_timed (port->queue, end_time);
 }
 
 void
-g_omx_port_setup (GOmxPort *port,
-                  OMX_PARAM_PORTDEFINITIONTYPE *omx_port)
+g_omx_port_release_buffer (GOmxPort *port,
+                           OMX_BUFFERHEADERTYPE *omx_buffer)
 {
-    GOmxPortType type = -1;
+    stats_release (port, omx_buffer);
 
-    switch (omx_port->eDir)
+    if (port->buffer_refs)
     {
-        case OMX_DirInput:
-            type = GOMX_PORT_INPUT;
+        BufferRef *ref;
+
+        ref = g_hash_table_lookup (port->buffer_refs, omx_buffer->pBuffer);
+
+        if (G_LIKELY (ref))
+        {
+            g_mutex_lock (ref->lock->mutex);
+            if (!ref->in_component)
+            {
+                ref->in_component = TRUE;
+                ref->holders++;
+            }
+            g_mutex_unlock (ref->lock->mutex);
+        }
+        else
+        {
+            GST_WARNING ("unknown omx_buffer=%p on zero-copy port %u", omx_buffer, port->port_index);
+        }
+    }
+
+    g_atomic_int_inc (&port->in_component);
+
+    switch (port->type)
+    {
+        case GOMX_PORT_INPUT:
+            G_OMX_TRACE (G_OMX_TRACE_INSTANT, "EmptyThisBuffer", port->core, omx_buffer);
+            OMX_EmptyThisBuffer (port->core->omx_handle, omx_buffer);
             break;
-        case OMX_DirOutput:
-            type = GOMX_PORT_OUTPUT;
+        case GOMX_PORT_OUTPUT:
+            G_OMX_TRACE (G_OMX_TRACE_INSTANT, "FillThisBuffer", port->core, omx_buffer);
+            OMX_FillThisBuffer (port->core->omx_handle, omx_buffer);
             break;
         default:
             break;
     }
+}
 
-    port->type = type;
-    /** @todo should it be nBufferCountMin? */
-    port->num_buffers = omx_port->nBufferCountActual;
-    port->buffer_size = omx_port->nBufferSize;
-    port->port_index = omx_port->nPortIndex;
+/* Takes up to count buffers that are available right now, without waiting.
+ * Returns how many were stored in omx_buffers. */
+guint
+g_omx_port_request_buffers (GOmxPort *port,
+                            OMX_BUFFERHEADERTYPE **omx_buffers,
+                            guint count)
+{
+    stats_request (port, async_ring_length (port->queue), count);
 
-    g_free (port->buffers);
-    port->buffers = g_new0 (OMX_BUFFERHEADERTYPE *, port->num_buffers);
+    return async_ring_pop_many (port->queue, (gpointer *) omx_buffers, count);
 }
 
-static void
-port_allocate_buffers (GOmxPort *port)
+void
+g_omx_port_release_buffers (GOmxPort *port,
+                            OMX_BUFFERHEADERTYPE **omx_buffers,
+                            guint count)
 {
     guint i;
 
-    for (i = 0; i < port->num_buffers; i++)
-    {
-        gpointer buffer_data;
-        guint size;
-
-        size = port->buffer_size;
-        buffer_data = g_malloc (size);
+    for (i = 0; i < count; i++)
+        g_omx_port_release_buffer (port, omx_buffers[i]);
+}
 
-#ifdef USE_ALLOCATE_BUFFER
-        OMX_AllocateBuffer (port->core->omx_handle,
-                            &port->buffers[i],
-                            port->port_index,
-                            NULL,
-                            size);
-#else
-        OMX_UseBuffer (port->core->omx_handle,
-                       &port->buffers[i],
-                       port->port_index,
-                       NULL,
-                       size,
-                       buffer_data);
-#endif /* USE_ALLOCATE_BUFFER */
-    }
+void
+g_omx_port_resume (GOmxPort *port)
+{
+    g_mutex_lock (port->mutex);
+    port->paused = FALSE;
+    async_ring_enable (port->queue);
+    g_mutex_unlock (port->mutex);
 }
 
-static void
-port_free_buffers (GOmxPort *port)
+/* May run while the thread taking buffers reconfigures the port; the
+ * reconfiguration then leaves the queue disabled. */
+void
+g_omx_port_pause (GOmxPort *port)
 {
-    guint i;
+    g_mutex_lock (port->mutex);
+    port->paused = TRUE;
+    async_ring_disable (port->queue);
+    g_mutex_unlock (port->mutex);
+}
 
-    for (i = 0; i < port->num_buffers; i++)
+void
+g_omx_port_flush (GOmxPort *port)
+{
+    if (port->type == GOMX_PORT_OUTPUT)
     {
         OMX_BUFFERHEADERTYPE *omx_buffer;
+        while ((omx_buffer = async_ring_pop_forced (port->queue)))
+        {
+            omx_buffer->nFilledLen = 0;
+            g_omx_port_release_buffer (port, omx_buffer);
+        }
+    }
+    else
+    {
+        G_OMX_TRACE (G_OMX_TRACE_BEGIN, "Flush", port->core, GUINT_TO_POINTER (port->port_index));
+        OMX_SendCommand (port->core->omx_handle, OMX_CommandFlush, port->port_index, NULL);
+        g_omx_sem_down (port->core->flush_sem);
+        G_OMX_TRACE (G_OMX_TRACE_END, "Flush", port->core, GUINT_TO_POINTER (port->port_index));
+    }
+}
 
-        omx_buffer = port->buffers[i];
+void
+g_omx_port_enable (GOmxPort *port)
+{
+    GOmxCore *core;
 
-        if (omx_buffer)
-        {
-#ifdef USE_ALLOCATE_BUFFER
-            g_free (omx_buffer->pBuffer);
-            omx_buffer->pBuffer = NULL;
-#endif /* USE_ALLOCATE_BUFFER */
+    core = port->core;
 
-            OMX_FreeBuffer (port->core->omx_handle, port->port_index, omx_buffer);
-            port->buffers[i] = NULL;
+    OMX_SendCommand (core->omx_handle, OMX_CommandPortEnable, port->port_index, NULL);
+    port_allocate_buffers (port);
+    if (core->omx_state != OMX_StateLoaded)
+        port_start_buffers (port);
+    port_queue_enable (port);
+
+    g_omx_sem_down (core->port_sem);
+}
+
+void
+g_omx_port_disable (GOmxPort *port)
+{
+    GOmxCore *core;
+
+    core = port->core;
+
+    OMX_SendCommand (core->omx_handle, OMX_CommandPortDisable, port->port_index, NULL);
+    port_queue_disable (port);
+    g_omx_port_flush (port);
+    port_free_buffers (port);
+
+    g_omx_sem_down (core->port_sem);
+}
+
+void
+g_omx_port_finish (GOmxPort *port)
+{
+    port->enabled = FALSE;
+    port_queue_disable (port);
+}
+
+/* Applies new port settings while the rest of the component keeps running:
+ * the port is disabled, its buffers freed, and allocated again with the
+ * sizes the component asks for now. Must be called from the thread that
+ * takes buffers from the port, never from a component callback. */
+void
+g_omx_port_reconfigure (GOmxPort *port)
+{
+    GOmxCore *core;
+    GTimeVal end_time;
+    GTimeVal *timeout = NULL;
+
+    core = port->core;
+
+    GST_INFO ("reconfiguring port %u", port->port_index);
+
+    port->enabled = FALSE;
+
+    port_queue_disable (port);
+
+    OMX_SendCommand (core->omx_handle, OMX_CommandPortDisable, port->port_index, NULL);
+
+    if (core->state_timeout)
+    {
+        g_get_current_time (&end_time);
+        g_time_val_add (&end_time, core->state_timeout * 1000);
+        timeout = &end_time;
+    }
+
+    g_mutex_lock (port->mutex);
+    while (g_atomic_int_get (&port->in_component) > 0)
+    {
+        if (!g_cond_timed_wait (port->drained, port->mutex, timeout))
+        {
+            GST_WARNING ("component still holds %d buffers", port->in_component);
+            break;
         }
     }
+    g_mutex_unlock (port->mutex);
+
+    port_free_buffers (port);
+
+    g_omx_sem_down (core->port_sem);
+
+    /* Nothing in the queue is valid anymore. */
+    async_ring_flush (port->queue);
+
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *param;
+
+        param = calloc (1, sizeof (OMX_PARAM_PORTDEFINITIONTYPE));
+        param->nSize = sizeof (OMX_PARAM_PORTDEFINITIONTYPE);
+        param->nVersion.s.nVersionMajor = 1;
+        param->nVersion.s.nVersionMinor = 1;
+        param->nPortIndex = port->port_index;
+
+        OMX_GetParameter (core->omx_handle, OMX_IndexParamPortDefinition, param);
+        g_omx_port_setup (port, param);
+
+        free (param);
+    }
+
+    GST_INFO ("port %u: %u buffers of %lu bytes", port->port_index,
+              port->num_buffers, port->buffer_size);
+
+    port->enabled = TRUE;
+    g_omx_port_enable (port);
 }
 
 static void
-port_start_buffers (GOmxPort *port)
+buffer_ref_notify (gpointer data)
 {
-    guint i;
+    BufferRef *ref;
 
-    for (i = 0; i < port->num_buffers; i++)
+    gboolean unused = FALSE;
+
+    ref = data;
+
+    g_mutex_lock (ref->lock->mutex);
+    if (--ref->holders == 0)
     {
-        OMX_BUFFERHEADERTYPE *omx_buffer;
+        GOmxPort *port;
 
-        omx_buffer = port->buffers[i];
+        port = ref->port;
 
-        /* If it's an input port we will need to fill the buffer, so put it in
-         * the queue, otherwise send to omx for processing (fill it up). */
-        if (port->type == GOMX_PORT_INPUT)
-            got_buffer (port->core, port, omx_buffer);
+        if (!port)
+        {
+            unused = TRUE;
+        }
         else
-            g_omx_port_release_buffer (port, omx_buffer);
+        {
+            /* This runs in whatever thread dropped the last GstBuffer, so
+             * the header goes back through the queue; output_loop gives
+             * empty output buffers back to the component. */
+            if (port->type == GOMX_PORT_OUTPUT)
+            {
+                ref->omx_buffer->nFilledLen = 0;
+                ref->omx_buffer->nFlags = 0;
+            }
+            g_omx_port_push_buffer (port, ref->omx_buffer);
+        }
     }
-}
+    g_mutex_unlock (ref->lock->mutex);
 
-void
-g_omx_port_push_buffer (GOmxPort *port,
-                        OMX_BUFFERHEADERTYPE *omx_buffer)
-{
-    async_queue_push (port->queue, omx_buffer);
+    if (unused)
+        buffer_ref_free (ref);
 }
 
-OMX_BUFFERHEADERTYPE *
-g_omx_port_request_buffer (GOmxPort *port)
+/* Wrap a free buffer of a zero-copy port so the client can write into it
+ * directly. Returns NULL if there's no buffer available right now. */
+GstBuffer *
+g_omx_port_alloc_gst_buffer (GOmxPort *port,
+                             guint size)
 {
-    return async_queue_pop (port->queue);
-}
+    OMX_BUFFERHEADERTYPE *omx_buffer;
+    BufferRef *ref;
 
-void
-g_omx_port_release_buffer (GOmxPort *port,
-                           OMX_BUFFERHEADERTYPE *omx_buffer)
-{
-    switch (port->type)
+    if (!port->buffer_refs || size > port->buffer_size)
+        return NULL;
+
+    /* Don't block; the caller can fall back to a normal buffer. */
+    omx_buffer = async_ring_try_pop (port->queue);
+    if (!omx_buffer)
+        return NULL;
+
+    ref = g_hash_table_lookup (port->buffer_refs, omx_buffer->pBuffer);
+    if (G_UNLIKELY (!ref))
     {
-        case GOMX_PORT_INPUT:
-            OMX_EmptyThisBuffer (port->core->omx_handle, omx_buffer);
-            break;
-        case GOMX_PORT_OUTPUT:
-            OMX_FillThisBuffer (port->core->omx_handle, omx_buffer);
-            break;
-        default:
-            break;
+        g_omx_port_push_buffer (port, omx_buffer);
+        return NULL;
     }
-}
 
-void
-g_omx_port_resume (GOmxPort *port)
-{
-    async_queue_enable (port->queue);
-}
+    g_mutex_lock (ref->lock->mutex);
+    ref->holders++;
+    g_mutex_unlock (ref->lock->mutex);
 
-void
-g_omx_port_pause (GOmxPort *port)
-{
-    async_queue_disable (port->queue);
+    return gst_omx_buffer_new (omx_buffer->pBuffer, size, ref, buffer_ref_notify);
 }
 
-void
-g_omx_port_flush (GOmxPort *port)
+/* Get the header a GstBuffer from g_omx_port_alloc_gst_buffer wraps, so it
+ * can be released without copying. Returns NULL for any other buffer. */
+OMX_BUFFERHEADERTYPE *
+g_omx_port_claim_gst_buffer (GOmxPort *port,
+                             GstBuffer *buf)
 {
-    if (port->type == GOMX_PORT_OUTPUT)
-    {
-        OMX_BUFFERHEADERTYPE *omx_buffer;
-        while ((omx_buffer = async_queue_pop_forced (port->queue)))
-        {
-            omx_buffer->nFilledLen = 0;
-            g_omx_port_release_buffer (port, omx_buffer);
-        }
-    }
-    else
-    {
-        OMX_SendCommand (port->core->omx_handle, OMX_CommandFlush, port->port_index, NULL);
-        g_omx_sem_down (port->core->flush_sem);
-    }
+    OMX_BUFFERHEADERTYPE *omx_buffer = NULL;
+    GstOmxBuffer *omx_buf;
+    BufferRef *ref;
+
+    if (!port->buffer_refs || !GST_IS_OMX_BUFFER (buf))
+        return NULL;
+
+    omx_buf = GST_OMX_BUFFER (buf);
+    ref = g_hash_table_lookup (port->buffer_refs, GST_BUFFER_DATA (buf));
+    if (!ref || omx_buf->user_data != ref)
+        return NULL;
+
+    /* g_omx_port_release_buffer takes the component's reference. */
+    g_mutex_lock (ref->lock->mutex);
+    if (ref->port == port && !ref->in_component)
+        omx_buffer = ref->omx_buffer;
+    g_mutex_unlock (ref->lock->mutex);
+
+    return omx_buffer;
 }
 
-void
-g_omx_port_enable (GOmxPort *port)
+/* Wrap the filled data of a header of a zero-copy port; the header is
+ * recycled when the GstBuffer is finalized, so it must not be released
+ * before that. Returns NULL if the header isn't one of the port. */
+GstBuffer *
+g_omx_port_wrap_buffer (GOmxPort *port,
+                        OMX_BUFFERHEADERTYPE *omx_buffer)
 {
-    GOmxCore *core;
+    BufferRef *ref;
 
-    core = port->core;
+    if (!port->buffer_refs)
+        return NULL;
 
-    OMX_SendCommand (core->omx_handle, OMX_CommandPortEnable, port->port_index, NULL);
-    port_allocate_buffers (port);
-    if (core->omx_state != OMX_StateLoaded)
-        port_start_buffers (port);
-    g_omx_port_resume (port);
+    ref = g_hash_table_lookup (port->buffer_refs, omx_buffer->pBuffer);
+    if (G_UNLIKELY (!ref))
+        return NULL;
 
-    g_omx_sem_down (core->port_sem);
+    g_mutex_lock (ref->lock->mutex);
+    ref->holders++;
+    g_mutex_unlock (ref->lock->mutex);
+
+    return gst_omx_buffer_new (omx_buffer->pBuffer + omx_buffer->nOffset,
+                               omx_buffer->nFilledLen,
+                               ref, buffer_ref_notify);
 }
 
 void
-g_omx_port_disable (GOmxPort *port)
+g_omx_port_reset_stats (GOmxPort *port)
 {
-    GOmxCore *core;
+    g_mutex_lock (port->stats_mutex);
+    memset (&port->stats, 0, sizeof (port->stats));
+    g_mutex_unlock (port->stats_mutex);
+}
 
-    core = port->core;
+static inline void
+append_histogram (GstStructure *structure,
+                  const gchar *name,
+                  const guint *histogram)
+{
+    GValue array;
+    GValue val;
+    guint i;
 
-    OMX_SendCommand (core->omx_handle, OMX_CommandPortDisable, port->port_index, NULL);
-    g_omx_port_pause (port);
-    g_omx_port_flush (port);
-    port_free_buffers (port);
+    array.g_type = val.g_type = 0;
 
-    g_omx_sem_down (core->port_sem);
+    g_value_init (&array, GST_TYPE_ARRAY);
+    g_value_init (&val, G_TYPE_UINT);
+
+    for (i = 0; i < GOMX_PORT_STATS_BUCKETS; i++)
+    {
+        g_value_set_uint (&val, histogram[i]);
+        gst_value_array_append_value (&array, &val);
+    }
+
+    gst_structure_set_value (structure, name, &array);
+
+    g_value_unset (&val);
+    g_value_unset (&array);
 }
 
 void
-g_omx_port_finish (GOmxPort *port)
+g_omx_port_append_stats (GOmxPort *port,
+                         GstStructure *structure,
+                         const gchar *prefix)
 {
-    port->enabled = FALSE;
-    async_queue_disable (port->queue);
+    GOmxPortStats stats;
+    gchar *name;
+
+    g_mutex_lock (port->stats_mutex);
+    stats = port->stats;
+    g_mutex_unlock (port->stats_mutex);
+
+#define SET_FIELD(field, type, value) \
+    name = g_strdup_printf ("%s-%s", prefix, field); \
+    gst_structure_set (structure, name, type, value, NULL); \
+    g_free (name)
+
+    SET_FIELD ("released", G_TYPE_UINT64, stats.released);
+    SET_FIELD ("returned", G_TYPE_UINT64, stats.returned);
+    SET_FIELD ("requested", G_TYPE_UINT64, stats.requested);
+    SET_FIELD ("starved", G_TYPE_UINT64, stats.starved);
+    SET_FIELD ("residency-mean", G_TYPE_UINT64,
+               stats.returned ? stats.residency_sum / stats.returned : 0);
+    SET_FIELD ("residency-max", G_TYPE_UINT64, stats.residency_max);
+
+#undef SET_FIELD
+
+    name = g_strdup_printf ("%s-residency-histogram", prefix);
+    append_histogram (structure, name, stats.residency);
+    g_free (name);
+
+    name = g_strdup_printf ("%s-occupancy-histogram", prefix);
+    append_histogram (structure, name, stats.occupancy);
+    g_free (name);
 }
 
 /*
@@ -675,6 +2159,31 @@ g_omx_sem_down (GOmxSem *sem)
     g_mutex_unlock (sem->mutex);
 }
 
+gboolean
+g_omx_sem_down_timed (GOmxSem *sem,
+                      GTimeVal *end_time)
+{
+    gboolean ret = TRUE;
+
+    g_mutex_lock (sem->mutex);
+
+    while (sem->counter == 0)
+    {
+        if (!g_cond_timed_wait (sem->condition, sem->mutex, end_time))
+        {
+            ret = FALSE;
+            break;
+        }
+    }
+
+    if (ret)
+        sem->counter--;
+
+    g_mutex_unlock (sem->mutex);
+
+    return ret;
+}
+
 void
 g_omx_sem_up (GOmxSem *sem)
 {
@@ -691,12 +2200,33 @@ g_omx_sem_up (GOmxSem *sem)
  */
 
 static inline void
-change_state (GOmxCore *core,
-              OMX_STATETYPE state)
+send_state (GOmxCore *core,
+            OMX_STATETYPE state)
 {
+    OMX_STATETYPE current;
+
+    current = core->omx_state;
+
+    /* The dispatcher is sized for the ports, which are known by now. */
+    if (core->use_dispatcher && current == OMX_StateLoaded && state == OMX_StateIdle)
+    {
+        if (core->dispatcher)
+            dispatcher_stop (core);
+        dispatcher_start (core);
+    }
+
+    G_OMX_TRACE (G_OMX_TRACE_INSTANT, "StateSet", core, GINT_TO_POINTER (state));
     OMX_SendCommand (core->omx_handle, OMX_CommandStateSet, state, NULL);
+
+    /* These transitions don't complete until the buffers are provided, or
+     * taken back. */
+    if (current == OMX_StateLoaded && state == OMX_StateIdle)
+        core_for_each_port (core, port_allocate_buffers);
+    else if (current == OMX_StateIdle && state == OMX_StateLoaded)
+        core_for_each_port (core, port_free_buffers);
 }
 
+/* The state thread sends whatever is queued next. */
 static inline void
 complete_change_state (GOmxCore *core,
                        OMX_STATETYPE state)
@@ -704,23 +2234,44 @@ complete_change_state (GOmxCore *core,
     g_mutex_lock (core->omx_state_mutex);
 
     core->omx_state = state;
-    g_cond_signal (core->omx_state_condition);
+
+    g_cond_broadcast (core->omx_state_condition);
 
     g_mutex_unlock (core->omx_state_mutex);
 }
 
+/* Whatever was queued won't make sense anymore; with omx_state_mutex. */
+static inline void
+fail_state_changes (GOmxCore *core,
+                    OMX_ERRORTYPE error)
+{
+    core->omx_error = error;
+    core->pending_state = OMX_StateMax;
+    while (!g_queue_is_empty (core->state_queue))
+        g_queue_pop_head (core->state_queue);
+
+    g_cond_broadcast (core->omx_state_condition);
+}
+
 static inline void
-wait_for_state (GOmxCore *core,
-                OMX_STATETYPE state)
+report_error (GOmxCore *core,
+              OMX_ERRORTYPE error)
 {
+    gboolean in_transition;
+
+    GST_ERROR ("component error: 0x%08x", error);
+
     g_mutex_lock (core->omx_state_mutex);
 
-    while (core->omx_state != state)
-    {
-        g_cond_wait (core->omx_state_condition, core->omx_state_mutex);
-    }
+    /* A failed transition is reported by the state thread. */
+    in_transition = (core->pending_state != OMX_StateMax);
+    core->component_error = error;
+    fail_state_changes (core, error);
 
     g_mutex_unlock (core->omx_state_mutex);
+
+    if (!in_transition && core->state_changed_cb)
+        core->state_changed_cb (core, core->omx_state, error);
 }
 
 /*
@@ -767,7 +2318,38 @@ got_buffer (GOmxCore *core,
 
     if (G_LIKELY (port))
     {
-        g_omx_port_push_buffer (port, omx_buffer);
+        gboolean done = TRUE;
+
+        stats_return (port, omx_buffer);
+
+        if (g_atomic_int_dec_and_test (&port->in_component))
+        {
+            g_mutex_lock (port->mutex);
+            g_cond_broadcast (port->drained);
+            g_mutex_unlock (port->mutex);
+        }
+
+        if (port->buffer_refs)
+        {
+            BufferRef *ref;
+
+            ref = g_hash_table_lookup (port->buffer_refs, omx_buffer->pBuffer);
+
+            if (G_LIKELY (ref))
+            {
+                g_mutex_lock (ref->lock->mutex);
+                if (ref->in_component)
+                {
+                    ref->in_component = FALSE;
+                    ref->holders--;
+                }
+                done = (ref->holders == 0);
+                g_mutex_unlock (ref->lock->mutex);
+            }
+        }
+
+        if (done)
+            g_omx_port_push_buffer (port, omx_buffer);
 
         switch (port->type)
         {
@@ -787,18 +2369,12 @@ got_buffer (GOmxCore *core,
  * OpenMAX IL callbacks.
  */
 
-static OMX_ERRORTYPE
-EventHandler (OMX_HANDLETYPE omx_handle,
-              OMX_PTR app_data,
+static void
+handle_event (GOmxCore *core,
               OMX_EVENTTYPE event,
               OMX_U32 data_1,
-              OMX_U32 data_2,
-              OMX_PTR event_data)
+              OMX_U32 data_2)
 {
-    GOmxCore *core;
-
-    core = (GOmxCore *) app_data;
-
     switch (event)
     {
         case OMX_EventCmdComplete:
@@ -810,9 +2386,11 @@ EventHandler (OMX_HANDLETYPE omx_handle,
                 switch (cmd)
                 {
                     case OMX_CommandStateSet:
+                        G_OMX_TRACE (G_OMX_TRACE_INSTANT, "StateSet complete", core, GUINT_TO_POINTER (data_2));
                         complete_change_state (core, data_2);
                         break;
                     case OMX_CommandFlush:
+                        G_OMX_TRACE (G_OMX_TRACE_INSTANT, "Flush complete", core, GUINT_TO_POINTER (data_2));
                         g_omx_sem_up (core->flush_sem);
                         break;
                     case OMX_CommandPortDisable:
@@ -831,9 +2409,27 @@ EventHandler (OMX_HANDLETYPE omx_handle,
                 }
                 break;
             }
+        case OMX_EventError:
+            {
+                report_error (core, (OMX_ERRORTYPE) data_1);
+                break;
+            }
         case OMX_EventPortSettingsChanged:
             {
-                /** @todo only on the relevant port. */
+                GOmxPort *port;
+
+                port = g_omx_core_get_port (core, data_1);
+
+                /* The buffers have to be replaced, but not from here; the
+                 * client gets settings_changed_cb once that is done. */
+                if (port && port->reconfigurable &&
+                    core->omx_state != OMX_StateLoaded)
+                {
+                    g_atomic_int_set (&port->settings_changed, TRUE);
+                    port_queue_disable (port);
+                    break;
+                }
+
                 if (core->settings_changed_cb)
                 {
                     core->settings_changed_cb (core);
@@ -842,6 +2438,191 @@ EventHandler (OMX_HANDLETYPE omx_handle,
         default:
             break;
     }
+}
+
+static void
+handle_buffer_done (GOmxCore *core,
+                    guint port_index,
+                    OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    GOmxPort *port;
+
+    port = g_omx_core_get_port (core, port_index);
+
+    GST_LOG ("omx_buffer=%p", omx_buffer);
+    got_buffer (core, port, omx_buffer);
+}
+
+static gpointer
+dispatcher_thread (gpointer data)
+{
+    GOmxCore *core;
+    CoreEvent *core_event;
+
+    core = data;
+
+    while ((core_event = async_ring_pop (core->events)))
+    {
+        if (core_event->omx_buffer)
+            handle_buffer_done (core, core_event->data_1, core_event->omx_buffer);
+        else
+            handle_event (core, core_event->event, core_event->data_1, core_event->data_2);
+
+        async_ring_push (core->free_events, core_event);
+    }
+
+    return NULL;
+}
+
+/* Events come from a pool with room for every buffer of the ports, so
+ * callbacks only wait for the dispatcher when a port got more buffers
+ * later on. */
+static void
+dispatcher_start (GOmxCore *core)
+{
+    CoreEvent *pool;
+    guint count = DISPATCH_EVENT_HEADROOM;
+    guint index;
+
+    for (index = 0; index < core->ports->len; index++)
+    {
+        GOmxPort *port;
+
+        port = g_omx_core_get_port (core, index);
+
+        if (port)
+            count += port->num_buffers;
+    }
+
+    pool = g_new (CoreEvent, count);
+    core->event_pool = pool;
+    core->free_events = async_ring_new (count);
+    for (index = 0; index < count; index++)
+        async_ring_push (core->free_events, &pool[index]);
+
+    g_mutex_lock (core->dispatch_mutex);
+    core->events = async_ring_new (count);
+    g_mutex_unlock (core->dispatch_mutex);
+
+    core->dispatcher = g_thread_create (dispatcher_thread, core, TRUE, NULL);
+}
+
+static void
+dispatcher_stop (GOmxCore *core)
+{
+    CoreEvent *core_event;
+
+    /* New callbacks wait; the ones under way get their events queued. */
+    g_mutex_lock (core->dispatch_mutex);
+    core->dispatch_stopping = TRUE;
+    core->dispatch_drainer = g_thread_self ();
+    while (core->dispatch_users > 0)
+        g_cond_wait (core->dispatch_cond, core->dispatch_mutex);
+    g_mutex_unlock (core->dispatch_mutex);
+
+    async_ring_disable (core->events);
+    g_thread_join (core->dispatcher);
+    core->dispatcher = NULL;
+
+    /* Whatever is left still has to be seen, or waiters would hang; the
+     * callbacks that waited are handled after it, in order. */
+    while ((core_event = async_ring_pop_forced (core->events)))
+    {
+        if (core_event->omx_buffer)
+            handle_buffer_done (core, core_event->data_1, core_event->omx_buffer);
+        else
+            handle_event (core, core_event->event, core_event->data_1, core_event->data_2);
+    }
+
+    g_mutex_lock (core->dispatch_mutex);
+
+    async_ring_free (core->events);
+    core->events = NULL;
+    async_ring_free (core->free_events);
+    core->free_events = NULL;
+    g_free (core->event_pool);
+    core->event_pool = NULL;
+
+    core->dispatch_stopping = FALSE;
+    core->dispatch_drainer = NULL;
+    g_cond_broadcast (core->dispatch_cond);
+
+    g_mutex_unlock (core->dispatch_mutex);
+}
+
+/* Returns FALSE if the callback has to be handled right away. */
+static inline gboolean
+dispatch (GOmxCore *core,
+          OMX_EVENTTYPE event,
+          OMX_U32 data_1,
+          OMX_U32 data_2,
+          OMX_BUFFERHEADERTYPE *omx_buffer)
+{
+    CoreEvent *core_event;
+    GThread *self;
+
+    self = g_thread_self ();
+
+    g_mutex_lock (core->dispatch_mutex);
+
+    /* Called back from within a call the dispatcher made. */
+    if (self == core->dispatcher || self == core->dispatch_drainer)
+    {
+        g_mutex_unlock (core->dispatch_mutex);
+        return FALSE;
+    }
+
+    while (core->dispatch_stopping)
+        g_cond_wait (core->dispatch_cond, core->dispatch_mutex);
+
+    if (!core->events)
+    {
+        g_mutex_unlock (core->dispatch_mutex);
+        return FALSE;
+    }
+
+    /* Keeps the rings from being freed under us. */
+    core->dispatch_users++;
+    g_mutex_unlock (core->dispatch_mutex);
+
+    /* Waits while every event is in use. */
+    core_event = async_ring_pop (core->free_events);
+    if (G_LIKELY (core_event))
+    {
+        core_event->event = event;
+        core_event->data_1 = data_1;
+        core_event->data_2 = data_2;
+        core_event->omx_buffer = omx_buffer;
+
+        /* events has room for the whole pool. */
+        async_ring_push (core->events, core_event);
+    }
+
+    g_mutex_lock (core->dispatch_mutex);
+    if (--core->dispatch_users == 0)
+        g_cond_broadcast (core->dispatch_cond);
+    g_mutex_unlock (core->dispatch_mutex);
+
+    return core_event != NULL;
+}
+
+static OMX_ERRORTYPE
+EventHandler (OMX_HANDLETYPE omx_handle,
+              OMX_PTR app_data,
+              OMX_EVENTTYPE event,
+              OMX_U32 data_1,
+              OMX_U32 data_2,
+              OMX_PTR event_data)
+{
+    GOmxCore *core;
+
+    core = ((GOmxHandle *) app_data)->core;
+
+    if (G_UNLIKELY (!core))
+        return OMX_ErrorNone;
+
+    if (!dispatch (core, event, data_1, data_2, NULL))
+        handle_event (core, event, data_1, data_2);
 
     return OMX_ErrorNone;
 }
@@ -852,13 +2633,16 @@ EmptyBufferDone (OMX_HANDLETYPE omx_handle,
                  OMX_BUFFERHEADERTYPE *omx_buffer)
 {
     GOmxCore *core;
-    GOmxPort *port;
 
-    core = (GOmxCore*) app_data;
-    port = g_omx_core_get_port (core, omx_buffer->nInputPortIndex);
+    core = ((GOmxHandle *) app_data)->core;
 
-    GST_LOG ("omx_buffer=%p", omx_buffer);
-    got_buffer (core, port, omx_buffer);
+    if (G_UNLIKELY (!core))
+        return OMX_ErrorNone;
+
+    G_OMX_TRACE (G_OMX_TRACE_INSTANT, "EmptyBufferDone", core, omx_buffer);
+
+    if (!dispatch (core, 0, omx_buffer->nInputPortIndex, 0, omx_buffer))
+        handle_buffer_done (core, omx_buffer->nInputPortIndex, omx_buffer);
 
     return OMX_ErrorNone;
 }
@@ -869,13 +2653,16 @@ FillBufferDone (OMX_HANDLETYPE omx_handle,
                 OMX_BUFFERHEADERTYPE *omx_buffer)
 {
     GOmxCore *core;
-    GOmxPort *port;
 
-    core = (GOmxCore *) app_data;
-    port = g_omx_core_get_port (core, omx_buffer->nOutputPortIndex);
+    core = ((GOmxHandle *) app_data)->core;
 
-    GST_LOG ("omx_buffer=%p", omx_buffer);
-    got_buffer (core, port, omx_buffer);
+    if (G_UNLIKELY (!core))
+        return OMX_ErrorNone;
+
+    G_OMX_TRACE (G_OMX_TRACE_INSTANT, "FillBufferDone", core, omx_buffer);
+
+    if (!dispatch (core, 0, omx_buffer->nOutputPortIndex, 0, omx_buffer))
+        handle_buffer_done (core, omx_buffer->nOutputPortIndex, omx_buffer);
 
     return OMX_ErrorNone;
 }
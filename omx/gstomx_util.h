@@ -25,10 +25,11 @@
 
 #include <stdbool.h>
 #include <glib.h>
+#include <gst/gst.h>
 #include <OMX_Core.h>
 #include <OMX_Component.h>
 
-#include <async_queue.h>
+#include <async_ring.h>
 
 /* Typedefs. */
 
@@ -37,10 +38,15 @@ typedef struct GOmxPort GOmxPort;
 typedef struct GOmxSem GOmxSem;
 typedef struct GOmxImp GOmxImp;
 typedef struct GOmxSymbolTable GOmxSymbolTable;
+typedef struct GOmxHandle GOmxHandle;
+typedef struct GOmxPortStats GOmxPortStats;
+typedef struct GOmxBufferData GOmxBufferData;
 typedef enum GOmxPortType GOmxPortType;
 
 typedef void (*GOmxCb) (GOmxCore *core);
+typedef void (*GOmxStateCb) (GOmxCore *core, OMX_STATETYPE state, OMX_ERRORTYPE error);
 typedef void (*GOmxPortCb) (GOmxPort *port);
+typedef GstBuffer *(*GOmxPortAllocCb) (GOmxPort *port, guint size);
 
 /* Enums. */
 
@@ -52,6 +58,8 @@ enum GOmxPortType
 
 /* Structures. */
 
+#define GOMX_PORT_STATS_BUCKETS 16
+
 struct GOmxSymbolTable
 {
     OMX_ERRORTYPE (*init) (void);
@@ -73,12 +81,21 @@ struct GOmxImp
 struct GOmxCore
 {
     OMX_HANDLETYPE omx_handle;
-    OMX_ERRORTYPE omx_error;
+    GOmxHandle *handle; /**< What the callbacks of omx_handle get. */
+    OMX_ERRORTYPE omx_error; /**< Of the last state change; cleared when a new one starts. */
+    OMX_ERRORTYPE component_error; /**< Reported by the component; kept until deinit. */
 
     OMX_STATETYPE omx_state;
     GCond *omx_state_condition;
     GMutex *omx_state_mutex;
 
+    OMX_STATETYPE pending_state; /**< Sent but not completed; OMX_StateMax if none. */
+    GQueue *state_queue; /**< States to go through after pending_state. */
+    GThread *state_thread; /**< Sends the queued states. */
+    gboolean state_thread_quit;
+    guint state_timeout; /**< In milliseconds; 0 waits forever. */
+    GOmxStateCb state_changed_cb; /**< Called from state_thread on completion and failure; on other errors from the callback. */
+
     GPtrArray *ports;
 
     gpointer client_data; /**< Placeholder for the client data. */
@@ -91,6 +108,36 @@ struct GOmxCore
     GOmxImp *imp;
 
     gboolean done;
+
+    gboolean use_dispatcher; /**< Handle callbacks in our own thread. */
+    AsyncRing *events;
+    AsyncRing *free_events; /**< Unused entries of event_pool. */
+    gpointer event_pool;
+    GThread *dispatcher;
+    GMutex *dispatch_mutex; /**< Guards events and the fields below. */
+    GCond *dispatch_cond;
+    guint dispatch_users; /**< Callbacks between checking events and queueing theirs. */
+    gboolean dispatch_stopping; /**< Callbacks wait until what's queued has been handled. */
+    GThread *dispatch_drainer; /**< Handles what's left while stopping. */
+
+    guint priority; /**< OMX group priority; 0 is the highest. */
+    guint admission_timeout; /**< In milliseconds; 0 fails at once when no session is left. */
+    gpointer session; /**< Set while the core holds a limited session. */
+    gboolean preempted;
+    gboolean preempt_reporting; /**< The preemption is being reported; the session isn't released meanwhile. */
+};
+
+/* Updated with the stats_mutex of the port held. */
+struct GOmxPortStats
+{
+    guint64 released; /**< Buffers sent to the component. */
+    guint64 returned; /**< Buffers given back by the component. */
+    guint64 requested; /**< Buffers requested by the client. */
+    guint64 starved; /**< Requests that found no buffer available. */
+    guint64 residency_sum; /**< Microseconds spent in the component. */
+    guint64 residency_max;
+    guint residency[GOMX_PORT_STATS_BUCKETS]; /**< Bucket n counts [2^n, 2^(n+1)) us. */
+    guint occupancy[GOMX_PORT_STATS_BUCKETS]; /**< Available buffers on request. */
 };
 
 struct GOmxPort
@@ -105,9 +152,32 @@ struct GOmxPort
 
     GMutex *mutex;
     gboolean enabled;
-    AsyncQueue *queue;
+    AsyncRing *queue; /**< Only replaced with mutex held. */
+    gboolean paused; /**< Between g_omx_port_pause and g_omx_port_resume; with mutex. */
+
+    volatile gint in_component; /**< Buffers the component holds right now. */
+    GCond *drained; /**< Signalled, with mutex, when in_component drops to 0. */
+    gboolean reconfigurable; /**< The client calls g_omx_port_reconfigure on settings changes. */
+    volatile gint settings_changed;
+
+    GOmxPortStats stats;
+    GMutex *stats_mutex;
+
+    gboolean zero_copy; /**< Let GstBuffers point directly at the buffers of the port. */
+    GOmxPortAllocCb alloc_cb; /**< Optionally provides the memory of zero-copy ports. */
+    GHashTable *buffer_refs;
+    gpointer buffer_refs_lock; /**< Shared with the GstBuffers wrapping its headers. */
+};
+
+/* The pAppPrivate of every header of a port points to one of these. */
+struct GOmxBufferData
+{
+    gpointer client_data; /**< Free for the client to use. */
+    guint64 release_time; /**< In microseconds; 0 unless the component has it. */
 };
 
+#define G_OMX_BUFFER_DATA(omx_buffer) ((GOmxBufferData *) (omx_buffer)->pAppPrivate)
+
 struct GOmxSem
 {
     GCond *condition;
@@ -119,17 +189,22 @@ struct GOmxSem
 
 void g_omx_init (void);
 void g_omx_deinit (void);
+void g_omx_set_handle_pool_size (guint size);
+void g_omx_set_session_limit (const gchar *component_name, guint limit);
 
 GOmxCore *g_omx_core_new (void);
 void g_omx_core_free (GOmxCore *core);
 void g_omx_core_init (GOmxCore *core, const gchar *library_name, const gchar *component_name);
 void g_omx_core_deinit (GOmxCore *core);
+void g_omx_core_set_state_async (GOmxCore *core, OMX_STATETYPE state);
+OMX_ERRORTYPE g_omx_core_wait_for_state (GOmxCore *core, OMX_STATETYPE state);
 void g_omx_core_prepare (GOmxCore *core);
 void g_omx_core_start (GOmxCore *core);
 void g_omx_core_pause (GOmxCore *core);
 void g_omx_core_finish (GOmxCore *core);
 void g_omx_core_set_done (GOmxCore *core);
 void g_omx_core_wait_for_done (GOmxCore *core);
+gboolean g_omx_core_wait_for_done_timed (GOmxCore *core, GTimeVal *end_time);
 void g_omx_core_flush_start (GOmxCore *core);
 void g_omx_core_flush_stop (GOmxCore *core);
 GOmxPort *g_omx_core_setup_port (GOmxCore *core, OMX_PARAM_PORTDEFINITIONTYPE *omx_port);
@@ -139,17 +214,27 @@ void g_omx_port_free (GOmxPort *port);
 void g_omx_port_setup (GOmxPort *port, OMX_PARAM_PORTDEFINITIONTYPE *omx_port);
 void g_omx_port_push_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer);
 OMX_BUFFERHEADERTYPE *g_omx_port_request_buffer (GOmxPort *port);
+OMX_BUFFERHEADERTYPE *g_omx_port_request_buffer_timed (GOmxPort *port, GTimeVal *end_time);
 void g_omx_port_release_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer);
+guint g_omx_port_request_buffers (GOmxPort *port, OMX_BUFFERHEADERTYPE **omx_buffers, guint count);
+void g_omx_port_release_buffers (GOmxPort *port, OMX_BUFFERHEADERTYPE **omx_buffers, guint count);
 void g_omx_port_resume (GOmxPort *port);
 void g_omx_port_pause (GOmxPort *port);
 void g_omx_port_flush (GOmxPort *port);
 void g_omx_port_enable (GOmxPort *port);
 void g_omx_port_disable (GOmxPort *port);
 void g_omx_port_finish (GOmxPort *port);
+void g_omx_port_reconfigure (GOmxPort *port);
+GstBuffer *g_omx_port_alloc_gst_buffer (GOmxPort *port, guint size);
+OMX_BUFFERHEADERTYPE *g_omx_port_claim_gst_buffer (GOmxPort *port, GstBuffer *buf);
+GstBuffer *g_omx_port_wrap_buffer (GOmxPort *port, OMX_BUFFERHEADERTYPE *omx_buffer);
+void g_omx_port_reset_stats (GOmxPort *port);
+void g_omx_port_append_stats (GOmxPort *port, GstStructure *structure, const gchar *prefix);
 
 GOmxSem *g_omx_sem_new (void);
 void g_omx_sem_free (GOmxSem *sem);
 void g_omx_sem_down (GOmxSem *sem);
+gboolean g_omx_sem_down_timed (GOmxSem *sem, GTimeVal *end_time);
 void g_omx_sem_up (GOmxSem *sem);
 
 #endif /* GSTOMX_UTIL_H */
@@ -93,6 +93,9 @@ type_instance_init (GTypeInstance *instance,
 
     omx_base_filter->omx_component = g_strdup (OMX_COMPONENT_NAME);
     omx_base->compression_format = OMX_VIDEO_CodingWMV;
+
+    /* B-frames come out reordered. */
+    omx_base_filter->timestamps = gst_omx_timestamps_new ();
 }
 
 GType
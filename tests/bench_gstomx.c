@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2007-2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Pushes buffers through an omx element, normally omx_dummy on top of the
+ * mock component in standalone/, and prints one JSON object per run. The
+ * mock is configured through OMX_MOCK_* (see standalone/mock_config.h). */
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <stdlib.h> /* For qsort */
+#include <sys/resource.h> /* For getrusage */
+
+typedef struct Instance Instance;
+
+struct Instance
+{
+    GstElement *filter;
+    GstPad *srcpad;
+    GstPad *sinkpad;
+    GThread *thread;
+
+    guint64 *sent; /**< Push time of every buffer, in microseconds. */
+    guint64 *latency;
+    guint received;
+    gboolean eos;
+    GMutex *mutex;
+    GCond *cond;
+};
+
+static gchar *element_name = "omx_dummy";
+static gchar *library_name = "libomxil-foo.so";
+static gint buffer_count = 1000;
+static gint buffer_size = 0x1000;
+static gint instance_count = 1;
+static gint in_buffers = 0;
+static gint out_buffers = 0;
+static gboolean zero_copy_input;
+static gboolean zero_copy_output;
+static gint timeout = 30;
+
+static GOptionEntry entries[] =
+{
+    { "element", 'e', 0, G_OPTION_ARG_STRING, &element_name, "Element to benchmark", "NAME" },
+    { "library", 'l', 0, G_OPTION_ARG_STRING, &library_name, "OpenMAX IL library", "FILE" },
+    { "buffers", 'n', 0, G_OPTION_ARG_INT, &buffer_count, "Buffers per instance", "N" },
+    { "size", 's', 0, G_OPTION_ARG_INT, &buffer_size, "Buffer size in bytes", "BYTES" },
+    { "instances", 'i', 0, G_OPTION_ARG_INT, &instance_count, "Concurrent instances", "N" },
+    { "in-buffers", 0, 0, G_OPTION_ARG_INT, &in_buffers, "Input port buffer count (mock)", "N" },
+    { "out-buffers", 0, 0, G_OPTION_ARG_INT, &out_buffers, "Output port buffer count (mock)", "N" },
+    { "zero-copy-input", 0, 0, G_OPTION_ARG_NONE, &zero_copy_input, "Allocate input from the omx buffers", NULL },
+    { "zero-copy-output", 0, 0, G_OPTION_ARG_NONE, &zero_copy_output, "Push the omx buffers downstream", NULL },
+    { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout, "Seconds to wait for every run", "S" },
+    { NULL }
+};
+
+static GstStaticPadTemplate src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+                         GST_PAD_SRC,
+                         GST_PAD_ALWAYS,
+                         GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+                         GST_PAD_SINK,
+                         GST_PAD_ALWAYS,
+                         GST_STATIC_CAPS_ANY);
+
+/* Microseconds, from a monotonic clock. */
+static inline guint64
+now (void)
+{
+    return gst_util_get_timestamp () / GST_USECOND;
+}
+
+static inline gdouble
+cpu_time (const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static GstFlowReturn
+sink_chain (GstPad *pad,
+            GstBuffer *buf)
+{
+    Instance *instance;
+    guint64 index;
+
+    instance = gst_pad_get_element_private (pad);
+
+    /* The timestamp carries the index of the buffer. */
+    index = GST_BUFFER_TIMESTAMP (buf) / GST_MSECOND;
+
+    g_mutex_lock (instance->mutex);
+    if (index < (guint64) buffer_count && instance->latency[index] == 0)
+    {
+        instance->latency[index] = MAX (now () - instance->sent[index], 1);
+        instance->received++;
+    }
+    g_mutex_unlock (instance->mutex);
+
+    gst_buffer_unref (buf);
+
+    return GST_FLOW_OK;
+}
+
+static gboolean
+sink_event (GstPad *pad,
+            GstEvent *event)
+{
+    Instance *instance;
+
+    instance = gst_pad_get_element_private (pad);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_EOS)
+    {
+        g_mutex_lock (instance->mutex);
+        instance->eos = TRUE;
+        g_cond_signal (instance->cond);
+        g_mutex_unlock (instance->mutex);
+    }
+
+    gst_event_unref (event);
+
+    return TRUE;
+}
+
+static gpointer
+push_thread (gpointer data)
+{
+    Instance *instance;
+    gint i;
+
+    instance = data;
+
+    for (i = 0; i < buffer_count; i++)
+    {
+        GstBuffer *buf = NULL;
+
+        /* Goes through pad_buffer_alloc, so zero-copy input applies. */
+        if (gst_pad_alloc_buffer (instance->srcpad, GST_BUFFER_OFFSET_NONE,
+                                  buffer_size, NULL, &buf) != GST_FLOW_OK || !buf)
+        {
+            buf = gst_buffer_new_and_alloc (buffer_size);
+        }
+
+        GST_BUFFER_TIMESTAMP (buf) = i * GST_MSECOND;
+        GST_BUFFER_DURATION (buf) = GST_MSECOND;
+
+        instance->sent[i] = now ();
+
+        if (gst_pad_push (instance->srcpad, buf) != GST_FLOW_OK)
+            break;
+    }
+
+    gst_pad_push_event (instance->srcpad, gst_event_new_eos ());
+
+    return NULL;
+}
+
+static Instance *
+instance_new (void)
+{
+    Instance *instance;
+
+    instance = g_new0 (Instance, 1);
+
+    instance->filter = gst_element_factory_make (element_name, NULL);
+    if (!instance->filter)
+    {
+        g_printerr ("couldn't create %s\n", element_name);
+        exit (1);
+    }
+
+    g_object_set (G_OBJECT (instance->filter),
+                  "library-name", library_name,
+                  "zero-copy-input", zero_copy_input,
+                  "zero-copy-output", zero_copy_output,
+                  NULL);
+
+    instance->sent = g_new0 (guint64, buffer_count);
+    instance->latency = g_new0 (guint64, buffer_count);
+    instance->mutex = g_mutex_new ();
+    instance->cond = g_cond_new ();
+
+    instance->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+    instance->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+    gst_pad_set_element_private (instance->sinkpad, instance);
+    gst_pad_set_chain_function (instance->sinkpad, sink_chain);
+    gst_pad_set_event_function (instance->sinkpad, sink_event);
+
+    {
+        GstPad *pad;
+
+        pad = gst_element_get_static_pad (instance->filter, "sink");
+        gst_pad_link (instance->srcpad, pad);
+        gst_object_unref (pad);
+
+        pad = gst_element_get_static_pad (instance->filter, "src");
+        gst_pad_link (pad, instance->sinkpad);
+        gst_object_unref (pad);
+    }
+
+    gst_pad_set_active (instance->srcpad, TRUE);
+    gst_pad_set_active (instance->sinkpad, TRUE);
+
+    return instance;
+}
+
+static void
+instance_free (Instance *instance)
+{
+    gst_element_set_state (instance->filter, GST_STATE_NULL);
+
+    gst_pad_set_active (instance->srcpad, FALSE);
+    gst_pad_set_active (instance->sinkpad, FALSE);
+    gst_object_unref (instance->srcpad);
+    gst_object_unref (instance->sinkpad);
+    gst_object_unref (instance->filter);
+
+    g_cond_free (instance->cond);
+    g_mutex_free (instance->mutex);
+    g_free (instance->latency);
+    g_free (instance->sent);
+    g_free (instance);
+}
+
+static int
+compare_guint64 (const void *a,
+                 const void *b)
+{
+    guint64 x = *(const guint64 *) a;
+    guint64 y = *(const guint64 *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static inline guint64
+percentile (const guint64 *sorted,
+            guint count,
+            guint p)
+{
+    if (count == 0)
+        return 0;
+
+    return sorted[MIN (count - 1, (count * p) / 100)];
+}
+
+int
+main (int argc,
+      char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    Instance **instances;
+    guint64 *latencies;
+    guint received = 0;
+    guint64 start, elapsed;
+    struct rusage usage_start, usage_end;
+    gint i;
+
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+
+    context = g_option_context_new ("- benchmark the omx data path");
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_add_group (context, gst_init_get_option_group ());
+
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+        g_printerr ("%s\n", error->message);
+        return 1;
+    }
+
+    g_option_context_free (context);
+
+    /* Only the mock component looks at these. */
+    {
+        gchar tmp[16];
+
+        g_snprintf (tmp, sizeof (tmp), "%d", buffer_size);
+        g_setenv ("OMX_MOCK_IN_BUFFER_SIZE", tmp, FALSE);
+        g_setenv ("OMX_MOCK_OUT_BUFFER_SIZE", tmp, FALSE);
+
+        if (in_buffers > 0)
+        {
+            g_snprintf (tmp, sizeof (tmp), "%d", in_buffers);
+            g_setenv ("OMX_MOCK_IN_BUFFER_COUNT", tmp, TRUE);
+        }
+
+        if (out_buffers > 0)
+        {
+            g_snprintf (tmp, sizeof (tmp), "%d", out_buffers);
+            g_setenv ("OMX_MOCK_OUT_BUFFER_COUNT", tmp, TRUE);
+        }
+    }
+
+    instances = g_new0 (Instance *, instance_count);
+
+    for (i = 0; i < instance_count; i++)
+    {
+        instances[i] = instance_new ();
+
+        if (gst_element_set_state (instances[i]->filter, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        {
+            g_printerr ("couldn't start %s\n", element_name);
+            return 1;
+        }
+    }
+
+    getrusage (RUSAGE_SELF, &usage_start);
+    start = now ();
+
+    for (i = 0; i < instance_count; i++)
+        instances[i]->thread = g_thread_create (push_thread, instances[i], TRUE, NULL);
+
+    for (i = 0; i < instance_count; i++)
+    {
+        Instance *instance;
+        GTimeVal end_time;
+        gboolean finished = TRUE;
+
+        instance = instances[i];
+
+        g_get_current_time (&end_time);
+        g_time_val_add (&end_time, timeout * G_USEC_PER_SEC);
+
+        g_mutex_lock (instance->mutex);
+        while (!instance->eos && instance->received < (guint) buffer_count)
+        {
+            if (!g_cond_timed_wait (instance->cond, instance->mutex, &end_time))
+            {
+                finished = FALSE;
+                break;
+            }
+        }
+        g_mutex_unlock (instance->mutex);
+
+        /* The push thread may be stuck in a stalled element; shutting the
+         * element down flushes it out. */
+        if (!finished)
+        {
+            g_printerr ("instance %d timed out\n", i);
+            gst_element_set_state (instance->filter, GST_STATE_NULL);
+        }
+
+        g_thread_join (instance->thread);
+    }
+
+    elapsed = now () - start;
+    getrusage (RUSAGE_SELF, &usage_end);
+
+    latencies = g_new (guint64, buffer_count * instance_count);
+
+    for (i = 0; i < instance_count; i++)
+    {
+        gint j;
+
+        g_mutex_lock (instances[i]->mutex);
+        for (j = 0; j < buffer_count; j++)
+        {
+            if (instances[i]->latency[j])
+                latencies[received++] = instances[i]->latency[j];
+        }
+        g_mutex_unlock (instances[i]->mutex);
+
+        instance_free (instances[i]);
+    }
+
+    qsort (latencies, received, sizeof (guint64), compare_guint64);
+
+    {
+        gdouble seconds;
+
+        seconds = MAX (elapsed, 1) / (gdouble) G_USEC_PER_SEC;
+
+        printf ("{\"element\": \"%s\", \"instances\": %d, \"buffers\": %d, \"size\": %d, "
+                "\"in_buffers\": %d, \"out_buffers\": %d, "
+                "\"zero_copy_input\": %s, \"zero_copy_output\": %s, "
+                "\"received\": %u, \"seconds\": %.6f, "
+                "\"buffers_per_second\": %.1f, \"mb_per_second\": %.3f, "
+                "\"latency_us\": {\"p50\": %" G_GUINT64_FORMAT ", \"p90\": %" G_GUINT64_FORMAT
+                ", \"p99\": %" G_GUINT64_FORMAT ", \"max\": %" G_GUINT64_FORMAT "}, "
+                "\"cpu_user_seconds\": %.6f, \"cpu_system_seconds\": %.6f}\n",
+                element_name, instance_count, buffer_count, buffer_size,
+                in_buffers, out_buffers,
+                zero_copy_input ? "true" : "false", zero_copy_output ? "true" : "false",
+                received, seconds,
+                received / seconds, (gdouble) received * buffer_size / seconds / (1024 * 1024),
+                percentile (latencies, received, 50), percentile (latencies, received, 90),
+                percentile (latencies, received, 99), received ? latencies[received - 1] : 0,
+                cpu_time (&usage_end.ru_utime) - cpu_time (&usage_start.ru_utime),
+                cpu_time (&usage_end.ru_stime) - cpu_time (&usage_start.ru_stime));
+    }
+
+    g_free (latencies);
+    g_free (instances);
+
+    return (received == (guint) (buffer_count * instance_count)) ? 0 : 1;
+}
@@ -25,6 +25,7 @@
 
 #define PROCESS_COUNT 0x1000
 #define DISABLE_AT PROCESS_COUNT / 2
+#define TIMEOUT (G_USEC_PER_SEC / 100)
 
 typedef struct CustomData CustomData;
 
@@ -83,6 +84,56 @@ START_TEST (test_async_queue_pop)
 }
 END_TEST
 
+START_TEST (test_async_queue_try_pop)
+{
+    AsyncQueue *queue;
+    gpointer foo;
+    gpointer tmp;
+    queue = async_queue_new ();
+    fail_if (!queue,
+             "Construction failed");
+    tmp = async_queue_try_pop (queue);
+    fail_if (tmp != NULL,
+             "Pop on empty queue failed");
+    foo = GINT_TO_POINTER (1);
+    async_queue_push (queue, foo);
+    async_queue_disable (queue);
+    tmp = async_queue_try_pop (queue);
+    fail_if (tmp != NULL,
+             "Pop on disabled queue failed");
+    async_queue_enable (queue);
+    tmp = async_queue_try_pop (queue);
+    fail_if (tmp != foo,
+             "Pop failed");
+    async_queue_free (queue);
+}
+END_TEST
+
+START_TEST (test_async_queue_pop_timed)
+{
+    AsyncQueue *queue;
+    gpointer foo;
+    gpointer tmp;
+    GTimeVal end_time;
+    queue = async_queue_new ();
+    fail_if (!queue,
+             "Construction failed");
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, TIMEOUT);
+    tmp = async_queue_pop_timed (queue, &end_time);
+    fail_if (tmp != NULL,
+             "Timeout failed");
+    foo = GINT_TO_POINTER (1);
+    async_queue_push (queue, foo);
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, TIMEOUT);
+    tmp = async_queue_pop_timed (queue, &end_time);
+    fail_if (tmp != foo,
+             "Pop failed");
+    async_queue_free (queue);
+}
+END_TEST
+
 START_TEST (test_async_queue_process)
 {
     AsyncQueue *queue;
@@ -391,6 +442,8 @@ util_suite (void)
     TCase *tc_core = tcase_create ("Core");
     tcase_add_test (tc_core, test_async_queue_create);
     tcase_add_test (tc_core, test_async_queue_pop);
+    tcase_add_test (tc_core, test_async_queue_try_pop);
+    tcase_add_test (tc_core, test_async_queue_pop_timed);
     tcase_add_test (tc_core, test_async_queue_process);
     tcase_add_test (tc_core, test_async_queue_threads);
     tcase_add_test (tc_core, test_async_queue_disable_simple);
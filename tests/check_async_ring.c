@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <check.h>
+#include "async_ring.h"
+
+#define PROCESS_COUNT 0x1000
+#define DISABLE_AT PROCESS_COUNT / 2
+#define TIMEOUT (G_USEC_PER_SEC / 100)
+#define SMALL_CAPACITY 4
+#define PRODUCER_COUNT 4
+
+START_TEST (test_async_ring_create)
+{
+    AsyncRing *ring;
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+    fail_if (ring->capacity < SMALL_CAPACITY,
+             "Wrong capacity");
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_pop)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    gpointer tmp;
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+    foo = GINT_TO_POINTER (1);
+    async_ring_push (ring, foo);
+    tmp = async_ring_pop (ring);
+    fail_if (tmp != foo,
+             "Pop failed");
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_full)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    guint i;
+
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < ring->capacity; i++, foo++)
+    {
+        fail_if (!async_ring_push (ring, foo),
+                 "Push failed");
+    }
+
+    fail_if (async_ring_push (ring, foo),
+             "Push on full ring succeeded");
+    fail_if (async_ring_length (ring) != ring->capacity,
+             "Wrong length");
+
+    async_ring_flush (ring);
+
+    fail_if (async_ring_length (ring) != 0,
+             "Flush failed");
+    fail_if (async_ring_pop_forced (ring),
+             "Flush failed");
+
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_try_pop)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    gpointer tmp;
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+    tmp = async_ring_try_pop (ring);
+    fail_if (tmp != NULL,
+             "Pop on empty ring failed");
+    foo = GINT_TO_POINTER (1);
+    async_ring_push (ring, foo);
+    async_ring_disable (ring);
+    tmp = async_ring_try_pop (ring);
+    fail_if (tmp != NULL,
+             "Pop on disabled ring failed");
+    async_ring_enable (ring);
+    tmp = async_ring_try_pop (ring);
+    fail_if (tmp != foo,
+             "Pop failed");
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_pop_timed)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    gpointer tmp;
+    GTimeVal end_time;
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, TIMEOUT);
+    tmp = async_ring_pop_timed (ring, &end_time);
+    fail_if (tmp != NULL,
+             "Timeout failed");
+    foo = GINT_TO_POINTER (1);
+    async_ring_push (ring, foo);
+    g_get_current_time (&end_time);
+    g_time_val_add (&end_time, TIMEOUT);
+    tmp = async_ring_pop_timed (ring, &end_time);
+    fail_if (tmp != foo,
+             "Pop failed");
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_pop_many)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    gpointer tmp[SMALL_CAPACITY + 1];
+    guint count;
+    guint i;
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+    count = async_ring_pop_many (ring, tmp, SMALL_CAPACITY);
+    fail_if (count != 0,
+             "Pop on empty ring failed");
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < 3; i++, foo++)
+        async_ring_push (ring, foo);
+    async_ring_disable (ring);
+    count = async_ring_pop_many (ring, tmp, SMALL_CAPACITY);
+    fail_if (count != 0,
+             "Pop on disabled ring failed");
+    async_ring_enable (ring);
+    count = async_ring_pop_many (ring, tmp, 2);
+    fail_if (count != 2,
+             "Wrong count");
+    count += async_ring_pop_many (ring, tmp + count, SMALL_CAPACITY + 1 - count);
+    fail_if (count != 3,
+             "Wrong count");
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < count; i++, foo++)
+    {
+        fail_if (tmp[i] != foo,
+                 "Pop failed");
+    }
+    fail_if (async_ring_length (ring) != 0,
+             "Wrong length");
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_process)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    gpointer bar;
+    guint i;
+
+    /* Go around the ring several times. */
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+
+    foo = bar = GINT_TO_POINTER (1);
+    for (i = 0; i < PROCESS_COUNT; i++, foo++)
+    {
+        async_ring_push (ring, foo);
+        if (i % 2)
+        {
+            gpointer tmp;
+            tmp = async_ring_pop (ring);
+            fail_if (tmp != bar++,
+                     "Pop failed");
+            tmp = async_ring_pop (ring);
+            fail_if (tmp != bar++,
+                     "Pop failed");
+        }
+    }
+
+    fail_if (async_ring_length (ring) != 0,
+             "Wrong length");
+
+    async_ring_free (ring);
+}
+END_TEST
+
+static gpointer
+push_func (gpointer data)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    guint i;
+
+    ring = data;
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < PROCESS_COUNT; i++, foo++)
+    {
+        async_ring_push (ring, foo);
+    }
+
+    return NULL;
+}
+
+static gpointer
+pop_func (gpointer data)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    guint i;
+
+    ring = data;
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < PROCESS_COUNT; i++, foo++)
+    {
+        gpointer tmp;
+        tmp = async_ring_pop (ring);
+        fail_if (tmp != foo,
+                 "Pop failed");
+    }
+
+    return NULL;
+}
+
+START_TEST (test_async_ring_threads)
+{
+    AsyncRing *ring;
+    GThread *push_thread;
+    GThread *pop_thread;
+
+    ring = async_ring_new (PROCESS_COUNT);
+    fail_if (!ring,
+             "Construction failed");
+
+    pop_thread = g_thread_create (pop_func, ring, TRUE, NULL);
+    push_thread = g_thread_create (push_func, ring, TRUE, NULL);
+
+    g_thread_join (pop_thread);
+    g_thread_join (push_thread);
+
+    async_ring_free (ring);
+}
+END_TEST
+
+static gpointer
+push_multi_func (gpointer data)
+{
+    AsyncRing *ring;
+    guint i;
+
+    ring = data;
+    for (i = 0; i < PROCESS_COUNT; i++)
+    {
+        while (!async_ring_push (ring, GINT_TO_POINTER (1)))
+            g_usleep (10);
+    }
+
+    return NULL;
+}
+
+static gpointer
+pop_multi_func (gpointer data)
+{
+    AsyncRing *ring;
+    guint i;
+
+    ring = data;
+    for (i = 0; i < PROCESS_COUNT * PRODUCER_COUNT; i++)
+    {
+        gpointer tmp;
+        tmp = async_ring_pop (ring);
+        fail_if (tmp != GINT_TO_POINTER (1),
+                 "Pop failed");
+    }
+
+    return NULL;
+}
+
+START_TEST (test_async_ring_producers)
+{
+    AsyncRing *ring;
+    GThread *push_threads[PRODUCER_COUNT];
+    GThread *pop_thread;
+    guint i;
+
+    ring = async_ring_new (SMALL_CAPACITY);
+    fail_if (!ring,
+             "Construction failed");
+
+    pop_thread = g_thread_create (pop_multi_func, ring, TRUE, NULL);
+    for (i = 0; i < PRODUCER_COUNT; i++)
+        push_threads[i] = g_thread_create (push_multi_func, ring, TRUE, NULL);
+
+    g_thread_join (pop_thread);
+    for (i = 0; i < PRODUCER_COUNT; i++)
+        g_thread_join (push_threads[i]);
+
+    fail_if (async_ring_length (ring) != 0,
+             "Wrong length");
+
+    async_ring_free (ring);
+}
+END_TEST
+
+static gpointer
+push_and_disable_func (gpointer data)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    guint i;
+
+    ring = data;
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < DISABLE_AT; i++, foo++)
+    {
+        async_ring_push (ring, foo);
+    }
+
+    async_ring_disable (ring);
+
+    return NULL;
+}
+
+static gpointer
+pop_with_disable_func (gpointer data)
+{
+    AsyncRing *ring;
+    gpointer foo;
+    guint i;
+    guint count = 0;
+
+    ring = data;
+    foo = GINT_TO_POINTER (1);
+    for (i = 0; i < PROCESS_COUNT; i++, foo++)
+    {
+        gpointer tmp;
+        tmp = async_ring_pop (ring);
+        if (!tmp)
+            continue;
+        count++;
+        fail_if (tmp != foo,
+                 "Pop failed");
+    }
+
+    return GINT_TO_POINTER (count);
+}
+
+START_TEST (test_async_ring_disable_simple)
+{
+    AsyncRing *ring;
+    GThread *pop_thread;
+    guint count;
+
+    ring = async_ring_new (PROCESS_COUNT);
+    fail_if (!ring,
+             "Construction failed");
+
+    pop_thread = g_thread_create (pop_with_disable_func, ring, TRUE, NULL);
+
+    async_ring_disable (ring);
+
+    count = GPOINTER_TO_INT (g_thread_join (pop_thread));
+
+    fail_if (count != 0,
+             "Disable failed");
+
+    async_ring_free (ring);
+}
+END_TEST
+
+START_TEST (test_async_ring_enable)
+{
+    AsyncRing *ring;
+    GThread *push_thread;
+    GThread *pop_thread;
+    guint count;
+
+    ring = async_ring_new (PROCESS_COUNT);
+    fail_if (!ring,
+             "Construction failed");
+
+    async_ring_disable (ring);
+
+    pop_thread = g_thread_create (pop_with_disable_func, ring, TRUE, NULL);
+    count = GPOINTER_TO_INT (g_thread_join (pop_thread));
+
+    fail_if (count != 0,
+             "Disable failed");
+
+    async_ring_enable (ring);
+
+    pop_thread = g_thread_create (pop_with_disable_func, ring, TRUE, NULL);
+    push_thread = g_thread_create (push_and_disable_func, ring, TRUE, NULL);
+
+    count = GPOINTER_TO_INT (g_thread_join (pop_thread));
+    g_thread_join (push_thread);
+
+    fail_if (count > DISABLE_AT,
+             "Disable failed");
+
+    async_ring_free (ring);
+}
+END_TEST
+
+Suite *
+util_suite (void)
+{
+    Suite *s = suite_create ("util");
+
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+
+    /* Core test case */
+    TCase *tc_core = tcase_create ("Core");
+    tcase_add_test (tc_core, test_async_ring_create);
+    tcase_add_test (tc_core, test_async_ring_pop);
+    tcase_add_test (tc_core, test_async_ring_try_pop);
+    tcase_add_test (tc_core, test_async_ring_pop_timed);
+    tcase_add_test (tc_core, test_async_ring_pop_many);
+    tcase_add_test (tc_core, test_async_ring_full);
+    tcase_add_test (tc_core, test_async_ring_process);
+    tcase_add_test (tc_core, test_async_ring_threads);
+    tcase_add_test (tc_core, test_async_ring_producers);
+    tcase_add_test (tc_core, test_async_ring_disable_simple);
+    tcase_add_test (tc_core, test_async_ring_enable);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = util_suite ();
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? 0 : 1;
+}
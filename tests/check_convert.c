@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <check.h>
+#include <string.h>
+#include "gstomx_convert.h"
+
+/* Odd widths exercise the scalar tail after the vector loop. */
+static const guint sizes[][2] = {
+    { 2, 2 },
+    { 31, 3 },
+    { 64, 4 },
+    { 65, 5 },
+    { 176, 144 },
+};
+
+static guint8 *
+random_data (guint size)
+{
+    guint8 *data;
+    guint i;
+
+    data = g_malloc (size);
+    for (i = 0; i < size; i++)
+        data[i] = g_random_int_range (0, 256);
+
+    return data;
+}
+
+START_TEST (test_convert_nv12_to_i420)
+{
+    guint n;
+
+    for (n = 0; n < G_N_ELEMENTS (sizes); n++)
+    {
+        guint width, height, cw, ch, stride, i, j;
+        guint8 *y, *uv, *out, *ref;
+
+        width = sizes[n][0];
+        height = sizes[n][1];
+        cw = (width + 1) / 2;
+        ch = (height + 1) / 2;
+        /* padded source, as omx components tend to produce */
+        stride = width + 35;
+
+        y = random_data (stride * height);
+        uv = random_data (stride * ch);
+        out = g_malloc0 (width * height + 2 * cw * ch);
+        ref = g_malloc0 (width * height + 2 * cw * ch);
+
+        for (i = 0; i < height; i++)
+            memcpy (ref + i * width, y + i * stride, width);
+        for (i = 0; i < ch; i++)
+        {
+            for (j = 0; j < cw; j++)
+            {
+                ref[width * height + i * cw + j] = uv[i * stride + 2 * j];
+                ref[width * height + cw * ch + i * cw + j] = uv[i * stride + 2 * j + 1];
+            }
+        }
+
+        gst_omx_convert_nv12_to_i420 (y, stride, uv, stride,
+                                      out, width,
+                                      out + width * height,
+                                      out + width * height + cw * ch, cw,
+                                      width, height);
+
+        fail_if (memcmp (out, ref, width * height + 2 * cw * ch) != 0,
+                 "Mismatch at %ux%u", width, height);
+
+        g_free (y);
+        g_free (uv);
+        g_free (out);
+        g_free (ref);
+    }
+}
+END_TEST
+
+START_TEST (test_convert_i420_to_nv12)
+{
+    guint n;
+
+    for (n = 0; n < G_N_ELEMENTS (sizes); n++)
+    {
+        guint width, height, cw, ch, stride, i, j;
+        guint8 *in, *out, *ref;
+
+        width = sizes[n][0];
+        height = sizes[n][1];
+        cw = (width + 1) / 2;
+        ch = (height + 1) / 2;
+        stride = width + 35;
+
+        in = random_data (width * height + 2 * cw * ch);
+        out = g_malloc0 (stride * (height + ch));
+        ref = g_malloc0 (stride * (height + ch));
+
+        for (i = 0; i < height; i++)
+            memcpy (ref + i * stride, in + i * width, width);
+        for (i = 0; i < ch; i++)
+        {
+            for (j = 0; j < cw; j++)
+            {
+                ref[stride * height + i * stride + 2 * j] = in[width * height + i * cw + j];
+                ref[stride * height + i * stride + 2 * j + 1] = in[width * height + cw * ch + i * cw + j];
+            }
+        }
+
+        gst_omx_convert_i420_to_nv12 (in, width,
+                                      in + width * height,
+                                      in + width * height + cw * ch, cw,
+                                      out, stride,
+                                      out + stride * height, stride,
+                                      width, height);
+
+        fail_if (memcmp (out, ref, stride * (height + ch)) != 0,
+                 "Mismatch at %ux%u", width, height);
+
+        g_free (in);
+        g_free (out);
+        g_free (ref);
+    }
+}
+END_TEST
+
+Suite *
+convert_suite (void)
+{
+    Suite *s = suite_create ("convert");
+
+    /* Core test case */
+    TCase *tc_core = tcase_create ("Core");
+    tcase_add_test (tc_core, test_convert_nv12_to_i420);
+    tcase_add_test (tc_core, test_convert_i420_to_nv12);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = convert_suite ();
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? 0 : 1;
+}
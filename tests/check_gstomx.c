@@ -20,6 +20,7 @@
  */
 
 #include <gst/check/gstcheck.h>
+#include <string.h> /* For memset */
 
 #define BUFFER_SIZE 0x1000
 #define BUFFER_COUNT 0x100
@@ -68,7 +69,8 @@ GST_STATIC_PAD_TEMPLATE ("src",
                          GST_STATIC_CAPS_ANY);
 
 static void
-helper (gboolean flush)
+helper (gboolean flush,
+        gboolean dispatch)
 {
     GstElement *filter;
     GstBus *bus;
@@ -83,7 +85,10 @@ helper (gboolean flush)
     gst_pad_set_active (mysrcpad, TRUE);
     gst_pad_set_active (mysinkpad, TRUE);
 
-    g_object_set (G_OBJECT (filter), "library-name", "libomxil-foo.so", NULL);
+    g_object_set (G_OBJECT (filter),
+                  "library-name", "libomxil-foo.so",
+                  "dispatch-callbacks", dispatch,
+                  NULL);
 
     /* start */
 
@@ -158,13 +163,271 @@ helper (gboolean flush)
 
 GST_START_TEST (test_flush)
 {
-    helper (TRUE);
+    helper (TRUE, FALSE);
+}
+GST_END_TEST
+
+/* The output port grows on every settings change while flushes keep
+ * pausing it from the streaming thread. */
+GST_START_TEST (test_flush_reconfigure)
+{
+    g_setenv ("OMX_MOCK_SETTINGS_CHANGED_EVERY", "3", TRUE);
+    g_setenv ("OMX_MOCK_SETTINGS_CHANGED_GROW", "1", TRUE);
+
+    helper (TRUE, FALSE);
+
+    g_unsetenv ("OMX_MOCK_SETTINGS_CHANGED_EVERY");
+    g_unsetenv ("OMX_MOCK_SETTINGS_CHANGED_GROW");
+}
+GST_END_TEST
+
+#define DISPATCH_RUNS 8
+
+/* Callbacks keep coming from the component while flushes and the final
+ * shutdown stop the dispatcher. */
+GST_START_TEST (test_dispatch_flush)
+{
+    guint i;
+
+    for (i = 0; i < DISPATCH_RUNS; i++)
+        helper (TRUE, TRUE);
+}
+GST_END_TEST
+
+#define SMALL_BUFFER_SIZE 0x10
+#define COALESCE_BYTES 0x100
+
+GST_START_TEST (test_coalesce)
+{
+    GstElement *filter;
+    GstPad *mysrcpad;
+    GstPad *mysinkpad;
+    guint total = 0;
+
+    filter = gst_check_setup_element ("omx_dummy");
+    mysrcpad = gst_check_setup_src_pad (filter, &srctemplate, NULL);
+    mysinkpad = gst_check_setup_sink_pad (filter, &sinktemplate, NULL);
+
+    gst_pad_set_active (mysrcpad, TRUE);
+    gst_pad_set_active (mysinkpad, TRUE);
+
+    g_object_set (G_OBJECT (filter),
+                  "library-name", "libomxil-foo.so",
+                  "coalesce-bytes", COALESCE_BYTES,
+                  NULL);
+
+    fail_unless_equals_int (gst_element_set_state (filter, GST_STATE_PLAYING),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    {
+        guint i;
+        for (i = 0; i < BUFFER_COUNT; i++)
+        {
+            GstBuffer *inbuffer;
+            inbuffer = gst_buffer_new_and_alloc (SMALL_BUFFER_SIZE);
+            memset (GST_BUFFER_DATA (inbuffer), i, SMALL_BUFFER_SIZE);
+            fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+        }
+    }
+
+    gst_pad_push_event (mysrcpad, gst_event_new_eos ());
+
+    /* fewer, bigger buffers; same data */
+    {
+        GList *cur;
+        for (cur = buffers; cur; cur = g_list_next (cur))
+        {
+            GstBuffer *buffer;
+            guint i;
+            buffer = cur->data;
+            for (i = 0; i < GST_BUFFER_SIZE (buffer); i++, total++)
+                fail_unless (GST_BUFFER_DATA (buffer)[i] == (guint8) (total / SMALL_BUFFER_SIZE));
+        }
+        fail_unless (total == BUFFER_COUNT * SMALL_BUFFER_SIZE);
+        fail_unless (g_list_length (buffers) <= BUFFER_COUNT * SMALL_BUFFER_SIZE / COALESCE_BYTES + 1);
+    }
+
+    gst_check_drop_buffers ();
+
+    gst_element_set_state (filter, GST_STATE_NULL);
+
+    gst_pad_set_active (mysrcpad, FALSE);
+    gst_pad_set_active (mysinkpad, FALSE);
+    gst_check_teardown_src_pad (filter);
+    gst_check_teardown_sink_pad (filter);
+    gst_check_teardown_element (filter);
 }
 GST_END_TEST
 
 GST_START_TEST (test_basic)
 {
-    helper (FALSE);
+    helper (FALSE, FALSE);
+}
+GST_END_TEST
+
+/* main limits the dummy component to one session, pools one handle
+ * and lets priorities preempt. */
+
+static GstElement *
+session_element (guint priority,
+                 guint admission_timeout)
+{
+    GstElement *filter;
+
+    filter = gst_element_factory_make ("omx_dummy", NULL);
+    g_object_set (G_OBJECT (filter),
+                  "library-name", "libomxil-foo.so",
+                  "priority", priority,
+                  "admission-timeout", admission_timeout,
+                  NULL);
+
+    return filter;
+}
+
+static gpointer
+set_ready (gpointer data)
+{
+    return GINT_TO_POINTER (gst_element_set_state (GST_ELEMENT (data), GST_STATE_READY));
+}
+
+static GstMessage *
+wait_for_error (GstBus *bus)
+{
+    guint i;
+
+    for (i = 0; i < 200; i++)
+    {
+        GstMessage *message;
+
+        while ((message = gst_bus_pop (bus)))
+        {
+            if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR)
+                return message;
+            gst_message_unref (message);
+        }
+
+        g_usleep (10000);
+    }
+
+    return NULL;
+}
+
+GST_START_TEST (test_session_limit)
+{
+    GstElement *first;
+    GstElement *second;
+
+    first = session_element (0, 0);
+    second = session_element (0, 0);
+
+    fail_unless_equals_int (gst_element_set_state (first, GST_STATE_READY),
+                            GST_STATE_CHANGE_SUCCESS);
+    fail_unless_equals_int (gst_element_set_state (second, GST_STATE_READY),
+                            GST_STATE_CHANGE_FAILURE);
+
+    gst_element_set_state (first, GST_STATE_NULL);
+
+    fail_unless_equals_int (gst_element_set_state (second, GST_STATE_READY),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    gst_element_set_state (second, GST_STATE_NULL);
+
+    gst_object_unref (first);
+    gst_object_unref (second);
+}
+GST_END_TEST
+
+/* The handle of the first goes to the pool while the second waits; it
+ * must take it over rather than add a session. */
+GST_START_TEST (test_session_pool)
+{
+    GstElement *first;
+    GstElement *second;
+    GstElement *third;
+    GThread *thread;
+
+    first = session_element (0, 0);
+    second = session_element (0, 2000);
+    third = session_element (0, 0);
+
+    fail_unless_equals_int (gst_element_set_state (first, GST_STATE_READY),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    thread = g_thread_create (set_ready, second, TRUE, NULL);
+    g_usleep (100000);
+
+    gst_element_set_state (first, GST_STATE_NULL);
+
+    fail_unless_equals_int (GPOINTER_TO_INT (g_thread_join (thread)),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    /* Nothing is left in the pool to hide a session in. */
+    fail_unless_equals_int (gst_element_set_state (third, GST_STATE_READY),
+                            GST_STATE_CHANGE_FAILURE);
+
+    gst_element_set_state (second, GST_STATE_NULL);
+
+    /* Reuses the pooled handle. */
+    fail_unless_equals_int (gst_element_set_state (third, GST_STATE_READY),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    gst_element_set_state (third, GST_STATE_NULL);
+
+    gst_object_unref (first);
+    gst_object_unref (second);
+    gst_object_unref (third);
+}
+GST_END_TEST
+
+/* The higher priority stream waits for the preempted one to shut down,
+ * even without an admission-timeout. */
+GST_START_TEST (test_session_preempt)
+{
+    GstElement *low;
+    GstElement *high;
+    GstBus *bus;
+    GstMessage *message;
+    GThread *thread;
+
+    low = session_element (1, 0);
+    high = session_element (0, 0);
+
+    bus = gst_bus_new ();
+    gst_element_set_bus (low, bus);
+
+    fail_unless_equals_int (gst_element_set_state (low, GST_STATE_READY),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    thread = g_thread_create (set_ready, high, TRUE, NULL);
+
+    message = wait_for_error (bus);
+    fail_unless (message != NULL);
+
+    {
+        GError *err;
+        gchar *debug;
+
+        gst_message_parse_error (message, &err, &debug);
+        fail_unless (err->domain == GST_RESOURCE_ERROR);
+        fail_unless_equals_int (err->code, GST_RESOURCE_ERROR_BUSY);
+        g_error_free (err);
+        g_free (debug);
+    }
+    gst_message_unref (message);
+
+    gst_element_set_state (low, GST_STATE_NULL);
+
+    fail_unless_equals_int (GPOINTER_TO_INT (g_thread_join (thread)),
+                            GST_STATE_CHANGE_SUCCESS);
+
+    gst_element_set_state (high, GST_STATE_NULL);
+
+    gst_bus_set_flushing (bus, TRUE);
+    gst_element_set_bus (low, NULL);
+    gst_object_unref (bus);
+
+    gst_object_unref (low);
+    gst_object_unref (high);
 }
 GST_END_TEST
 
@@ -177,9 +440,37 @@ gstomx_suite (void)
   tcase_set_timeout (tc_chain, 10);
   tcase_add_test (tc_chain, test_basic);
   tcase_add_test (tc_chain, test_flush);
+  tcase_add_test (tc_chain, test_flush_reconfigure);
+  tcase_add_test (tc_chain, test_dispatch_flush);
+  tcase_add_test (tc_chain, test_coalesce);
+  tcase_add_test (tc_chain, test_session_limit);
+  tcase_add_test (tc_chain, test_session_pool);
+  tcase_add_test (tc_chain, test_session_preempt);
   suite_add_tcase (s, tc_chain);
 
   return s;
 }
 
-GST_CHECK_MAIN (gstomx);
+int
+main (int argc,
+      char **argv)
+{
+    Suite *s;
+    SRunner *sr;
+    int nf;
+
+    /* Read when the plugin is loaded. */
+    g_setenv ("GST_OMX_SESSION_LIMITS", "OMX.st.dummy:1", TRUE);
+    g_setenv ("GST_OMX_HANDLE_POOL", "1", TRUE);
+    g_setenv ("GST_OMX_PREEMPT", "1", TRUE);
+
+    gst_check_init (&argc, &argv);
+
+    s = gstomx_suite ();
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    nf = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return nf == 0 ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <check.h>
+#include <string.h>
+#include "gstomx_h264parse.h"
+#include "gstomx_buffer.h"
+
+static const guint8 stream[] = {
+    0x00, 0x00, 0x00, 0x01, 0x67, 0x42, 0x00, 0x1e, /* SPS */
+    0x00, 0x00, 0x00, 0x01, 0x68, 0xce, 0x38, 0x80, /* PPS */
+    0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x21, /* IDR slice */
+    0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x02, 0x03, /* P slice, first_mb_in_slice 0 */
+    0x00, 0x00, 0x01, 0x41, 0x1a, 0x04, /* P slice, same picture */
+    0x00, 0x00, 0x01, 0x41, 0x9a, 0x05, 0x06, /* P slice, next picture */
+};
+
+static GList *units;
+
+static GstFlowReturn
+collect (GstBuffer *buf,
+         gpointer user_data)
+{
+    units = g_list_append (units, buf);
+
+    return GST_FLOW_OK;
+}
+
+static void
+drop_units (void)
+{
+    GList *cur;
+
+    for (cur = units; cur; cur = g_list_next (cur))
+        gst_buffer_unref (cur->data);
+
+    g_list_free (units);
+    units = NULL;
+}
+
+static GstBuffer *
+new_buffer (const guint8 *data,
+            guint size)
+{
+    GstBuffer *buf;
+
+    buf = gst_buffer_new_and_alloc (size);
+    memcpy (GST_BUFFER_DATA (buf), data, size);
+
+    return buf;
+}
+
+static void
+push_bytes (GstOmxH264Parse *parse,
+            guint chunk)
+{
+    guint offset;
+
+    for (offset = 0; offset < sizeof (stream); offset += chunk)
+    {
+        gst_omx_h264_parse_push (parse,
+                                 new_buffer (stream + offset, MIN (chunk, sizeof (stream) - offset)),
+                                 FALSE, collect, NULL);
+    }
+
+    gst_omx_h264_parse_drain (parse, collect, NULL);
+}
+
+static gboolean
+is_frame_end (GList *cur)
+{
+    return GST_OMX_BUFFER_IS_END_OF_FRAME (cur->data);
+}
+
+static gboolean
+is_delta_unit (GList *cur)
+{
+    return GST_BUFFER_FLAG_IS_SET (cur->data, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+START_TEST (test_h264parse_start_code)
+{
+    fail_if (gst_omx_h264_find_start_code (stream, stream + sizeof (stream)) != stream + 1,
+             "Start code not found");
+    fail_if (gst_omx_h264_find_start_code (stream + 2, stream + sizeof (stream)) != stream + 9,
+             "Next start code not found");
+    fail_if (gst_omx_h264_find_start_code (stream + 4, stream + 10) != NULL,
+             "Truncated start code found");
+}
+END_TEST
+
+START_TEST (test_h264parse_access_units)
+{
+    GstOmxH264Parse *parse;
+    guint chunk;
+
+    for (chunk = 1; chunk <= sizeof (stream); chunk++)
+    {
+        parse = gst_omx_h264_parse_new ();
+        push_bytes (parse, chunk);
+        fail_if (g_list_length (units) != 3,
+                 "Wrong number of access units");
+        fail_if (GST_BUFFER_SIZE (g_list_nth_data (units, 0)) != 23 ||
+                 GST_BUFFER_SIZE (g_list_nth_data (units, 1)) != 14 ||
+                 GST_BUFFER_SIZE (g_list_nth_data (units, 2)) != 7,
+                 "Wrong access unit boundaries");
+        fail_if (memcmp (GST_BUFFER_DATA (g_list_nth_data (units, 1)), stream + 23, 14) != 0,
+                 "Data corrupted");
+        fail_if (is_delta_unit (g_list_nth (units, 0)) || !is_delta_unit (g_list_nth (units, 1)),
+                 "Wrong key frame flags");
+        fail_if (!is_frame_end (g_list_nth (units, 0)) || !is_frame_end (g_list_nth (units, 2)),
+                 "Frame end not flagged");
+        fail_if (!GST_BUFFER_IS_DISCONT (g_list_nth_data (units, 0)),
+                 "No discont at the start");
+        drop_units ();
+        gst_omx_h264_parse_free (parse);
+    }
+}
+END_TEST
+
+START_TEST (test_h264parse_nals)
+{
+    GstOmxH264Parse *parse;
+
+    parse = gst_omx_h264_parse_new ();
+    parse->split_nals = TRUE;
+    push_bytes (parse, 5);
+    fail_if (g_list_length (units) != 6,
+             "Wrong number of NAL units");
+    fail_if (GST_BUFFER_SIZE (g_list_nth_data (units, 0)) != 8,
+             "Wrong NAL unit boundaries");
+    fail_if (is_frame_end (g_list_nth (units, 1)) || !is_frame_end (g_list_nth (units, 2)) ||
+             is_frame_end (g_list_nth (units, 3)) || !is_frame_end (g_list_nth (units, 4)),
+             "Frame end on the wrong NAL unit");
+    drop_units ();
+    gst_omx_h264_parse_free (parse);
+}
+END_TEST
+
+START_TEST (test_h264parse_aligned)
+{
+    GstOmxH264Parse *parse;
+    GstBuffer *buf;
+
+    parse = gst_omx_h264_parse_new ();
+    buf = new_buffer (stream, 23);
+    GST_BUFFER_TIMESTAMP (buf) = GST_SECOND;
+    gst_omx_h264_parse_push (parse, buf, TRUE, collect, NULL);
+    fail_if (g_list_length (units) != 1,
+             "Aligned access unit held back");
+    fail_if (GST_BUFFER_TIMESTAMP (units->data) != GST_SECOND,
+             "Wrong timestamp");
+    drop_units ();
+    gst_omx_h264_parse_free (parse);
+}
+END_TEST
+
+START_TEST (test_h264parse_avc)
+{
+    static const guint8 avcc[] = {
+        0x01, 0x42, 0x00, 0x1e, 0xfd, /* two byte lengths */
+        0xe1, 0x00, 0x04, 0x67, 0x42, 0x00, 0x1e,
+        0x01, 0x00, 0x04, 0x68, 0xce, 0x38, 0x80,
+    };
+    static const guint8 sample[] = {
+        0x00, 0x04, 0x65, 0x88, 0x84, 0x21,
+        0x00, 0x02, 0x06, 0x05,
+    };
+    GstOmxH264Parse *parse;
+    GstBuffer *codec_data;
+    GstBuffer *buf;
+
+    buf = new_buffer (avcc, sizeof (avcc));
+    parse = gst_omx_h264_parse_new ();
+    codec_data = gst_omx_h264_codec_data_to_byte_stream (buf, &parse->nal_length_size);
+    gst_buffer_unref (buf);
+    fail_if (codec_data == NULL,
+             "avcC not converted");
+    fail_if (parse->nal_length_size != 2,
+             "Wrong length size");
+    fail_if (GST_BUFFER_SIZE (codec_data) != 16 ||
+             memcmp (GST_BUFFER_DATA (codec_data), stream, 16) != 0,
+             "Wrong SPS and PPS");
+    gst_buffer_unref (codec_data);
+    gst_omx_h264_parse_push (parse, new_buffer (sample, sizeof (sample)), FALSE, collect, NULL);
+    fail_if (g_list_length (units) != 1,
+             "Wrong number of access units");
+    buf = units->data;
+    fail_if (GST_BUFFER_SIZE (buf) != 14 ||
+             memcmp (GST_BUFFER_DATA (buf) + 4, stream + 19, 4) != 0 ||
+             GST_BUFFER_DATA (buf)[11] != 0x01,
+             "Length prefixes not replaced");
+    fail_if (is_delta_unit (units) || !is_frame_end (units),
+             "Wrong flags");
+    drop_units ();
+    gst_omx_h264_parse_free (parse);
+}
+END_TEST
+
+Suite *
+h264parse_suite (void)
+{
+    Suite *s = suite_create ("h264parse");
+
+    /* Core test case */
+    TCase *tc_core = tcase_create ("Core");
+    tcase_add_test (tc_core, test_h264parse_start_code);
+    tcase_add_test (tc_core, test_h264parse_access_units);
+    tcase_add_test (tc_core, test_h264parse_nals);
+    tcase_add_test (tc_core, test_h264parse_aligned);
+    tcase_add_test (tc_core, test_h264parse_avc);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    gst_init (NULL, NULL);
+
+    s = h264parse_suite ();
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? 0 : 1;
+}
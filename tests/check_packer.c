@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <check.h>
+#include <string.h>
+#include "gstomx_packer.h"
+
+#define FRAME (10 * GST_MSECOND)
+
+static GstBuffer *
+new_frame (guint size,
+           guint8 value,
+           GstClockTime timestamp)
+{
+    GstBuffer *buf;
+
+    buf = gst_buffer_new_and_alloc (size);
+    memset (GST_BUFFER_DATA (buf), value, size);
+    GST_BUFFER_TIMESTAMP (buf) = timestamp;
+
+    return buf;
+}
+
+START_TEST (test_packer_pack)
+{
+    GstOmxPacker *packer;
+    GstBuffer *buf;
+    packer = gst_omx_packer_new (10, 160, FRAME, NULL);
+    packer->frames_per_buffer = 3;
+    fail_if (gst_omx_packer_push (packer, new_frame (10, 1, 0)) != NULL,
+             "Pushed too early");
+    fail_if (gst_omx_packer_push (packer, new_frame (10, 2, FRAME)) != NULL,
+             "Pushed too early");
+    buf = gst_omx_packer_push (packer, new_frame (10, 3, 2 * FRAME));
+    fail_if (buf == NULL,
+             "Not pushed");
+    fail_if (GST_BUFFER_SIZE (buf) != 30,
+             "Wrong size");
+    fail_if (GST_BUFFER_DATA (buf)[0] != 1 || GST_BUFFER_DATA (buf)[29] != 3,
+             "Frames out of order");
+    fail_if (GST_BUFFER_TIMESTAMP (buf) != 0,
+             "Wrong timestamp");
+    fail_if (GST_BUFFER_DURATION (buf) != 3 * FRAME,
+             "Wrong duration");
+    gst_buffer_unref (buf);
+    gst_omx_packer_free (packer);
+}
+END_TEST
+
+START_TEST (test_packer_whole)
+{
+    GstOmxPacker *packer;
+    GstBuffer *in;
+    GstBuffer *buf;
+    packer = gst_omx_packer_new (10, 160, FRAME, NULL);
+    packer->frames_per_buffer = 2;
+    in = new_frame (20, 1, FRAME);
+    buf = gst_omx_packer_push (packer, in);
+    fail_if (buf != in,
+             "Complete buffer was copied");
+    fail_if (GST_BUFFER_DURATION (buf) != 2 * FRAME,
+             "Wrong duration");
+    gst_buffer_unref (buf);
+    gst_omx_packer_free (packer);
+}
+END_TEST
+
+START_TEST (test_packer_drain)
+{
+    GstOmxPacker *packer;
+    GstBuffer *buf;
+    packer = gst_omx_packer_new (10, 160, FRAME, NULL);
+    packer->frames_per_buffer = 4;
+    fail_if (gst_omx_packer_drain (packer) != NULL,
+             "Nothing was pending");
+    gst_omx_packer_push (packer, new_frame (10, 1, 0));
+    gst_omx_packer_push (packer, new_frame (10, 2, FRAME));
+    buf = gst_omx_packer_drain (packer);
+    fail_if (buf == NULL || GST_BUFFER_SIZE (buf) != 20,
+             "Short packet lost");
+    fail_if (GST_BUFFER_DURATION (buf) != 2 * FRAME,
+             "Wrong duration");
+    gst_buffer_unref (buf);
+    gst_omx_packer_push (packer, new_frame (10, 1, 0));
+    gst_omx_packer_reset (packer);
+    fail_if (gst_omx_packer_drain (packer) != NULL,
+             "Not reset");
+    gst_omx_packer_free (packer);
+}
+END_TEST
+
+START_TEST (test_packer_amr)
+{
+    GstOmxPacker *packer;
+    guint8 data[32 + 6 + 1];
+    packer = gst_omx_packer_new (32, 320, 2 * FRAME, gst_omx_packer_amrnb_frame_length);
+    memset (data, 0, sizeof (data));
+    data[0] = 7 << 3; /* 12.2 kbps */
+    data[32] = 8 << 3; /* SID */
+    data[38] = 15 << 3; /* no data */
+    fail_if (gst_omx_packer_frame_length (packer, data, sizeof (data)) != 32,
+             "Wrong frame length");
+    fail_if (gst_omx_packer_count (packer, data, sizeof (data)) != 3,
+             "Wrong frame count");
+    /* truncated */
+    fail_if (gst_omx_packer_count (packer, data, 20) != 1,
+             "Wrong frame count");
+    gst_omx_packer_free (packer);
+}
+END_TEST
+
+START_TEST (test_packer_g729)
+{
+    GstOmxPacker *packer;
+    guint8 data[10 + 10 + 2];
+    packer = gst_omx_packer_new (10, 160, FRAME, gst_omx_packer_g729_frame_length);
+    memset (data, 0, sizeof (data));
+    fail_if (gst_omx_packer_count (packer, data, sizeof (data)) != 3,
+             "Comfort noise frame not counted");
+    fail_if (gst_omx_packer_frame_length (packer, data + 20, 2) != 2,
+             "Wrong comfort noise frame length");
+    gst_omx_packer_free (packer);
+}
+END_TEST
+
+Suite *
+packer_suite (void)
+{
+    Suite *s = suite_create ("packer");
+
+    /* Core test case */
+    TCase *tc_core = tcase_create ("Core");
+    tcase_add_test (tc_core, test_packer_pack);
+    tcase_add_test (tc_core, test_packer_whole);
+    tcase_add_test (tc_core, test_packer_drain);
+    tcase_add_test (tc_core, test_packer_amr);
+    tcase_add_test (tc_core, test_packer_g729);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    gst_init (NULL, NULL);
+
+    s = packer_suite ();
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? 0 : 1;
+}
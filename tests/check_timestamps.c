@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <check.h>
+#include "gstomx_timestamps.h"
+
+#define FRAME (GST_SECOND / 25)
+
+static GstClockTime
+pop_hinted (GstOmxTimestamps *ts,
+            GstClockTime hint,
+            gboolean *discont)
+{
+    GstClockTime timestamp;
+    GstClockTime duration;
+    gboolean tmp;
+
+    tmp = gst_omx_timestamps_pop (ts, hint, &timestamp, &duration);
+    if (discont)
+        *discont = tmp;
+
+    return timestamp;
+}
+
+static GstClockTime
+pop (GstOmxTimestamps *ts,
+     gboolean *discont)
+{
+    return pop_hinted (ts, GST_CLOCK_TIME_NONE, discont);
+}
+
+START_TEST (test_timestamps_reorder)
+{
+    GstOmxTimestamps *ts;
+    ts = gst_omx_timestamps_new ();
+    gst_omx_timestamps_set_framerate (ts, 25, 1);
+    /* I P B B, in decode order */
+    gst_omx_timestamps_push (ts, 0, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, 3 * FRAME, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, 1 * FRAME, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, 2 * FRAME, FRAME, FALSE);
+    fail_if (pop (ts, NULL) != 0,
+             "Wrong first timestamp");
+    fail_if (pop (ts, NULL) != 1 * FRAME,
+             "Not in presentation order");
+    fail_if (pop (ts, NULL) != 2 * FRAME,
+             "Not in presentation order");
+    fail_if (pop (ts, NULL) != 3 * FRAME,
+             "Not in presentation order");
+    gst_omx_timestamps_free (ts);
+}
+END_TEST
+
+START_TEST (test_timestamps_interpolate)
+{
+    GstOmxTimestamps *ts;
+    ts = gst_omx_timestamps_new ();
+    gst_omx_timestamps_set_framerate (ts, 25, 1);
+    gst_omx_timestamps_push (ts, FRAME, GST_CLOCK_TIME_NONE, FALSE);
+    gst_omx_timestamps_push (ts, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, FALSE);
+    gst_omx_timestamps_push (ts, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, FALSE);
+    fail_if (pop (ts, NULL) != FRAME,
+             "Wrong first timestamp");
+    fail_if (pop (ts, NULL) != 2 * FRAME,
+             "Not interpolated");
+    fail_if (pop (ts, NULL) != 3 * FRAME,
+             "Not interpolated");
+    gst_omx_timestamps_free (ts);
+}
+END_TEST
+
+START_TEST (test_timestamps_duplicated)
+{
+    GstOmxTimestamps *ts;
+    ts = gst_omx_timestamps_new ();
+    gst_omx_timestamps_set_framerate (ts, 25, 1);
+    gst_omx_timestamps_push (ts, FRAME, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, FRAME, FRAME, FALSE);
+    fail_if (pop (ts, NULL) != FRAME,
+             "Wrong first timestamp");
+    fail_if (pop (ts, NULL) != 2 * FRAME,
+             "Duplicated timestamp");
+    gst_omx_timestamps_free (ts);
+}
+END_TEST
+
+START_TEST (test_timestamps_discont)
+{
+    GstOmxTimestamps *ts;
+    gboolean discont;
+    ts = gst_omx_timestamps_new ();
+    gst_omx_timestamps_set_framerate (ts, 25, 1);
+    gst_omx_timestamps_push (ts, 10 * FRAME, FRAME, FALSE);
+    pop (ts, &discont);
+    fail_if (discont,
+             "Unexpected discont");
+    gst_omx_timestamps_push (ts, 2 * FRAME, FRAME, TRUE);
+    fail_if (pop (ts, &discont) != 2 * FRAME,
+             "Timestamp before discont kept");
+    fail_if (!discont,
+             "Discont lost");
+    pop (ts, &discont);
+    fail_if (discont,
+             "Discont repeated");
+    gst_omx_timestamps_reset (ts);
+    gst_omx_timestamps_push (ts, FRAME, FRAME, FALSE);
+    fail_if (pop (ts, &discont) != FRAME,
+             "Wrong timestamp after reset");
+    fail_if (!discont,
+             "No discont after reset");
+    gst_omx_timestamps_free (ts);
+}
+END_TEST
+
+START_TEST (test_timestamps_dropped)
+{
+    GstOmxTimestamps *ts;
+    ts = gst_omx_timestamps_new ();
+    gst_omx_timestamps_set_framerate (ts, 25, 1);
+    /* I P B B, in decode order; the first B gets dropped */
+    gst_omx_timestamps_push (ts, 0, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, 3 * FRAME, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, 1 * FRAME, FRAME, FALSE);
+    gst_omx_timestamps_push (ts, 2 * FRAME, FRAME, FALSE);
+    fail_if (pop_hinted (ts, 0, NULL) != 0,
+             "Wrong first timestamp");
+    /* rounded to OpenMAX ticks */
+    fail_if (pop_hinted (ts, 2 * FRAME - 500, NULL) != 2 * FRAME,
+             "Hint not followed");
+    fail_if (pop_hinted (ts, GST_CLOCK_TIME_NONE, NULL) != 3 * FRAME,
+             "Entry of the dropped frame kept");
+    /* a hint that matches nothing is ignored */
+    gst_omx_timestamps_push (ts, 4 * FRAME, FRAME, FALSE);
+    fail_if (pop_hinted (ts, 10 * FRAME, NULL) != 4 * FRAME,
+             "Unmatched hint not ignored");
+    gst_omx_timestamps_free (ts);
+}
+END_TEST
+
+Suite *
+timestamps_suite (void)
+{
+    Suite *s = suite_create ("timestamps");
+
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+
+    /* Core test case */
+    TCase *tc_core = tcase_create ("Core");
+    tcase_add_test (tc_core, test_timestamps_reorder);
+    tcase_add_test (tc_core, test_timestamps_interpolate);
+    tcase_add_test (tc_core, test_timestamps_duplicated);
+    tcase_add_test (tc_core, test_timestamps_discont);
+    tcase_add_test (tc_core, test_timestamps_dropped);
+    suite_add_tcase (s, tc_core);
+
+    return s;
+}
+
+int
+main (void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = timestamps_suite ();
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? 0 : 1;
+}
@@ -25,8 +25,10 @@
 #include <glib.h>
 
 #include <stdlib.h> /* For calloc, free */
+#include <string.h> /* For memcpy */
 
 #include "async_queue.h"
+#include "mock_config.h"
 
 static void *foo_thread (void *cb_data);
 
@@ -58,6 +60,14 @@ struct CompPrivate
     CompPrivatePort *ports;
     gboolean done;
     GMutex *flush_mutex;
+    GThread *thread;
+    MockConfig config;
+
+    /* Protected by flush_mutex. */
+    OMX_BUFFERHEADERTYPE *current; /**< Input being consumed. */
+    GQueue *held; /**< Output kept back for reordering. */
+    guint in_count;
+    guint out_count;
 };
 
 struct CompPrivatePort
@@ -66,6 +76,49 @@ struct CompPrivatePort
     AsyncQueue *queue;
 };
 
+/* Hands back every buffer the component holds on a port; with flush_mutex. */
+static void
+return_buffers (OMX_COMPONENTTYPE *comp,
+                OMX_U32 port_index)
+{
+    CompPrivate *private;
+    OMX_BUFFERHEADERTYPE *buffer;
+
+    private = comp->pComponentPrivate;
+
+    if (port_index == 0 || port_index == OMX_ALL)
+    {
+        if (private->current)
+        {
+            private->callbacks->EmptyBufferDone (comp,
+                                                 private->app_data, private->current);
+            private->current = NULL;
+        }
+
+        while ((buffer = async_queue_pop_forced (private->ports[0].queue)))
+        {
+            private->callbacks->EmptyBufferDone (comp,
+                                                 private->app_data, buffer);
+        }
+    }
+
+    if (port_index == 1 || port_index == OMX_ALL)
+    {
+        while ((buffer = g_queue_pop_head (private->held)))
+        {
+            buffer->nFilledLen = 0;
+            private->callbacks->FillBufferDone (comp,
+                                                private->app_data, buffer);
+        }
+
+        while ((buffer = async_queue_pop_forced (private->ports[1].queue)))
+        {
+            private->callbacks->FillBufferDone (comp,
+                                                private->app_data, buffer);
+        }
+    }
+}
+
 static OMX_ERRORTYPE
 comp_GetState (OMX_HANDLETYPE handle,
                OMX_STATETYPE *state)
@@ -106,7 +159,7 @@ comp_GetParameter (OMX_HANDLETYPE handle,
                 break;
             }
         default:
-            break;
+            return OMX_ErrorUnsupportedIndex;
     }
 
     return OMX_ErrorNone;
@@ -135,12 +188,36 @@ comp_SetParameter (OMX_HANDLETYPE handle,
                 break;
             }
         default:
-            break;
+            return OMX_ErrorUnsupportedIndex;
     }
 
     return OMX_ErrorNone;
 }
 
+static OMX_ERRORTYPE
+comp_GetConfig (OMX_HANDLETYPE handle,
+                OMX_INDEXTYPE index,
+                OMX_PTR config)
+{
+    return OMX_ErrorUnsupportedIndex;
+}
+
+static OMX_ERRORTYPE
+comp_SetConfig (OMX_HANDLETYPE handle,
+                OMX_INDEXTYPE index,
+                OMX_PTR config)
+{
+    return OMX_ErrorUnsupportedIndex;
+}
+
+static OMX_ERRORTYPE
+comp_GetExtensionIndex (OMX_HANDLETYPE handle,
+                        OMX_STRING name,
+                        OMX_INDEXTYPE *index)
+{
+    return OMX_ErrorUnsupportedIndex;
+}
+
 static OMX_ERRORTYPE
 comp_SendCommand (OMX_HANDLETYPE handle,
                   OMX_COMMANDTYPE command,
@@ -161,7 +238,26 @@ comp_SendCommand (OMX_HANDLETYPE handle,
             {
                 if (private->state == OMX_StateLoaded && param_1 == OMX_StateIdle)
                 {
-                    g_thread_create (foo_thread, comp, TRUE, NULL);
+                    private->done = FALSE;
+                    async_queue_enable (private->ports[0].queue);
+                    async_queue_enable (private->ports[1].queue);
+                    private->thread = g_thread_create (foo_thread, comp, TRUE, NULL);
+                }
+                else if ((private->state == OMX_StateExecuting || private->state == OMX_StatePause) &&
+                         param_1 == OMX_StateIdle)
+                {
+                    /* Idle means the client has all of its buffers back. */
+                    g_mutex_lock (private->flush_mutex);
+                    return_buffers (comp, OMX_ALL);
+                    g_mutex_unlock (private->flush_mutex);
+                }
+                else if (private->state == OMX_StateIdle && param_1 == OMX_StateLoaded)
+                {
+                    private->done = TRUE;
+                    async_queue_disable (private->ports[0].queue);
+                    async_queue_disable (private->ports[1].queue);
+                    g_thread_join (private->thread);
+                    private->thread = NULL;
                 }
                 private->state = param_1;
                 private->callbacks->EventHandler (handle,
@@ -169,24 +265,10 @@ comp_SendCommand (OMX_HANDLETYPE handle,
                                                   OMX_CommandStateSet, private->state, data);
             }
             break;
-        case  OMX_CommandFlush:
+        case OMX_CommandFlush:
             {
                 g_mutex_lock (private->flush_mutex);
-                {
-                    OMX_BUFFERHEADERTYPE *buffer;
-
-                    while (buffer = async_queue_pop_forced (private->ports[0].queue))
-                    {
-                        private->callbacks->EmptyBufferDone (comp,
-                                                             private->app_data, buffer);
-                    }
-
-                    while (buffer = async_queue_pop_forced (private->ports[1].queue))
-                    {
-                        private->callbacks->FillBufferDone (comp,
-                                                            private->app_data, buffer);
-                    }
-                }
+                return_buffers (comp, param_1);
                 g_mutex_unlock (private->flush_mutex);
 
                 private->callbacks->EventHandler (handle,
@@ -194,6 +276,24 @@ comp_SendCommand (OMX_HANDLETYPE handle,
                                                   OMX_CommandFlush, param_1, data);
             }
             break;
+        case OMX_CommandPortDisable:
+            {
+                g_mutex_lock (private->flush_mutex);
+                return_buffers (comp, param_1);
+                g_mutex_unlock (private->flush_mutex);
+
+                private->callbacks->EventHandler (handle,
+                                                  private->app_data, OMX_EventCmdComplete,
+                                                  OMX_CommandPortDisable, param_1, data);
+            }
+            break;
+        case OMX_CommandPortEnable:
+            {
+                private->callbacks->EventHandler (handle,
+                                                  private->app_data, OMX_EventCmdComplete,
+                                                  OMX_CommandPortEnable, param_1, data);
+            }
+            break;
         default:
             /* printf ("command: %d\n", command); */
             break;
@@ -213,10 +313,14 @@ comp_UseBuffer (OMX_HANDLETYPE handle,
     OMX_BUFFERHEADERTYPE *new;
 
     new = calloc (1, sizeof (OMX_BUFFERHEADERTYPE));
+    if (!new)
+        return OMX_ErrorInsufficientResources;
+
     new->nSize = sizeof (OMX_BUFFERHEADERTYPE);
     new->nVersion.nVersion = 1;
     new->pBuffer = buffer;
     new->nAllocLen = size;
+    new->pAppPrivate = data;
 
     switch (index)
     {
@@ -230,60 +334,211 @@ comp_UseBuffer (OMX_HANDLETYPE handle,
     return OMX_ErrorNone;
 }
 
+static OMX_ERRORTYPE
+comp_AllocateBuffer (OMX_HANDLETYPE handle,
+                     OMX_BUFFERHEADERTYPE **buffer_header,
+                     OMX_U32 index,
+                     OMX_PTR data,
+                     OMX_U32 size)
+{
+    OMX_ERRORTYPE error;
+    OMX_U8 *buffer;
+
+    buffer = malloc (size);
+    if (!buffer)
+        return OMX_ErrorInsufficientResources;
+
+    error = comp_UseBuffer (handle, buffer_header, index, data, size, buffer);
+    if (error != OMX_ErrorNone)
+    {
+        free (buffer);
+        return error;
+    }
+
+    /* Tells FreeBuffer the data is ours. */
+    (*buffer_header)->pPlatformPrivate = buffer;
+
+    return error;
+}
+
 static OMX_ERRORTYPE
 comp_FreeBuffer (OMX_HANDLETYPE handle,
                  OMX_U32 index,
                  OMX_BUFFERHEADERTYPE *buffer_header)
 {
+    free (buffer_header->pPlatformPrivate);
     free (buffer_header);
 
     return OMX_ErrorNone;
 }
 
+/* Sends out a filled buffer, going through the reordering window; with
+ * flush_mutex. */
+static void
+output_buffer (OMX_COMPONENTTYPE *comp,
+               OMX_BUFFERHEADERTYPE *out_buffer)
+{
+    CompPrivate *private;
+    OMX_BUFFERHEADERTYPE *buffer;
+
+    private = comp->pComponentPrivate;
+
+    if (private->config.reorder > 1)
+    {
+        g_queue_push_tail (private->held, out_buffer);
+
+        if (g_queue_get_length (private->held) < private->config.reorder &&
+            !(out_buffer->nFlags & OMX_BUFFERFLAG_EOS))
+        {
+            return;
+        }
+
+        /* EOS goes out after the rest. */
+        if (out_buffer->nFlags & OMX_BUFFERFLAG_EOS)
+            g_queue_pop_tail (private->held);
+        else
+            out_buffer = NULL;
+
+        while ((buffer = g_queue_pop_tail (private->held)))
+        {
+            private->callbacks->FillBufferDone (comp,
+                                                private->app_data, buffer);
+        }
+
+        if (!out_buffer)
+            goto leave;
+    }
+
+    private->callbacks->FillBufferDone (comp,
+                                        private->app_data, out_buffer);
+
+leave:
+    private->out_count++;
+
+    if (private->config.settings_changed_every &&
+        private->out_count % private->config.settings_changed_every == 0)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE *port_def;
+
+        port_def = &private->ports[1].port_def;
+        port_def->nBufferCountActual += private->config.settings_changed_grow;
+        port_def->nBufferCountMin += private->config.settings_changed_grow;
+
+        private->callbacks->EventHandler (comp,
+                                          private->app_data, OMX_EventPortSettingsChanged,
+                                          1, 0, NULL);
+    }
+}
+
+/* Holds the thread back to honour the configured delay and throughput. */
+static inline void
+pace (CompPrivate *private,
+      GTimer *timer,
+      guint64 bytes)
+{
+    if (private->config.delay)
+        g_usleep (private->config.delay);
+
+    if (private->config.throughput)
+    {
+        gdouble wanted;
+        gdouble elapsed;
+
+        wanted = (gdouble) bytes / private->config.throughput;
+        elapsed = g_timer_elapsed (timer, NULL);
+
+        if (wanted > elapsed)
+            g_usleep ((gulong) ((wanted - elapsed) * G_USEC_PER_SEC));
+    }
+}
+
 static gpointer
 foo_thread (gpointer cb_data)
 {
     OMX_COMPONENTTYPE *comp;
     CompPrivate *private;
+    GTimer *timer;
+    guint64 bytes = 0;
 
     comp = cb_data;
     private = comp->pComponentPrivate;
 
+    timer = g_timer_new ();
+
     while (!private->done)
     {
         OMX_BUFFERHEADERTYPE *in_buffer;
         OMX_BUFFERHEADERTYPE *out_buffer;
+        gboolean input_done = FALSE;
+        unsigned long size;
+
+        g_mutex_lock (private->flush_mutex);
+        in_buffer = private->current;
+        g_mutex_unlock (private->flush_mutex);
+
+        if (!in_buffer)
+        {
+            in_buffer = async_queue_pop (private->ports[0].queue);
+            if (!in_buffer) continue;
 
-        in_buffer = async_queue_pop (private->ports[0].queue);
-        if (!in_buffer) continue;
+            g_mutex_lock (private->flush_mutex);
+            private->current = in_buffer;
+            g_mutex_unlock (private->flush_mutex);
+        }
 
         out_buffer = async_queue_pop (private->ports[1].queue);
         if (!out_buffer) continue;
 
+        g_mutex_lock (private->flush_mutex);
+
+        /* Flushed while we waited for an output buffer. */
+        if (private->current != in_buffer)
+        {
+            async_queue_push (private->ports[1].queue, out_buffer);
+            g_mutex_unlock (private->flush_mutex);
+            continue;
+        }
+
         /* process buffers */
         {
-            unsigned long size;
             size = MIN (in_buffer->nFilledLen, out_buffer->nAllocLen);
-            memcpy (out_buffer->pBuffer, in_buffer->pBuffer, size);
+            memcpy (out_buffer->pBuffer, in_buffer->pBuffer + in_buffer->nOffset, size);
+            out_buffer->nOffset = 0;
             out_buffer->nFilledLen = size;
+            in_buffer->nOffset += size;
             in_buffer->nFilledLen -= size;
             out_buffer->nTimeStamp = in_buffer->nTimeStamp;
-            out_buffer->nFlags = in_buffer->nFlags;
+            out_buffer->nFlags = in_buffer->nFilledLen == 0 ? in_buffer->nFlags : 0;
         }
 
-        g_mutex_lock (private->flush_mutex);
+        output_buffer (comp, out_buffer);
 
-        private->callbacks->FillBufferDone (comp,
-                                            private->app_data, out_buffer);
         if (in_buffer->nFilledLen == 0)
         {
+            private->current = NULL;
             private->callbacks->EmptyBufferDone (comp,
                                                  private->app_data, in_buffer);
+            input_done = TRUE;
+            private->in_count++;
+
+            if (private->in_count == private->config.error_after)
+            {
+                private->callbacks->EventHandler (comp,
+                                                  private->app_data, OMX_EventError,
+                                                  private->config.error_code, 0, NULL);
+            }
         }
 
         g_mutex_unlock (private->flush_mutex);
+
+        bytes += size;
+
+        if (input_done)
+            pace (private, timer, bytes);
     }
 
+    g_timer_destroy (timer);
+
     return NULL;
 }
 
@@ -336,8 +591,12 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
     comp->GetState = comp_GetState;
     comp->GetParameter = comp_GetParameter;
     comp->SetParameter = comp_SetParameter;
+    comp->GetConfig = comp_GetConfig;
+    comp->SetConfig = comp_SetConfig;
+    comp->GetExtensionIndex = comp_GetExtensionIndex;
     comp->SendCommand = comp_SendCommand;
     comp->UseBuffer = comp_UseBuffer;
+    comp->AllocateBuffer = comp_AllocateBuffer;
     comp->FreeBuffer = comp_FreeBuffer;
     comp->EmptyThisBuffer = comp_EmptyThisBuffer;
     comp->FillThisBuffer = comp_FillThisBuffer;
@@ -351,6 +610,9 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
         private->app_data = data;
         private->ports = calloc (2, sizeof (CompPrivatePort));
         private->flush_mutex = g_mutex_new ();
+        private->held = g_queue_new ();
+
+        mock_config_load (&private->config, component_name);
 
         private->ports[0].queue = async_queue_new ();
         private->ports[1].queue = async_queue_new ();
@@ -363,9 +625,9 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
             port_def->nVersion.nVersion = 1;
             port_def->nPortIndex = 0;
             port_def->eDir = OMX_DirInput;
-            port_def->nBufferCountActual = 1;
-            port_def->nBufferCountMin = 1;
-            port_def->nBufferSize = 0x1000;
+            port_def->nBufferCountActual = private->config.in_buffer_count;
+            port_def->nBufferCountMin = private->config.in_buffer_count;
+            port_def->nBufferSize = private->config.in_buffer_size;
             port_def->eDomain = OMX_PortDomainAudio;
 
         }
@@ -378,9 +640,9 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
             port_def->nVersion.nVersion = 1;
             port_def->nPortIndex = 1;
             port_def->eDir = OMX_DirOutput;
-            port_def->nBufferCountActual = 1;
-            port_def->nBufferCountMin = 1;
-            port_def->nBufferSize = 0x1000;
+            port_def->nBufferCountActual = private->config.out_buffer_count;
+            port_def->nBufferCountMin = private->config.out_buffer_count;
+            port_def->nBufferSize = private->config.out_buffer_size;
             port_def->eDomain = OMX_PortDomainAudio;
         }
 
@@ -395,6 +657,27 @@ OMX_GetHandle (OMX_HANDLETYPE *handle,
 OMX_ERRORTYPE
 OMX_FreeHandle (OMX_HANDLETYPE handle)
 {
-    /** @todo Free private structure? */
+    OMX_COMPONENTTYPE *comp;
+    CompPrivate *private;
+
+    comp = handle;
+    private = comp->pComponentPrivate;
+
+    if (private->thread)
+    {
+        private->done = TRUE;
+        async_queue_disable (private->ports[0].queue);
+        async_queue_disable (private->ports[1].queue);
+        g_thread_join (private->thread);
+    }
+
+    async_queue_free (private->ports[0].queue);
+    async_queue_free (private->ports[1].queue);
+    g_queue_free (private->held);
+    g_mutex_free (private->flush_mutex);
+    free (private->ports);
+    free (private);
+    free (comp);
+
     return OMX_ErrorNone;
 }
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "mock_config.h"
+
+#include <stdlib.h> /* For getenv, strtoul */
+
+typedef struct MockConfigKey MockConfigKey;
+
+struct MockConfigKey
+{
+    const gchar *name;
+    const gchar *env;
+    gsize offset;
+};
+
+#define KEY(name, env, field) { name, env, G_STRUCT_OFFSET (MockConfig, field) }
+
+static const MockConfigKey keys[] =
+{
+    KEY ("delay", "OMX_MOCK_DELAY", delay),
+    KEY ("throughput", "OMX_MOCK_THROUGHPUT", throughput),
+    KEY ("in-buffer-count", "OMX_MOCK_IN_BUFFER_COUNT", in_buffer_count),
+    KEY ("in-buffer-size", "OMX_MOCK_IN_BUFFER_SIZE", in_buffer_size),
+    KEY ("out-buffer-count", "OMX_MOCK_OUT_BUFFER_COUNT", out_buffer_count),
+    KEY ("out-buffer-size", "OMX_MOCK_OUT_BUFFER_SIZE", out_buffer_size),
+    KEY ("settings-changed-every", "OMX_MOCK_SETTINGS_CHANGED_EVERY", settings_changed_every),
+    KEY ("settings-changed-grow", "OMX_MOCK_SETTINGS_CHANGED_GROW", settings_changed_grow),
+    KEY ("reorder", "OMX_MOCK_REORDER", reorder),
+    KEY ("error-after", "OMX_MOCK_ERROR_AFTER", error_after),
+    KEY ("error-code", "OMX_MOCK_ERROR_CODE", error_code),
+};
+
+#undef KEY
+
+static inline void
+set_value (MockConfig *config,
+           const MockConfigKey *key,
+           guint value)
+{
+    if (key->offset == G_STRUCT_OFFSET (MockConfig, error_code))
+        config->error_code = (OMX_ERRORTYPE) value;
+    else
+        G_STRUCT_MEMBER (guint, config, key->offset) = value;
+}
+
+static void
+load_group (MockConfig *config,
+            GKeyFile *key_file,
+            const gchar *group)
+{
+    guint i;
+
+    if (!g_key_file_has_group (key_file, group))
+        return;
+
+    for (i = 0; i < G_N_ELEMENTS (keys); i++)
+    {
+        gchar *str;
+
+        str = g_key_file_get_value (key_file, group, keys[i].name, NULL);
+        if (str)
+        {
+            /* Error codes are easier to read in hex. */
+            set_value (config, &keys[i], strtoul (str, NULL, 0));
+            g_free (str);
+        }
+    }
+}
+
+void
+mock_config_load (MockConfig *config,
+                  const gchar *component_name)
+{
+    const gchar *file_name;
+    guint i;
+
+    config->delay = 0;
+    config->throughput = 0;
+    config->in_buffer_count = 1;
+    config->in_buffer_size = 0x1000;
+    config->out_buffer_count = 1;
+    config->out_buffer_size = 0x1000;
+    config->settings_changed_every = 0;
+    config->settings_changed_grow = 0;
+    config->reorder = 0;
+    config->error_after = 0;
+    config->error_code = OMX_ErrorHardware;
+
+    file_name = getenv ("OMX_MOCK_CONFIG");
+    if (file_name)
+    {
+        GKeyFile *key_file;
+        GError *error = NULL;
+
+        key_file = g_key_file_new ();
+
+        if (g_key_file_load_from_file (key_file, file_name, G_KEY_FILE_NONE, &error))
+        {
+            load_group (config, key_file, "mock");
+            if (component_name)
+                load_group (config, key_file, component_name);
+        }
+        else
+        {
+            g_warning ("couldn't load %s: %s", file_name, error->message);
+            g_error_free (error);
+        }
+
+        g_key_file_free (key_file);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (keys); i++)
+    {
+        const gchar *str;
+
+        str = getenv (keys[i].env);
+        if (str)
+            set_value (config, &keys[i], strtoul (str, NULL, 0));
+    }
+}
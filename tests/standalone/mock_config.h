@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef MOCK_CONFIG_H
+#define MOCK_CONFIG_H
+
+#include <OMX_Core.h>
+
+#include <glib.h>
+
+/* Behaviour of the mock component. The defaults give a plain one buffer in,
+ * one buffer out copy; everything can be changed through a key file named
+ * by OMX_MOCK_CONFIG (group "mock", then a group named after the
+ * component), and then through OMX_MOCK_<KEY> environment variables, e.g.
+ * OMX_MOCK_DELAY=5000 for the "delay" key. */
+
+typedef struct MockConfig MockConfig;
+
+struct MockConfig
+{
+    guint delay; /**< Microseconds spent on every input buffer. */
+    guint throughput; /**< Bytes per second; 0 doesn't cap it. */
+    guint in_buffer_count;
+    guint in_buffer_size;
+    guint out_buffer_count;
+    guint out_buffer_size;
+    guint settings_changed_every; /**< Output buffers between PortSettingsChanged events; 0 never. */
+    guint settings_changed_grow; /**< Output buffers the port asks for on top after each of them. */
+    guint reorder; /**< Output buffers held back and released in reverse order. */
+    guint error_after; /**< Input buffers before an OMX_EventError; 0 never. */
+    OMX_ERRORTYPE error_code;
+};
+
+void mock_config_load (MockConfig *config, const gchar *component_name);
+
+#endif /* MOCK_CONFIG_H */
@@ -63,6 +63,28 @@ async_queue_push (AsyncQueue *queue,
     g_mutex_unlock (queue->mutex);
 }
 
+static inline gpointer
+queue_pop_tail (AsyncQueue *queue)
+{
+    gpointer data = NULL;
+
+    if (queue->tail)
+    {
+        GList *node = queue->tail;
+        data = node->data;
+
+        queue->tail = node->prev;
+        if (queue->tail)
+            queue->tail->next = NULL;
+        else
+            queue->head = NULL;
+        queue->length--;
+        g_list_free_1 (node);
+    }
+
+    return data;
+}
+
 gpointer
 async_queue_pop (AsyncQueue *queue)
 {
@@ -81,19 +103,7 @@ async_queue_pop (AsyncQueue *queue)
         g_cond_wait (queue->condition, queue->mutex);
     }
 
-    if (queue->tail)
-    {
-        GList *node = queue->tail;
-        data = node->data;
-
-        queue->tail = node->prev;
-        if (queue->tail)
-            queue->tail->next = NULL;
-        else
-            queue->head = NULL;
-        queue->length--;
-        g_list_free_1 (node);
-    }
+    data = queue_pop_tail (queue);
 
 leave:
     g_mutex_unlock (queue->mutex);
@@ -102,26 +112,51 @@ leave:
 }
 
 gpointer
-async_queue_pop_forced (AsyncQueue *queue)
+async_queue_pop_timed (AsyncQueue *queue,
+                       GTimeVal *end_time)
 {
     gpointer data = NULL;
 
     g_mutex_lock (queue->mutex);
 
-    if (queue->tail)
+    while (queue->enabled && !queue->tail)
     {
-        GList *node = queue->tail;
-        data = node->data;
-
-        queue->tail = node->prev;
-        if (queue->tail)
-            queue->tail->next = NULL;
-        else
-            queue->head = NULL;
-        queue->length--;
-        g_list_free_1 (node);
+        if (!g_cond_timed_wait (queue->condition, queue->mutex, end_time))
+            break;
     }
 
+    if (queue->enabled)
+        data = queue_pop_tail (queue);
+
+    g_mutex_unlock (queue->mutex);
+
+    return data;
+}
+
+gpointer
+async_queue_try_pop (AsyncQueue *queue)
+{
+    gpointer data = NULL;
+
+    g_mutex_lock (queue->mutex);
+
+    if (queue->enabled)
+        data = queue_pop_tail (queue);
+
+    g_mutex_unlock (queue->mutex);
+
+    return data;
+}
+
+gpointer
+async_queue_pop_forced (AsyncQueue *queue)
+{
+    gpointer data = NULL;
+
+    g_mutex_lock (queue->mutex);
+
+    data = queue_pop_tail (queue);
+
     g_mutex_unlock (queue->mutex);
 
     return data;
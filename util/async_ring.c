@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+
+#include "async_ring.h"
+
+/*
+ * Every slot carries a sequence number; a producer may only write to a slot
+ * whose sequence equals its position, a consumer may only read from a slot
+ * whose sequence is its position + 1. Positions are claimed with a
+ * compare-and-exchange, so several producers and consumers can be active at
+ * the same time.
+ */
+
+static inline gboolean
+ring_try_push (AsyncRing *ring,
+               gpointer data)
+{
+    AsyncRingSlot *slot;
+    guint pos;
+
+    pos = (guint) g_atomic_int_get (&ring->tail);
+
+    while (TRUE)
+    {
+        gint diff;
+
+        slot = &ring->slots[pos & ring->mask];
+        diff = (gint) ((guint) g_atomic_int_get (&slot->sequence) - pos);
+
+        if (diff == 0)
+        {
+            if (g_atomic_int_compare_and_exchange (&ring->tail, (gint) pos, (gint) (pos + 1)))
+                break;
+        }
+        else if (diff < 0)
+        {
+            /* full */
+            return FALSE;
+        }
+
+        pos = (guint) g_atomic_int_get (&ring->tail);
+    }
+
+    slot->data = data;
+    g_atomic_int_set (&slot->sequence, (gint) (pos + 1));
+
+    return TRUE;
+}
+
+static inline gpointer
+ring_try_pop (AsyncRing *ring)
+{
+    AsyncRingSlot *slot;
+    gpointer data;
+    guint pos;
+
+    pos = (guint) g_atomic_int_get (&ring->head);
+
+    while (TRUE)
+    {
+        gint diff;
+
+        slot = &ring->slots[pos & ring->mask];
+        diff = (gint) ((guint) g_atomic_int_get (&slot->sequence) - (pos + 1));
+
+        if (diff == 0)
+        {
+            if (g_atomic_int_compare_and_exchange (&ring->head, (gint) pos, (gint) (pos + 1)))
+                break;
+        }
+        else if (diff < 0)
+        {
+            /* empty */
+            return NULL;
+        }
+
+        pos = (guint) g_atomic_int_get (&ring->head);
+    }
+
+    data = slot->data;
+    slot->data = NULL;
+    g_atomic_int_set (&slot->sequence, (gint) (pos + ring->mask + 1));
+
+    return data;
+}
+
+/* Claims every ready slot up to count with a single compare-and-exchange. */
+static inline guint
+ring_try_pop_many (AsyncRing *ring,
+                   gpointer *data,
+                   guint count)
+{
+    guint pos;
+    guint n;
+    guint i;
+
+    pos = (guint) g_atomic_int_get (&ring->head);
+
+    while (TRUE)
+    {
+        for (n = 0; n < count; n++)
+        {
+            AsyncRingSlot *slot;
+            gint diff;
+
+            slot = &ring->slots[(pos + n) & ring->mask];
+            diff = (gint) ((guint) g_atomic_int_get (&slot->sequence) - (pos + n + 1));
+
+            if (diff != 0)
+            {
+                /* empty */
+                if (n == 0 && diff < 0)
+                    return 0;
+                break;
+            }
+        }
+
+        if (n > 0 && g_atomic_int_compare_and_exchange (&ring->head, (gint) pos, (gint) (pos + n)))
+            break;
+
+        pos = (guint) g_atomic_int_get (&ring->head);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        AsyncRingSlot *slot;
+
+        slot = &ring->slots[(pos + i) & ring->mask];
+        data[i] = slot->data;
+        slot->data = NULL;
+        g_atomic_int_set (&slot->sequence, (gint) (pos + i + ring->mask + 1));
+    }
+
+    return n;
+}
+
+AsyncRing *
+async_ring_new (guint capacity)
+{
+    AsyncRing *ring;
+    guint i;
+
+    ring = g_slice_new0 (AsyncRing);
+
+    /* The sequence scheme needs at least two slots. */
+    ring->capacity = 2;
+    while (ring->capacity < capacity)
+        ring->capacity <<= 1;
+    ring->mask = ring->capacity - 1;
+
+    ring->slots = g_new0 (AsyncRingSlot, ring->capacity);
+    for (i = 0; i < ring->capacity; i++)
+        ring->slots[i].sequence = i;
+
+    ring->condition = g_cond_new ();
+    ring->mutex = g_mutex_new ();
+    ring->enabled = TRUE;
+
+    return ring;
+}
+
+void
+async_ring_free (AsyncRing *ring)
+{
+    g_cond_free (ring->condition);
+    g_mutex_free (ring->mutex);
+
+    g_free (ring->slots);
+    g_slice_free (AsyncRing, ring);
+}
+
+gboolean
+async_ring_push (AsyncRing *ring,
+                 gpointer data)
+{
+    if (G_UNLIKELY (!ring_try_push (ring, data)))
+        return FALSE;
+
+    if (g_atomic_int_get (&ring->waiters) > 0)
+    {
+        g_mutex_lock (ring->mutex);
+        g_cond_signal (ring->condition);
+        g_mutex_unlock (ring->mutex);
+    }
+
+    return TRUE;
+}
+
+gpointer
+async_ring_pop (AsyncRing *ring)
+{
+    return async_ring_pop_timed (ring, NULL);
+}
+
+gpointer
+async_ring_pop_timed (AsyncRing *ring,
+                      GTimeVal *end_time)
+{
+    gpointer data = NULL;
+
+    if (!g_atomic_int_get (&ring->enabled))
+    {
+        /* g_warning ("not enabled!"); */
+        return NULL;
+    }
+
+    data = ring_try_pop (ring);
+    if (G_LIKELY (data))
+        return data;
+
+    g_mutex_lock (ring->mutex);
+
+    /* Producers check for waiters after publishing, so once we are
+     * registered any push will either be seen by the retry below, or will
+     * signal us. */
+    g_atomic_int_inc (&ring->waiters);
+
+    while (g_atomic_int_get (&ring->enabled))
+    {
+        data = ring_try_pop (ring);
+        if (data)
+            break;
+
+        /* A NULL end_time waits forever. */
+        if (!g_cond_timed_wait (ring->condition, ring->mutex, end_time))
+        {
+            data = ring_try_pop (ring);
+            break;
+        }
+    }
+
+    g_atomic_int_add (&ring->waiters, -1);
+
+    g_mutex_unlock (ring->mutex);
+
+    return data;
+}
+
+gpointer
+async_ring_try_pop (AsyncRing *ring)
+{
+    if (!g_atomic_int_get (&ring->enabled))
+        return NULL;
+
+    return ring_try_pop (ring);
+}
+
+/* Doesn't wait; returns how many items were stored in data. */
+guint
+async_ring_pop_many (AsyncRing *ring,
+                     gpointer *data,
+                     guint count)
+{
+    if (!g_atomic_int_get (&ring->enabled) || count == 0)
+        return 0;
+
+    return ring_try_pop_many (ring, data, count);
+}
+
+gpointer
+async_ring_pop_forced (AsyncRing *ring)
+{
+    return ring_try_pop (ring);
+}
+
+guint
+async_ring_length (AsyncRing *ring)
+{
+    return (guint) g_atomic_int_get (&ring->tail) - (guint) g_atomic_int_get (&ring->head);
+}
+
+void
+async_ring_disable (AsyncRing *ring)
+{
+    g_mutex_lock (ring->mutex);
+    g_atomic_int_set (&ring->enabled, FALSE);
+    g_cond_broadcast (ring->condition);
+    g_mutex_unlock (ring->mutex);
+}
+
+void
+async_ring_enable (AsyncRing *ring)
+{
+    g_mutex_lock (ring->mutex);
+    g_atomic_int_set (&ring->enabled, TRUE);
+    g_mutex_unlock (ring->mutex);
+}
+
+void
+async_ring_flush (AsyncRing *ring)
+{
+    while (ring_try_pop (ring));
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2008 Nokia Corporation.
+ *
+ * Author: Felipe Contreras <felipe.contreras@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef ASYNC_RING_H
+#define ASYNC_RING_H
+
+#include <glib.h>
+
+/* Bounded version of AsyncQueue; push and pop don't allocate and don't take
+ * the mutex unless somebody is waiting for data. */
+
+typedef struct AsyncRing AsyncRing;
+typedef struct AsyncRingSlot AsyncRingSlot;
+
+struct AsyncRingSlot
+{
+    volatile gint sequence;
+    gpointer data;
+};
+
+struct AsyncRing
+{
+    AsyncRingSlot *slots;
+    guint capacity;
+    guint mask;
+    volatile gint head;
+    volatile gint tail;
+    volatile gint enabled;
+    volatile gint waiters;
+    GMutex *mutex;
+    GCond *condition;
+};
+
+AsyncRing *async_ring_new (guint capacity);
+void async_ring_free (AsyncRing *ring);
+gboolean async_ring_push (AsyncRing *ring, gpointer data);
+gpointer async_ring_pop (AsyncRing *ring);
+gpointer async_ring_pop_timed (AsyncRing *ring, GTimeVal *end_time);
+gpointer async_ring_try_pop (AsyncRing *ring);
+guint async_ring_pop_many (AsyncRing *ring, gpointer *data, guint count);
+gpointer async_ring_pop_forced (AsyncRing *ring);
+guint async_ring_length (AsyncRing *ring);
+void async_ring_disable (AsyncRing *ring);
+void async_ring_enable (AsyncRing *ring);
+void async_ring_flush (AsyncRing *ring);
+
+#endif /* ASYNC_RING_H */